@@ -1,77 +1,1614 @@
+// Gate card reader firmware (Arduino + MFRC522).
+//
+// The same file builds on Linux against the simulated board in reader/sim
+// (see reader/CMakeLists.txt), which is how its timing is benchmarked.
+// #ifndef-guarded settings can be overridden with -D for such builds.
+
 #include <SPI.h>
 #include <MFRC522.h>
+#include <EEPROM.h>
 
+// Readers share SCK/MOSI/MISO and RST; each has its own SS pin. Reader i
+// reports id READER_ID_BASE + i, so several boards can feed one host.
 #define RST_PIN 9
-#define SS_PIN 10
+#ifndef READER_SS_PIN_LIST
+#define READER_SS_PIN_LIST 10               // e.g. 10, 8, 7, 3
+#endif
+const byte READER_SS_PINS[] = { READER_SS_PIN_LIST };
+#define READER_COUNT (sizeof(READER_SS_PINS) / sizeof(READER_SS_PINS[0]))
+#define READER_ID_BASE 0
 
-MFRC522 mfrc522(SS_PIN, RST_PIN);
+// Optional MFRC522 IRQ wiring, one Arduino pin per entry of
+// READER_SS_PIN_LIST. A reader whose IRQ is on an external-interrupt pin
+// (2 or 3 on an Uno) is not polled: every IRQ_KICK_MS the firmware starts a
+// REQA without waiting for the answer, and anticollision/select only runs
+// once a card's ATQA fires the interrupt. 0 (the serial RX pin) means not
+// wired; those readers, and pins without an interrupt, keep polling.
+#ifndef READER_IRQ_PIN_LIST
+#define READER_IRQ_PIN_LIST 0               // e.g. 2, 3
+#endif
+const byte READER_IRQ_PINS[READER_COUNT] = { READER_IRQ_PIN_LIST };
+#ifndef IRQ_KICK_MS
+#define IRQ_KICK_MS 2
+#endif
 
-void setup() {
-  Serial.begin(9600);
-  while (!Serial);
-  SPI.begin();
-  mfrc522.PCD_Init();
-  Serial.println("RFID Reader Ready");
+// Serial starts in text mode at BOOT_BAUD, or in the format and at the
+// baud stored with "CFG SET". The host can switch to binary frames (and a
+// faster baud) for a session with "FMT BIN <baud>".
+#ifndef BOOT_BAUD
+#define BOOT_BAUD 9600
+#endif
+
+// Polling modes, for the whole board:
+//   ACTIVE  for ACTIVE_HOLD_MS after any card; every polled reader is polled
+//           each POLL_INTERVAL_MS (0 = on every loop(); "CFG SET POLL").
+//   IDLE    each empty poll doubles a reader's interval up to
+//           IDLE_POLL_MAX_MS, so quiet doors cost little bus time.
+//   SLEEP   after SLEEP_AFTER_MS without a card (0 = never): polled readers
+//           are soft powered down (PCD_SoftPowerDown, antenna and
+//           oscillator off) between polls and woken every SLEEP_POLL_MS.
+// IRQ-wired readers are kicked as before in every mode.
+//
+// MAX_DETECT_MS is the promised worst case from a card entering the field
+// to the REQA that finds it. Each mode's interval, plus the oscillator
+// restart after a sleep, must fit in it. Due readers are served earliest
+// deadline first, and a poll that still comes late is counted ("POLL").
+#ifndef POLL_INTERVAL_MS
+#define POLL_INTERVAL_MS 0
+#endif
+#ifndef IDLE_POLL_MAX_MS
+#define IDLE_POLL_MAX_MS 16
+#endif
+#ifndef ACTIVE_HOLD_MS
+#define ACTIVE_HOLD_MS 2000
+#endif
+#ifndef SLEEP_AFTER_MS
+#define SLEEP_AFTER_MS 60000
+#endif
+#ifndef SLEEP_POLL_MS
+#define SLEEP_POLL_MS 100
+#endif
+#ifndef MAX_DETECT_MS
+#define MAX_DETECT_MS 120
+#endif
+#define WAKE_MAX_MS 2                       // PCD_SoftPowerUp: oscillator restart
+static_assert(POLL_INTERVAL_MS <= IDLE_POLL_MAX_MS && IDLE_POLL_MAX_MS <= MAX_DETECT_MS,
+              "IDLE polling must meet MAX_DETECT_MS");
+static_assert(SLEEP_AFTER_MS == 0 || SLEEP_POLL_MS + WAKE_MAX_MS <= MAX_DETECT_MS,
+              "SLEEP polling must meet MAX_DETECT_MS");
+
+// Cards read per detection. After a card is selected and halted the reader
+// asks again (REQA), and keeps selecting until no unhalted card answers, so
+// two students tapping together or a wallet with two cards are read in one
+// cycle and leave in the same batch. 1 reads a single card per poll.
+#ifndef MULTI_TAG_MAX
+#define MULTI_TAG_MAX 4
+#endif
+
+// Card response timeout in MFRC522 timer ticks (25 us each). The library
+// default is 1000 ticks (25 ms), which every empty poll waits out in full;
+// cards answer REQA/anticollision within about a millisecond.
+#ifndef PICC_TIMEOUT_TICKS
+#define PICC_TIMEOUT_TICKS 200
+#endif
+// HLTA has no answer, so the library waits out the whole timeout after it.
+// ISO 14443-3 counts any answer within 1 ms of HLTA as a NAK; waiting
+// longer learns nothing.
+#ifndef HALT_TIMEOUT_TICKS
+#define HALT_TIMEOUT_TICKS 40
+#endif
+// MIFARE auth, read and write answer far later than REQA: a write's ACK
+// follows the card's EEPROM write, up to about 10 ms. The record exchange
+// runs under this timeout instead of PICC_TIMEOUT_TICKS.
+#ifndef RECORD_TIMEOUT_TICKS
+#define RECORD_TIMEOUT_TICKS 480
+#endif
+
+// Receiver gain in dB (RFCfgReg RxGain): 18, 23, 33, 38, 43 or 48. More
+// gain reads cards from further away, and also cards only passing by. 33
+// is the chip's reset value; "CFG SET GAIN" changes it at runtime.
+#ifndef RX_GAIN_DB
+#define RX_GAIN_DB 33
+#endif
+
+// Recently seen cards. A repeat of the same UID inside its hold-off window
+// is dropped; any other card is accepted immediately. DEBOUNCE_HOLD_MS is
+// the default window, "CFG SET DEBOUNCE" the runtime one.
+#ifndef DEBOUNCE_SLOTS
+#define DEBOUNCE_SLOTS 8
+#endif
+#ifndef DEBOUNCE_HOLD_MS
+#define DEBOUNCE_HOLD_MS 3000
+#endif
+
+// Accepted scans are kept in a RAM ring until the host acknowledges them,
+// so taps made while the host is restarting are delivered once it sends
+// HELLO again. Boards that auto-reset when the port is opened (Uno) lose
+// the ring on reconnect; disable auto-reset to keep it.
+// REQUIRE_ACK 0 restores the old fire-and-forget "UID:" output.
+#ifndef REQUIRE_ACK
+#define REQUIRE_ACK 1
+#endif
+#ifndef EVENT_LOG_CAPACITY
+#define EVENT_LOG_CAPACITY 24
+#endif
+// Student record cached on the card, so the host knows who tapped without
+// a UID lookup. When CARD_RECORD_BLOCK is set, a MIFARE Classic card (SAK
+// bit 3) is authenticated with key A and that data block is read after
+// select; a block whose checksum matches is reported with the UID. The
+// host writes it at issue time with "CARD WRITE". 0 disables the read.
+// Block: student ObjectId[12], class-group bitmap u16 LE, CRC-16 LE over
+// the UID and then bytes 0..13, so a block copied to another card fails.
+#ifndef CARD_RECORD_BLOCK
+#define CARD_RECORD_BLOCK 0                 // e.g. 4, the first block of sector 1
+#endif
+#define CARD_RECORD_SIZE 14
+#define CARD_WRITE_TIMEOUT_MS 10000
+static_assert(CARD_RECORD_BLOCK < 64 && CARD_RECORD_BLOCK % 4 != 3,
+              "the record needs a data block of a 1K card, not a sector trailer");
+
+// A binary batch event is at most 10 header + 10 UID bytes, plus the card
+// record when one is read. FRAME_MAX_PAYLOAD must fit in LEN's byte.
+#if CARD_RECORD_BLOCK
+#define EVENT_WIRE_MAX (20 + CARD_RECORD_SIZE)
+#ifndef FLUSH_BATCH_MAX
+#define FLUSH_BATCH_MAX 7
+#endif
+#else
+#define EVENT_WIRE_MAX 20
+#ifndef FLUSH_BATCH_MAX
+#define FLUSH_BATCH_MAX 8
+#endif
+#endif
+#define ACK_TIMEOUT_MS 500
+#define ACK_RETRIES 3
+
+#define OVERFLOW_DROP_OLDEST 0
+#define OVERFLOW_DROP_NEWEST 1
+#ifndef OVERFLOW_POLICY
+#define OVERFLOW_POLICY OVERFLOW_DROP_OLDEST
+#endif
+
+// Binary frame: SYNC LEN TYPE READER SEQ_LO SEQ_HI PAYLOAD... CRC_LO CRC_HI
+// LEN counts TYPE..PAYLOAD, CRC-16/CCITT-FALSE covers LEN..PAYLOAD.
+// The host-side decoder lives in reader/frame.h and must match this layout.
+#define FRAME_SYNC 0xA5
+#define FRAME_HEADER 4
+#define FRAME_MAX_PAYLOAD (5 + FLUSH_BATCH_MAX * EVENT_WIRE_MAX)
+#define FRAME_HAS_RECORD 0x80               // set in a batch event's size byte
+static_assert(FRAME_HEADER + FRAME_MAX_PAYLOAD <= 255, "a full batch must fit in one frame");
+#define FRAME_SCAN 0x01
+#define FRAME_BATCH 0x02
+#define FRAME_TEXT 0x7F
+
+#define CMD_MAX_LEN 64                      // fits CARD WRITE with a 10-byte UID
+
+// Hot-path timing, dumped by "STATS". Each stage keeps count, min, mean and
+// max in micros() plus a histogram with bucket upper bounds of
+// 64 us, 256 us, 1 ms, 4 ms, 16 ms and the rest.
+#define STAT_BUCKETS 6
+
+// Gate feedback from the local allowlist, shared by all readers on the
+// board. Pins 11-13 belong to SPI.
+#define GREEN_LED_PIN 5
+#define RED_LED_PIN 6
+#define BUZZER_PIN 4
+#define FEEDBACK_MS 300
+
+// EEPROM layout: bytes below ALLOWLIST_BASE are reserved for settings.
+// SETTINGS_ADDR: the Settings written by "CFG SET".
+// CARD_KEY_ADDR: CARD_KEY_MAGIC and the 6-byte record key set with
+// "CARD KEY"; without it the transport key FF..FF is used.
+// Allowlist header (AllowlistHeader: magic, mode, hashes, version, count), then
+// either a sorted array of 32-bit UID keys or a Bloom filter bitmap.
+// Version 0 means "not provisioned": no local verdict is given.
+#define ALLOWLIST_BASE 64
+#define ALLOWLIST_MAGIC 0xA11C
+#define ALLOWLIST_DATA (ALLOWLIST_BASE + sizeof(AllowlistHeader))
+#define ALLOWLIST_SORTED 0
+#define ALLOWLIST_BLOOM 1
+// A BLOOM rewrite zeroes the whole data area, about 1 KB at 3.3 ms per
+// byte written; loop() clears this many bytes per pass instead.
+#ifndef ALLOWLIST_CLEAR_WRITES
+#define ALLOWLIST_CLEAR_WRITES 2
+#endif
+#define CARD_KEY_ADDR 56
+#define CARD_KEY_MAGIC 0xC4
+#define SETTINGS_ADDR 0
+#define SETTINGS_MAGIC 0x5E
+
+MFRC522 readers[READER_COUNT];
+
+struct ReaderState {
+  unsigned long nextPollAt;   // next REQA kick for IRQ readers
+  unsigned long lastPollAt;
+  unsigned int interval;
+  bool irq;
+  bool asleep;                // soft powered down until its next poll
+};
+
+enum PollMode : byte { MODE_ACTIVE, MODE_IDLE, MODE_SLEEP, MODE_COUNT };
+
+// Names for POLL and STATS live in flash; copy one out with strcpy_P.
+const char MODE_NAMES[MODE_COUNT][7] PROGMEM = { "ACTIVE", "IDLE", "SLEEP" };
+
+byte pollMode = MODE_ACTIVE;  // from boot until ACTIVE_HOLD_MS passes without a card
+unsigned long lastCardAt = 0;
+unsigned long modeSince = 0;
+
+ReaderState readerState[READER_COUNT];
+byte lastPolled = READER_COUNT - 1;
+
+// Bit r is set by reader r's ISR; one ISR per reader since they take no
+// arguments.
+volatile byte irqPending = 0;
+static_assert(READER_COUNT <= 8, "irqPending holds one bit per reader");
+
+template <byte R>
+void onReaderIrq() {
+  irqPending |= 1 << R;
 }
 
-void loop() {
-  if (!mfrc522.PICC_IsNewCardPresent()) return;
-  if (!mfrc522.PICC_ReadCardSerial()) return;
+void (*const READER_ISRS[8])() = {
+  onReaderIrq<0>, onReaderIrq<1>, onReaderIrq<2>, onReaderIrq<3>,
+  onReaderIrq<4>, onReaderIrq<5>, onReaderIrq<6>, onReaderIrq<7>,
+};
+
+struct SeenCard {
+  byte size;                // 0 = free slot
+  byte reader;
+  byte uid[10];
+  unsigned long seenAt;
+  unsigned long holdMs;
+};
+
+struct ScanEvent {
+  uint32_t seq;
+  uint32_t at;              // millis() when the card was read
+  byte reader;
+  byte size;
+  byte uid[10];
+#if CARD_RECORD_BLOCK
+  bool hasRecord;
+  byte record[CARD_RECORD_SIZE];
+#endif
+};
+
+SeenCard seenCards[DEBOUNCE_SLOTS];
+
+ScanEvent eventLog[EVENT_LOG_CAPACITY];
+byte logHead = 0;           // oldest event
+byte logCount = 0;
+uint32_t nextEventSeq = 1;
+uint32_t droppedEvents = 0;
+
+bool hostReady = false;     // set by HELLO, cleared after ACK_RETRIES timeouts
+byte batchCount = 0;        // events in the unacknowledged batch
+unsigned long batchSentAt = 0;
+byte batchRetries = 0;
+
+bool binaryOutput = false;
+uint16_t frameSeq = 0;
+byte txBuf[2 + FRAME_HEADER + FRAME_MAX_PAYLOAD + 2];
+
+struct AllowlistHeader {
+  uint16_t magic;
+  byte mode;
+  byte hashes;
+  uint32_t version;
+  uint16_t count;
+};
 
-  Serial.print("UID:");
-  for (byte i = 0; i < mfrc522.uid.size; i++) {
-    Serial.print(mfrc522.uid.uidByte[i] < 0x10 ? "0" : "");
-    Serial.print(mfrc522.uid.uidByte[i], HEX);
+AllowlistHeader allowlist;
+bool allowlistSyncing = false;
+uint32_t allowlistNextVersion = 0;
+int allowlistClearAt = 0;   // next data byte a BLOOM rewrite clears, 0 = none
+unsigned long feedbackUntil = 0;
+bool feedbackOn = false;
+bool feedbackAllowed = false;
+
+#if CARD_RECORD_BLOCK
+MFRC522::MIFARE_Key cardKey;
+
+// One armed "CARD WRITE": the record goes to the card with this UID the
+// next time it is tapped on any reader.
+struct CardWrite {
+  byte size;                // 0 = none armed
+  byte uid[10];
+  byte record[CARD_RECORD_SIZE];
+  unsigned long armedAt;
+};
+
+CardWrite cardWrite;
+#endif
+
+// Runtime settings ("CFG"). The stored copy carries SETTINGS_MAGIC and a
+// CRC, so a blank or half-written block falls back to the defaults.
+struct Settings {
+  byte magic;
+  byte gainDb;
+  byte binary;              // output format at boot
+  byte reserved;
+  uint32_t baud;            // baud at boot
+  uint16_t debounceMs;
+  uint16_t pollIntervalMs;  // ACTIVE-mode poll interval
+  uint16_t crc;             // CRC-16 of the bytes before it
+};
+
+static_assert(SETTINGS_ADDR + sizeof(Settings) <= CARD_KEY_ADDR, "settings overlap the card key");
+
+Settings settings;
+
+// Gain in dB by RxGain field value; values 2 and 3 repeat 18 and 23 dB.
+const byte GAIN_DB[8] PROGMEM = { 18, 23, 18, 23, 33, 38, 43, 48 };
+// Rates both the board and a Linux host (reader/serial_port.cpp) can run.
+const uint32_t BAUD_RATES[] PROGMEM = { 9600, 19200, 38400, 57600, 115200, 230400, 500000, 1000000 };
+
+char cmdBuf[CMD_MAX_LEN];
+byte cmdLen = 0;
+bool cmdOverflow = false;
+
+enum Stage : byte {
+  STAGE_LOOP,               // one loop() pass
+  STAGE_DETECT,             // REQA: a poll's PICC_IsNewCardPresent or an IRQ kick
+  STAGE_SELECT,             // anticollision + select
+  STAGE_RECORD,             // authenticate + read of the card record block
+  STAGE_HALT,               // HLTA + StopCrypto1
+  STAGE_WAKE,               // PCD_SoftPowerUp of a sleeping reader
+  STAGE_ENCODE,             // building a batch or UID line, UART time excluded
+  STAGE_UART,               // blocked in Serial.write while the TX buffer drains
+  STAGE_COUNT
+};
+
+const char STAGE_NAMES[STAGE_COUNT][7] PROGMEM = {
+  "LOOP", "DETECT", "SELECT", "RECORD", "HALT", "WAKE", "ENCODE", "UART"
+};
+
+struct StageStats {
+  uint32_t count;
+  uint32_t totalUs;
+  uint32_t minUs;
+  uint32_t maxUs;
+  uint16_t buckets[STAT_BUCKETS];   // saturating
+};
+
+StageStats stageStats[STAGE_COUNT];
+uint32_t statSelectFailed = 0;      // a card answered REQA but select failed
+uint32_t statBatchResends = 0;
+uint32_t statHostTimeouts = 0;      // ACK_RETRIES exhausted
+uint32_t statDropped = 0;
+uint32_t statCmdOverflows = 0;
+uint32_t statNoRecord = 0;          // a Classic card without a readable, valid record
+uint32_t modeMs[MODE_COUNT];        // closed spells in each polling mode
+uint32_t statWakes = 0;
+uint32_t statLatePolls = 0;         // polls more than MAX_DETECT_MS after the last one
+unsigned long statMaxPollGapMs = 0;
+unsigned long statsSince = 0;
+unsigned long uartBusyUs = 0;       // running total, for ENCODE's UART exclusion
+
+void resetStats(unsigned long now) {
+  memset(stageStats, 0, sizeof(stageStats));
+  statSelectFailed = 0;
+  statBatchResends = 0;
+  statHostTimeouts = 0;
+  statDropped = 0;
+  statCmdOverflows = 0;
+  statNoRecord = 0;
+  memset(modeMs, 0, sizeof(modeMs));
+  modeSince = now;
+  statWakes = 0;
+  statLatePolls = 0;
+  statMaxPollGapMs = 0;
+  statsSince = now;
+}
+
+void recordStage(byte stage, unsigned long us) {
+  StageStats &st = stageStats[stage];
+  // A 32-bit total holds 71 minutes of loop time. Rather than wrap, this
+  // stage's count and total are halved, which keeps its mean; min, max,
+  // the histogram and the error counters are left alone.
+  if (us > 0xFFFFFFFFUL - st.totalUs) {
+    st.count /= 2;
+    st.totalUs /= 2;
   }
-  Serial.println();
-  
-  mfrc522.PICC_HaltA();
-  mfrc522.PCD_StopCrypto1();
-  delay(1000);
+  if (st.count == 0 || us < st.minUs) st.minUs = us;
+  if (us > st.maxUs) st.maxUs = us;
+  st.count++;
+  st.totalUs += us;
+
+  byte b = 0;
+  for (unsigned long limit = 64; b < STAT_BUCKETS - 1 && us >= limit; limit <<= 2) b++;
+  if (st.buckets[b] != 0xFFFF) st.buckets[b]++;
 }
 
+bool sameCard(const SeenCard &slot, byte reader, const MFRC522::Uid &uid) {
+  if (slot.size != uid.size || slot.reader != reader) return false;
+  for (byte i = 0; i < uid.size; i++) {
+    if (slot.uid[i] != uid.uidByte[i]) return false;
+  }
+  return true;
+}
+
+// Returns true when the card should be reported, and records it in the
+// table. Expired entries are treated as free. The same card at another
+// reader is a different door and is not suppressed.
+bool acceptCard(byte reader, const MFRC522::Uid &uid, unsigned long now, unsigned long holdMs) {
+  int freeSlot = -1;
+  byte oldest = 0;
 
+  for (byte i = 0; i < DEBOUNCE_SLOTS; i++) {
+    SeenCard &slot = seenCards[i];
+    if (slot.size == 0 || now - slot.seenAt >= slot.holdMs) {
+      if (freeSlot < 0) freeSlot = i;
+      continue;
+    }
+    if (sameCard(slot, reader, uid)) return false;
+    if (now - slot.seenAt > now - seenCards[oldest].seenAt) oldest = i;
+  }
 
+  SeenCard &slot = seenCards[freeSlot >= 0 ? freeSlot : oldest];
+  slot.size = uid.size;
+  slot.reader = reader;
+  memcpy(slot.uid, uid.uidByte, uid.size);
+  slot.seenAt = now;
+  slot.holdMs = holdMs;
+  return true;
+}
 
+uint16_t crc16(const byte *data, byte len, uint16_t crc = 0xFFFF) {
+  while (len--) {
+    crc ^= (unsigned int)(*data++) << 8;
+    for (byte bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
 
+// Serial.write returns once the bytes fit in the 64-byte TX buffer; the
+// time it blocks before that is the UART stage.
+void uartWrite(const byte *data, byte len) {
+  unsigned long start = micros();
+  Serial.write(data, len);
+  unsigned long us = micros() - start;
+  uartBusyUs += us;
+  recordStage(STAGE_UART, us);
+}
 
+// Frames are assembled in txBuf and handed to the UART in one write.
+// Callers fill framePayload() and then call sendFrame().
+byte *framePayload() {
+  return txBuf + 2 + FRAME_HEADER;
+}
 
+// The READER header byte is the board's first reader id, except in SCAN
+// frames where it is the reader that saw the card.
+void sendFrame(byte type, byte payloadLen, byte reader = READER_ID_BASE) {
+  txBuf[0] = FRAME_SYNC;
+  txBuf[1] = FRAME_HEADER + payloadLen;
+  txBuf[2] = type;
+  txBuf[3] = reader;
+  txBuf[4] = frameSeq & 0xFF;
+  txBuf[5] = frameSeq >> 8;
+  frameSeq++;
 
+  byte end = 2 + FRAME_HEADER + payloadLen;
+  uint16_t crc = crc16(txBuf + 1, end - 1);
+  txBuf[end] = crc & 0xFF;
+  txBuf[end + 1] = crc >> 8;
+  uartWrite(txBuf, end + 2);
+}
 
+// Status and command replies. Wrapped in a TEXT frame in binary mode so
+// the host decoder never sees raw ASCII between frames.
+void reply(const char *text) {
+  if (!binaryOutput) {
+    Serial.println(text);
+    return;
+  }
+  byte len = strlen(text);
+  if (len > FRAME_MAX_PAYLOAD) len = FRAME_MAX_PAYLOAD;
+  memcpy(framePayload(), text, len);
+  sendFrame(FRAME_TEXT, len);
+}
 
-#include <SPI.h>
-#include <MFRC522.h>
+// The same for a literal kept in flash, reply(F("OK ...")): string
+// literals would otherwise be copied into SRAM at startup.
+void reply(const __FlashStringHelper *text) {
+  if (!binaryOutput) {
+    Serial.println(text);
+    return;
+  }
+  PGM_P p = reinterpret_cast<PGM_P>(text);
+  byte len = strlen_P(p);
+  if (len > FRAME_MAX_PAYLOAD) len = FRAME_MAX_PAYLOAD;
+  memcpy_P(framePayload(), p, len);
+  sendFrame(FRAME_TEXT, len);
+}
 
-#define RST_PIN 9
-#define SS_PIN 10  // يجب أن يتصل هذا بالرجل SDA في القارئ
+byte putHex(byte *out, const byte *data, byte len) {
+  static const char hex[] PROGMEM = "0123456789ABCDEF";
+  for (byte i = 0; i < len; i++) {
+    *out++ = pgm_read_byte(&hex[data[i] >> 4]);
+    *out++ = pgm_read_byte(&hex[data[i] & 0x0F]);
+  }
+  return len * 2;
+}
+
+byte putDec(byte *out, uint32_t value) {
+  char digits[10];
+  byte n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  for (byte i = 0; i < n; i++) out[i] = digits[n - 1 - i];
+  return n;
+}
+
+byte putLe32(byte *out, uint32_t value) {
+  for (byte i = 0; i < 4; i++) out[i] = value >> (8 * i);
+  return 4;
+}
+
+// UID:<uid>[:<record>], or a SCAN frame whose payload is the UID followed
+// by the record, if any (the host tells them apart by length).
+void sendUid(byte reader, const byte *uid, byte size, const byte *record) {
+  if (binaryOutput) {
+    byte n = size;
+    memcpy(framePayload(), uid, size);
+    if (record) {
+      memcpy(framePayload() + n, record, CARD_RECORD_SIZE);
+      n += CARD_RECORD_SIZE;
+    }
+    sendFrame(FRAME_SCAN, n, reader);
+    return;
+  }
+
+  byte n = 0;
+  txBuf[n++] = 'U';
+  txBuf[n++] = 'I';
+  txBuf[n++] = 'D';
+  txBuf[n++] = ':';
+  n += putHex(txBuf + n, uid, size);
+  if (record) {
+    txBuf[n++] = ':';
+    n += putHex(txBuf + n, record, CARD_RECORD_SIZE);
+  }
+  txBuf[n++] = '\r';
+  txBuf[n++] = '\n';
+  uartWrite(txBuf, n);
+}
+
+// record is the card's validated record block, or NULL.
+void logEvent(byte reader, const MFRC522::Uid &uid, unsigned long now, const byte *record) {
+  if (logCount == EVENT_LOG_CAPACITY) {
+    droppedEvents++;
+    statDropped++;
+#if OVERFLOW_POLICY == OVERFLOW_DROP_NEWEST
+    return;
+#else
+    logHead = (logHead + 1) % EVENT_LOG_CAPACITY;
+    logCount--;
+    if (batchCount > 0) batchCount--;
+#endif
+  }
+
+  ScanEvent &ev = eventLog[(logHead + logCount) % EVENT_LOG_CAPACITY];
+  ev.seq = nextEventSeq++;
+  ev.at = now;
+  ev.reader = reader;
+  ev.size = uid.size;
+  memcpy(ev.uid, uid.uidByte, uid.size);
+#if CARD_RECORD_BLOCK
+  ev.hasRecord = record != NULL;
+  if (record) memcpy(ev.record, record, CARD_RECORD_SIZE);
+#else
+  (void)record;
+#endif
+  logCount++;
+}
+
+const byte *eventRecord(const ScanEvent &ev) {
+#if CARD_RECORD_BLOCK
+  return ev.hasRecord ? ev.record : NULL;
+#else
+  (void)ev;
+  return NULL;
+#endif
+}
+
+const ScanEvent &loggedEvent(byte i) {
+  return eventLog[(logHead + i) % EVENT_LOG_CAPACITY];
+}
+
+// Text batch:   BATCH:<count>:<now>  EVT:<seq>:<at>:<reader>:<uid>[:<record>]...
+//               END:<lastSeq>
+// Binary batch: one FRAME_BATCH with <now u32><count u8> then per event
+//               <seq u32><at u32><reader u8><size u8><uid...>[<record>]
+//               where FRAME_HAS_RECORD in size flags a record after the UID
+void sendBatch(byte count, unsigned long now) {
+  if (binaryOutput) {
+    byte *p = framePayload();
+    byte n = putLe32(p, now);
+    p[n++] = count;
+    for (byte i = 0; i < count; i++) {
+      const ScanEvent &ev = loggedEvent(i);
+      n += putLe32(p + n, ev.seq);
+      n += putLe32(p + n, ev.at);
+      const byte *record = eventRecord(ev);
+      p[n++] = ev.reader;
+      p[n++] = ev.size | (record ? FRAME_HAS_RECORD : 0);
+      memcpy(p + n, ev.uid, ev.size);
+      n += ev.size;
+      if (record) {
+        memcpy(p + n, record, CARD_RECORD_SIZE);
+        n += CARD_RECORD_SIZE;
+      }
+    }
+    sendFrame(FRAME_BATCH, n);
+    return;
+  }
+
+  byte n = 6;
+  memcpy_P(txBuf, PSTR("BATCH:"), 6);
+  n += putDec(txBuf + n, count);
+  txBuf[n++] = ':';
+  n += putDec(txBuf + n, now);
+  txBuf[n++] = '\r';
+  txBuf[n++] = '\n';
+  uartWrite(txBuf, n);
+
+  for (byte i = 0; i < count; i++) {
+    const ScanEvent &ev = loggedEvent(i);
+    n = 4;
+    memcpy_P(txBuf, PSTR("EVT:"), 4);
+    n += putDec(txBuf + n, ev.seq);
+    txBuf[n++] = ':';
+    n += putDec(txBuf + n, ev.at);
+    txBuf[n++] = ':';
+    n += putDec(txBuf + n, ev.reader);
+    txBuf[n++] = ':';
+    n += putHex(txBuf + n, ev.uid, ev.size);
+    if (eventRecord(ev)) {
+      txBuf[n++] = ':';
+      n += putHex(txBuf + n, eventRecord(ev), CARD_RECORD_SIZE);
+    }
+    txBuf[n++] = '\r';
+    txBuf[n++] = '\n';
+    uartWrite(txBuf, n);
+  }
+
+  n = 4;
+  memcpy_P(txBuf, PSTR("END:"), 4);
+  n += putDec(txBuf + n, loggedEvent(count - 1).seq);
+  txBuf[n++] = '\r';
+  txBuf[n++] = '\n';
+  uartWrite(txBuf, n);
+}
+
+// Sends the oldest events as one batch and re-sends it until the host
+// acknowledges. After ACK_RETRIES silent timeouts the host is considered
+// gone and events accumulate until the next HELLO.
+void flushEvents(unsigned long now) {
+#if !REQUIRE_ACK
+  (void)now;
+  while (logCount > 0) {
+    const ScanEvent &ev = loggedEvent(0);
+    unsigned long start = micros(), uartBefore = uartBusyUs;
+    sendUid(ev.reader, ev.uid, ev.size, eventRecord(ev));
+    recordStage(STAGE_ENCODE, micros() - start - (uartBusyUs - uartBefore));
+    logHead = (logHead + 1) % EVENT_LOG_CAPACITY;
+    logCount--;
+  }
+#else
+  if (!hostReady || logCount == 0) return;
+
+  if (batchCount > 0) {
+    if (now - batchSentAt < ACK_TIMEOUT_MS) return;
+    if (++batchRetries > ACK_RETRIES) {
+      hostReady = false;
+      batchCount = 0;
+      statHostTimeouts++;
+      return;
+    }
+    statBatchResends++;
+  } else {
+    batchRetries = 0;
+  }
+
+  batchCount = logCount < FLUSH_BATCH_MAX ? logCount : FLUSH_BATCH_MAX;
+  unsigned long start = micros(), uartBefore = uartBusyUs;
+  sendBatch(batchCount, now);
+  recordStage(STAGE_ENCODE, micros() - start - (uartBusyUs - uartBefore));
+  batchSentAt = now;
+#endif
+}
+
+// Drops every logged event up to and including seq.
+void ackEvents(uint32_t seq) {
+  while (logCount > 0 && (int32_t)(loggedEvent(0).seq - seq) <= 0) {
+    logHead = (logHead + 1) % EVENT_LOG_CAPACITY;
+    logCount--;
+  }
+  batchCount = 0;
+  batchRetries = 0;
+}
+
+// FNV-1a over the whole UID. 4-byte UIDs are the common case; longer
+// ones collide with negligible probability for a list this size.
+uint32_t uidKey(const byte *uid, byte size) {
+  uint32_t h = 2166136261UL;
+  for (byte i = 0; i < size; i++) {
+    h ^= uid[i];
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+uint16_t allowlistCapacity() {
+  return (EEPROM.length() - ALLOWLIST_DATA) / 4;
+}
+
+uint32_t allowlistBloomBits() {
+  return (uint32_t)(EEPROM.length() - ALLOWLIST_DATA) * 8;
+}
 
-MFRC522 mfrc522(SS_PIN, RST_PIN);
+uint32_t allowlistKeyAt(uint16_t i) {
+  uint32_t key;
+  EEPROM.get(ALLOWLIST_DATA + i * 4, key);
+  return key;
+}
+
+// Index of the first entry >= key.
+uint16_t allowlistLowerBound(uint32_t key) {
+  uint16_t lo = 0, hi = allowlist.count;
+  while (lo < hi) {
+    uint16_t mid = (lo + hi) / 2;
+    if (allowlistKeyAt(mid) < key) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// Double hashing: bit i = h1 + i * h2 over the whole data area.
+uint32_t bloomBit(uint32_t key, byte i) {
+  uint32_t h2 = ((key >> 16) | (key << 16)) * 0x9E3779B1UL | 1;
+  return (key + i * h2) % allowlistBloomBits();
+}
+
+bool allowlistContains(uint32_t key) {
+  if (allowlist.mode == ALLOWLIST_BLOOM) {
+    for (byte i = 0; i < allowlist.hashes; i++) {
+      uint32_t bit = bloomBit(key, i);
+      if (!(EEPROM.read(ALLOWLIST_DATA + bit / 8) & (1 << (bit % 8)))) return false;
+    }
+    return true;
+  }
+  uint16_t i = allowlistLowerBound(key);
+  return i < allowlist.count && allowlistKeyAt(i) == key;
+}
+
+bool allowlistAdd(uint32_t key) {
+  if (allowlist.mode == ALLOWLIST_BLOOM) {
+    for (byte i = 0; i < allowlist.hashes; i++) {
+      uint32_t bit = bloomBit(key, i);
+      int addr = ALLOWLIST_DATA + bit / 8;
+      EEPROM.update(addr, EEPROM.read(addr) | (1 << (bit % 8)));
+    }
+    allowlist.count++;
+    return true;
+  }
+
+  uint16_t pos = allowlistLowerBound(key);
+  if (pos < allowlist.count && allowlistKeyAt(pos) == key) return true;
+  if (allowlist.count >= allowlistCapacity()) return false;
+
+  // The host sends a rewrite in key order, so this loop only runs for
+  // the adds of a small delta.
+  for (uint16_t i = allowlist.count; i > pos; i--) {
+    EEPROM.put(ALLOWLIST_DATA + i * 4, allowlistKeyAt(i - 1));
+  }
+  EEPROM.put(ALLOWLIST_DATA + pos * 4, key);
+  allowlist.count++;
+  return true;
+}
+
+bool allowlistRemove(uint32_t key) {
+  if (allowlist.mode == ALLOWLIST_BLOOM) return false;
+
+  uint16_t pos = allowlistLowerBound(key);
+  if (pos >= allowlist.count || allowlistKeyAt(pos) != key) return true;
+  for (uint16_t i = pos; i + 1 < allowlist.count; i++) {
+    EEPROM.put(ALLOWLIST_DATA + i * 4, allowlistKeyAt(i + 1));
+  }
+  allowlist.count--;
+  return true;
+}
+
+void saveAllowlistHeader() {
+  EEPROM.put(ALLOWLIST_BASE, allowlist);
+}
+
+void loadAllowlist() {
+  EEPROM.get(ALLOWLIST_BASE, allowlist);
+  bool valid = allowlist.magic == ALLOWLIST_MAGIC &&
+               (allowlist.mode == ALLOWLIST_SORTED || allowlist.mode == ALLOWLIST_BLOOM) &&
+               allowlist.count <= (allowlist.mode == ALLOWLIST_SORTED ? allowlistCapacity() : 0xFFFF);
+  if (!valid) {
+    allowlist.magic = ALLOWLIST_MAGIC;
+    allowlist.mode = ALLOWLIST_SORTED;
+    allowlist.hashes = 0;
+    allowlist.version = 0;
+    allowlist.count = 0;
+  }
+}
+
+// A sorted list needs no clearing; a Bloom bitmap is zeroed by
+// serviceAllowlistClear() over the next loop() passes.
+void clearAllowlist(byte mode, byte hashes) {
+  allowlist.mode = mode;
+  allowlist.hashes = hashes;
+  allowlist.count = 0;
+  if (mode == ALLOWLIST_BLOOM) allowlistClearAt = ALLOWLIST_DATA;
+}
+
+// Zeroes up to ALLOWLIST_CLEAR_WRITES set bytes of the bitmap, skipping
+// the ones already clear, and opens the sync once the area is done.
+void serviceAllowlistClear() {
+  if (!allowlistClearAt) return;
+  byte written = 0;
+  while (allowlistClearAt < (int)EEPROM.length() && written < ALLOWLIST_CLEAR_WRITES) {
+    if (EEPROM.read(allowlistClearAt)) {
+      EEPROM.write(allowlistClearAt, 0);
+      written++;
+    }
+    allowlistClearAt++;
+  }
+  if (allowlistClearAt < (int)EEPROM.length()) return;
+  allowlistClearAt = 0;
+  allowlistSyncing = true;
+  reply(F("OK AL BEGIN"));
+}
+
+byte parseHex(const char *text, byte *out, byte maxLen) {
+  byte n = 0;
+  while (text[0] && text[1] && n < maxLen) {
+    char digits[3] = { text[0], text[1], '\0' };
+    char *end;
+    out[n++] = strtoul(digits, &end, 16);
+    if (*end) return 0;
+    text += 2;
+  }
+  return *text ? 0 : n;
+}
+
+// Delta sync, one reply per line:
+//   AL VER                                -> OK AL <version> <count> <mode> <capacity>
+//   AL BEGIN <base> <new> [BLOOM <k>]     base 0 = full rewrite
+//   AL + <uid> / AL - <uid>               add / remove (remove: sorted only)
+//   AL END                                commits <new>
+// The stored version is 0 while a sync is open, so a reset mid-sync
+// forces the host to start over with a full rewrite. A BLOOM rewrite
+// answers OK AL BEGIN once its bitmap is cleared, a few seconds later;
+// until then other AL commands but VER get ERR AL BUSY.
+void cmdAllowlist(char *op) {
+  char text[48];
+
+  if (allowlistClearAt && !(op && strcmp_P(op, PSTR("VER")) == 0)) {
+    reply(F("ERR AL BUSY"));
+  } else if (op && strcmp_P(op, PSTR("VER")) == 0) {
+    snprintf_P(text, sizeof(text), PSTR("OK AL %lu %u %u %u"), (unsigned long)allowlist.version,
+               allowlist.count, allowlist.mode, allowlistCapacity());
+    reply(text);
+  } else if (op && strcmp_P(op, PSTR("BEGIN")) == 0) {
+    char *base = strtok(NULL, " ");
+    char *next = strtok(NULL, " ");
+    char *mode = strtok(NULL, " ");
+    char *hashes = strtok(NULL, " ");
+    if (!base || !next || strtoul(next, NULL, 10) == 0) {
+      reply(F("ERR AL ARGS"));
+      return;
+    }
+    uint32_t baseVersion = strtoul(base, NULL, 10);
+    if (baseVersion == 0) {
+      bool bloom = mode && strcmp_P(mode, PSTR("BLOOM")) == 0;
+      byte k = hashes ? atoi(hashes) : 0;
+      if (bloom && (k < 1 || k > 16)) {
+        reply(F("ERR AL ARGS"));
+        return;
+      }
+      clearAllowlist(bloom ? ALLOWLIST_BLOOM : ALLOWLIST_SORTED, bloom ? k : 0);
+    } else if (baseVersion != allowlist.version) {
+      reply(F("ERR AL VERSION"));
+      return;
+    }
+    allowlistNextVersion = strtoul(next, NULL, 10);
+    allowlist.version = 0;
+    saveAllowlistHeader();
+    if (allowlistClearAt) return;
+    allowlistSyncing = true;
+    reply(F("OK AL BEGIN"));
+  } else if (op && (strcmp_P(op, PSTR("+")) == 0 || strcmp_P(op, PSTR("-")) == 0)) {
+    char *hex = strtok(NULL, " ");
+    byte uid[10];
+    byte size = hex ? parseHex(hex, uid, sizeof(uid)) : 0;
+    if (!allowlistSyncing || size == 0) {
+      reply(F("ERR AL ARGS"));
+      return;
+    }
+    uint32_t key = uidKey(uid, size);
+    bool ok = op[0] == '+' ? allowlistAdd(key) : allowlistRemove(key);
+    reply(ok ? F("OK") : (op[0] == '+' ? F("ERR AL FULL") : F("ERR AL BLOOM")));
+  } else if (op && strcmp_P(op, PSTR("END")) == 0) {
+    if (!allowlistSyncing) {
+      reply(F("ERR AL ARGS"));
+      return;
+    }
+    allowlistSyncing = false;
+    allowlist.version = allowlistNextVersion;
+    saveAllowlistHeader();
+    reply(F("OK AL END"));
+  } else {
+    reply(F("ERR AL ARGS"));
+  }
+}
+
+// Local verdict at the gate. Nothing is signalled until the host has
+// provisioned a list, so an empty reader never denies everyone.
+// firstOfCycle is false for the further cards of one readCards() cycle.
+void signalVerdict(const MFRC522::Uid &uid, unsigned long now, bool firstOfCycle) {
+  if (allowlist.version == 0) return;
+
+  bool allowed = allowlistContains(uidKey(uid.uidByte, uid.size));
+  // Within one multi-card read any allowed card wins: the bank card next
+  // to a student card in a wallet must not turn the gate red.
+  if (!allowed && !firstOfCycle && feedbackOn && feedbackAllowed) return;
+  feedbackAllowed = allowed;
+  digitalWrite(GREEN_LED_PIN, allowed ? HIGH : LOW);
+  digitalWrite(RED_LED_PIN, allowed ? LOW : HIGH);
+  digitalWrite(BUZZER_PIN, allowed ? LOW : HIGH);
+  feedbackOn = true;
+  feedbackUntil = now + FEEDBACK_MS;
+}
+
+void updateFeedback(unsigned long now) {
+  if (!feedbackOn || (long)(now - feedbackUntil) < 0) return;
+  digitalWrite(GREEN_LED_PIN, LOW);
+  digitalWrite(RED_LED_PIN, LOW);
+  digitalWrite(BUZZER_PIN, LOW);
+  feedbackOn = false;
+}
+
+void setPiccTimeout(MFRC522 &rfid, uint16_t ticks) {
+  rfid.PCD_WriteRegister(MFRC522::TReloadRegH, ticks >> 8);
+  rfid.PCD_WriteRegister(MFRC522::TReloadRegL, ticks & 0xFF);
+}
+
+#if CARD_RECORD_BLOCK
+void loadCardKey() {
+  if (EEPROM.read(CARD_KEY_ADDR) != CARD_KEY_MAGIC) {
+    memset(cardKey.keyByte, 0xFF, sizeof(cardKey.keyByte));
+    return;
+  }
+  for (byte i = 0; i < MFRC522::MF_KEY_SIZE; i++) cardKey.keyByte[i] = EEPROM.read(CARD_KEY_ADDR + 1 + i);
+}
+
+uint16_t recordCrc(const MFRC522::Uid &uid, const byte *record) {
+  return crc16(record, CARD_RECORD_SIZE, crc16(uid.uidByte, uid.size));
+}
+
+// Crypto1 stays on for the record's sector until the StopCrypto1 after HLTA.
+bool authRecordSector(MFRC522 &rfid) {
+  return rfid.PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A, CARD_RECORD_BLOCK, &cardKey, &rfid.uid) ==
+         MFRC522::STATUS_OK;
+}
+
+// block needs 18 bytes (16 + the card's CRC_A). True if the checksum
+// matches this card's UID.
+bool readRecordBlock(MFRC522 &rfid, byte *block) {
+  byte len = 18;
+  if (rfid.MIFARE_Read(CARD_RECORD_BLOCK, block, &len) != MFRC522::STATUS_OK) return false;
+  uint16_t crc = recordCrc(rfid.uid, block);
+  return block[CARD_RECORD_SIZE] == (crc & 0xFF) && block[CARD_RECORD_SIZE + 1] == crc >> 8;
+}
+
+// Fills record for a MIFARE Classic card that carries a valid one. Other
+// card types are not asked: they cannot hold it.
+bool readCardRecord(MFRC522 &rfid, byte *record) {
+  if (!(rfid.uid.sak & 0x08)) return false;
+  unsigned long start = micros();
+  byte block[18];
+  setPiccTimeout(rfid, RECORD_TIMEOUT_TICKS);
+  bool ok = authRecordSector(rfid) && readRecordBlock(rfid, block);
+  setPiccTimeout(rfid, PICC_TIMEOUT_TICKS);
+  recordStage(STAGE_RECORD, micros() - start);
+  if (!ok) {
+    statNoRecord++;
+    return false;
+  }
+  memcpy(record, block, CARD_RECORD_SIZE);
+  return true;
+}
+
+bool isCardToWrite(const MFRC522::Uid &uid) {
+  return cardWrite.size != 0 && cardWrite.size == uid.size && memcmp(cardWrite.uid, uid.uidByte, uid.size) == 0;
+}
+
+// result is a PSTR.
+void replyCardWrite(PGM_P result) {
+  char text[40];
+  memcpy_P(text, PSTR("CARD "), 5);
+  byte n = 5 + putHex((byte *)text + 5, cardWrite.uid, cardWrite.size);
+  text[n++] = ' ';
+  strncpy_P(text + n, result, sizeof(text) - n - 1);
+  text[sizeof(text) - 1] = '\0';
+  reply(text);
+  cardWrite.size = 0;
+}
+
+// Writes the armed record to the selected card and reads it back.
+void writeCardRecord(MFRC522 &rfid) {
+  byte block[18];
+  memcpy(block, cardWrite.record, CARD_RECORD_SIZE);
+  uint16_t crc = recordCrc(rfid.uid, block);
+  block[CARD_RECORD_SIZE] = crc & 0xFF;
+  block[CARD_RECORD_SIZE + 1] = crc >> 8;
+  setPiccTimeout(rfid, RECORD_TIMEOUT_TICKS);
+  bool ok = (rfid.uid.sak & 0x08) && authRecordSector(rfid) &&
+            rfid.MIFARE_Write(CARD_RECORD_BLOCK, block, 16) == MFRC522::STATUS_OK &&
+            readRecordBlock(rfid, block) && memcmp(block, cardWrite.record, CARD_RECORD_SIZE) == 0;
+  setPiccTimeout(rfid, PICC_TIMEOUT_TICKS);
+  replyCardWrite(ok ? PSTR("OK") : PSTR("ERR"));
+}
+
+void expireCardWrite(unsigned long now) {
+  if (cardWrite.size != 0 && now - cardWrite.armedAt >= CARD_WRITE_TIMEOUT_MS) replyCardWrite(PSTR("TIMEOUT"));
+}
+#else
+bool readCardRecord(MFRC522 &, byte *) { return false; }
+bool isCardToWrite(const MFRC522::Uid &) { return false; }
+void writeCardRecord(MFRC522 &) {}
+void expireCardWrite(unsigned long) {}
+#endif
+
+// Card records, CARD_RECORD_BLOCK builds only:
+//   CARD KEY <12 hex>                    key A of the record's sector, kept in EEPROM
+//   CARD WRITE <uid> <student> <groups>  student: 24 hex ObjectId, groups: 16-bit
+//                                        bitmap in hex; armed for that card's next
+//                                        tap on any reader, for CARD_WRITE_TIMEOUT_MS
+// Both answer at once. The write itself ends with an unsolicited
+// "CARD <uid> OK|ERR|TIMEOUT", so replies to other commands stay in order
+// while the card is on its way to the reader.
+void cmdCard(char *op) {
+#if CARD_RECORD_BLOCK
+  if (op && strcmp_P(op, PSTR("KEY")) == 0) {
+    char *hex = strtok(NULL, " ");
+    byte key[MFRC522::MF_KEY_SIZE];
+    if (!hex || parseHex(hex, key, sizeof(key)) != sizeof(key)) {
+      reply(F("ERR CARD ARGS"));
+      return;
+    }
+    EEPROM.update(CARD_KEY_ADDR, CARD_KEY_MAGIC);
+    for (byte i = 0; i < sizeof(key); i++) EEPROM.update(CARD_KEY_ADDR + 1 + i, key[i]);
+    memcpy(cardKey.keyByte, key, sizeof(key));
+    reply(F("OK CARD KEY"));
+  } else if (op && strcmp_P(op, PSTR("WRITE")) == 0) {
+    char *uid = strtok(NULL, " ");
+    char *student = strtok(NULL, " ");
+    char *groups = strtok(NULL, " ");
+    char *end = NULL;
+    unsigned long bits = groups ? strtoul(groups, &end, 16) : 0;
+    CardWrite next;
+    next.size = uid ? parseHex(uid, next.uid, sizeof(next.uid)) : 0;
+    if (next.size == 0 || !student || parseHex(student, next.record, 12) != 12 || !groups || *end ||
+        bits > 0xFFFF) {
+      reply(F("ERR CARD ARGS"));
+      return;
+    }
+    if (cardWrite.size != 0) {
+      reply(F("ERR CARD BUSY"));
+      return;
+    }
+    next.record[12] = bits & 0xFF;
+    next.record[13] = bits >> 8;
+    next.armedAt = millis();
+    cardWrite = next;
+    reply(F("OK CARD WRITE"));
+  } else {
+    reply(F("ERR CARD ARGS"));
+  }
+#else
+  (void)op;
+  reply(F("ERR CARD DISABLED"));
+#endif
+}
+
+bool isBaudRate(unsigned long baud) {
+  for (byte i = 0; i < sizeof(BAUD_RATES) / sizeof(BAUD_RATES[0]); i++) {
+    if (pgm_read_dword(&BAUD_RATES[i]) == baud) return true;
+  }
+  return false;
+}
+
+// "FMT BIN <baud>" / "FMT TXT <baud>". The reply goes out at the old
+// setting; the host switches its side once it has seen it. The baud is
+// optional and, like CFG SET BAUD, one of BAUD_RATES: a rate the host
+// cannot open would leave the board unreachable until a power cycle.
+void cmdFormat(char *mode, char *baudArg) {
+  long baud = baudArg ? atol(baudArg) : 0;
+  if (!mode || (strcmp_P(mode, PSTR("BIN")) != 0 && strcmp_P(mode, PSTR("TXT")) != 0) ||
+      (baudArg && !isBaudRate(baud))) {
+    reply(F("ERR FMT"));
+    return;
+  }
+
+  reply(F("OK FMT"));
+  Serial.flush();
+  binaryOutput = strcmp_P(mode, PSTR("BIN")) == 0;
+  if (baud > 0) {
+    Serial.end();
+    Serial.begin(baud);
+  }
+}
+
+// "STATS" answers with one line per stage,
+//   STAT <stage> <count> <min> <mean> <max> <h64> <h256> <h1m> <h4m> <h16m> <hmore>
+// (times in us), then
+//   STAT ERR <selectFailed> <batchResends> <hostTimeouts> <dropped> <cmdOverflows> <noRecord>
+//   OK STATS <ms since reset>
+// "STATS RESET" zeroes everything and answers OK STATS RESET.
+void cmdStats(char *arg) {
+  unsigned long now = millis();
+  if (arg && strcmp_P(arg, PSTR("RESET")) == 0) {
+    resetStats(now);
+    reply(F("OK STATS RESET"));
+    return;
+  } else if (arg) {
+    reply(F("ERR STATS ARGS"));
+    return;
+  }
+
+  char text[96];
+  char name[sizeof(STAGE_NAMES[0])];
+  for (byte s = 0; s < STAGE_COUNT; s++) {
+    const StageStats &st = stageStats[s];
+    const uint16_t *h = st.buckets;
+    strcpy_P(name, STAGE_NAMES[s]);
+    snprintf_P(text, sizeof(text), PSTR("STAT %s %lu %lu %lu %lu %u %u %u %u %u %u"), name,
+               (unsigned long)st.count, (unsigned long)st.minUs,
+               (unsigned long)(st.count ? st.totalUs / st.count : 0), (unsigned long)st.maxUs,
+               h[0], h[1], h[2], h[3], h[4], h[5]);
+    reply(text);
+  }
+  snprintf_P(text, sizeof(text), PSTR("STAT ERR %lu %lu %lu %lu %lu %lu"), (unsigned long)statSelectFailed,
+             (unsigned long)statBatchResends, (unsigned long)statHostTimeouts,
+             (unsigned long)statDropped, (unsigned long)statCmdOverflows, (unsigned long)statNoRecord);
+  reply(text);
+  snprintf_P(text, sizeof(text), PSTR("OK STATS %lu"), now - statsSince);
+  reply(text);
+}
+
+// "POLL" answers
+//   OK POLL <mode> <activeMs> <idleMs> <sleepMs> <wakes> <latePolls> <maxGapMs> <maxDetectMs>
+// with the current mode, the time spent in each mode and the longest wait
+// between two polls of a reader since the last "STATS RESET".
+void cmdPoll() {
+  unsigned long now = millis();
+  uint32_t ms[MODE_COUNT];
+  memcpy(ms, modeMs, sizeof(ms));
+  ms[pollMode] += now - modeSince;
+
+  char text[96];
+  char mode[sizeof(MODE_NAMES[0])];
+  strcpy_P(mode, MODE_NAMES[pollMode]);
+  snprintf_P(text, sizeof(text), PSTR("OK POLL %s %lu %lu %lu %lu %lu %lu %u"), mode,
+             (unsigned long)ms[MODE_ACTIVE], (unsigned long)ms[MODE_IDLE], (unsigned long)ms[MODE_SLEEP],
+             (unsigned long)statWakes, (unsigned long)statLatePolls, statMaxPollGapMs, MAX_DETECT_MS);
+  reply(text);
+}
+
+// RxGain field value (already shifted) for a gain in dB, or -1.
+int gainMask(unsigned long db) {
+  for (byte i = 0; i < sizeof(GAIN_DB); i++) {
+    if (pgm_read_byte(&GAIN_DB[i]) == db) return i << 4;
+  }
+  return -1;
+}
+
+uint16_t settingsCrc(const Settings &s) {
+  return crc16((const byte *)&s, offsetof(Settings, crc));
+}
+
+void defaultSettings() {
+  memset(&settings, 0, sizeof(settings));
+  settings.magic = SETTINGS_MAGIC;
+  settings.gainDb = RX_GAIN_DB;
+  settings.baud = BOOT_BAUD;
+  settings.debounceMs = DEBOUNCE_HOLD_MS;
+  settings.pollIntervalMs = POLL_INTERVAL_MS;
+}
+
+void loadSettings() {
+  EEPROM.get(SETTINGS_ADDR, settings);
+  if (settings.magic != SETTINGS_MAGIC || settings.crc != settingsCrc(settings) ||
+      gainMask(settings.gainDb) < 0 || !isBaudRate(settings.baud) || settings.pollIntervalMs > IDLE_POLL_MAX_MS) {
+    defaultSettings();
+  }
+}
+
+// put() only rewrites the bytes that changed, at 3.3 ms each.
+void saveSettings() {
+  settings.crc = settingsCrc(settings);
+  EEPROM.put(SETTINGS_ADDR, settings);
+}
+
+void applyGain() {
+  for (byte r = 0; r < READER_COUNT; r++) readers[r].PCD_SetAntennaGain(gainMask(settings.gainDb));
+}
+
+// Polled readers restart from the new interval at once.
+void applyPollInterval(unsigned long now) {
+  for (byte r = 0; r < READER_COUNT; r++) {
+    readerState[r].interval = settings.pollIntervalMs;
+    if (!readerState[r].irq) readerState[r].nextPollAt = now;
+  }
+}
+
+// Runtime settings, kept in EEPROM and applied again at boot:
+//   CFG [GET]              OK CFG GAIN=<dB> DEBOUNCE=<ms> BAUD=<baud> POLL=<ms> FMT=<TXT|BIN>
+//   CFG SET <key> <value>  OK CFG SET <key> <value>, applied at once and stored
+//   CFG RESET              OK CFG RESET, the compile-time defaults applied and stored
+// GAIN is the receiver gain (RX_GAIN_DB), DEBOUNCE the repeat hold-off,
+// POLL the ACTIVE poll interval (0..IDLE_POLL_MAX_MS). BAUD (BAUD_RATES)
+// and FMT are the boot link: like "FMT", SET answers at the old setting
+// and switches after it, while RESET leaves the link alone until the next
+// boot. A session's "FMT" is not stored. Errors: ERR CFG ARGS, ERR CFG KEY
+// (unknown key), ERR CFG RANGE.
+void cmdConfig(char *op) {
+  char text[80];
+  if (!op || strcmp_P(op, PSTR("GET")) == 0) {
+    char format[4];
+    strcpy_P(format, settings.binary ? PSTR("BIN") : PSTR("TXT"));
+    snprintf_P(text, sizeof(text), PSTR("OK CFG GAIN=%u DEBOUNCE=%u BAUD=%lu POLL=%u FMT=%s"), settings.gainDb,
+               settings.debounceMs, (unsigned long)settings.baud, settings.pollIntervalMs, format);
+    reply(text);
+    return;
+  }
+  if (strcmp_P(op, PSTR("RESET")) == 0) {
+    defaultSettings();
+    saveSettings();
+    applyGain();
+    applyPollInterval(millis());
+    reply(F("OK CFG RESET"));
+    return;
+  }
+
+  char *key = strtok(NULL, " ");
+  char *value = strtok(NULL, " ");
+  if (strcmp_P(op, PSTR("SET")) != 0 || !key || !value) {
+    reply(F("ERR CFG ARGS"));
+    return;
+  }
+  char *end;
+  unsigned long n = strtoul(value, &end, 10);
+  bool number = *value >= '0' && *value <= '9' && *end == '\0';
+  bool ok;
+  if (strcmp_P(key, PSTR("GAIN")) == 0) {
+    ok = number && gainMask(n) >= 0;
+    if (ok) settings.gainDb = n;
+  } else if (strcmp_P(key, PSTR("DEBOUNCE")) == 0) {
+    ok = number && n <= 0xFFFF;
+    if (ok) settings.debounceMs = n;
+  } else if (strcmp_P(key, PSTR("POLL")) == 0) {
+    ok = number && n <= IDLE_POLL_MAX_MS;
+    if (ok) settings.pollIntervalMs = n;
+  } else if (strcmp_P(key, PSTR("BAUD")) == 0) {
+    ok = number && isBaudRate(n);
+    if (ok) settings.baud = n;
+  } else if (strcmp_P(key, PSTR("FMT")) == 0) {
+    ok = strcmp_P(value, PSTR("BIN")) == 0 || strcmp_P(value, PSTR("TXT")) == 0;
+    if (ok) settings.binary = strcmp_P(value, PSTR("BIN")) == 0;
+  } else {
+    reply(F("ERR CFG KEY"));
+    return;
+  }
+  if (!ok) {
+    reply(F("ERR CFG RANGE"));
+    return;
+  }
+
+  saveSettings();
+  snprintf_P(text, sizeof(text), PSTR("OK CFG SET %s %s"), key, value);
+  reply(text);
+  if (strcmp_P(key, PSTR("GAIN")) == 0) {
+    applyGain();
+  } else if (strcmp_P(key, PSTR("POLL")) == 0) {
+    applyPollInterval(millis());
+  } else if (strcmp_P(key, PSTR("BAUD")) == 0) {
+    Serial.flush();
+    Serial.end();
+    Serial.begin(settings.baud);
+  } else if (strcmp_P(key, PSTR("FMT")) == 0) {
+    Serial.flush();
+    binaryOutput = settings.binary;
+  }
+}
+
+void handleCommand(char *line) {
+  char *verb = strtok(line, " ");
+  if (!verb) return;
+
+  if (strcmp_P(verb, PSTR("FMT")) == 0) {
+    char *mode = strtok(NULL, " ");
+    cmdFormat(mode, strtok(NULL, " "));
+  } else if (strcmp_P(verb, PSTR("HELLO")) == 0) {
+    // A (re)connected host: resend anything unacknowledged from the start.
+    hostReady = true;
+    batchCount = 0;
+    char text[40];
+    snprintf_P(text, sizeof(text), PSTR("OK HELLO %u %lu"), logCount, (unsigned long)droppedEvents);
+    reply(text);
+  } else if (strcmp_P(verb, PSTR("ACK")) == 0) {
+    char *arg = strtok(NULL, " ");
+    if (arg) ackEvents(strtoul(arg, NULL, 10));
+  } else if (strcmp_P(verb, PSTR("AL")) == 0) {
+    cmdAllowlist(strtok(NULL, " "));
+  } else if (strcmp_P(verb, PSTR("STATS")) == 0) {
+    cmdStats(strtok(NULL, " "));
+  } else if (strcmp_P(verb, PSTR("CARD")) == 0) {
+    cmdCard(strtok(NULL, " "));
+  } else if (strcmp_P(verb, PSTR("POLL")) == 0) {
+    cmdPoll();
+  } else if (strcmp_P(verb, PSTR("CFG")) == 0) {
+    cmdConfig(strtok(NULL, " "));
+  } else if (strcmp_P(verb, PSTR("PING")) == 0) {
+    reply(F("OK PONG"));
+  } else {
+    reply(F("ERR UNKNOWN"));
+  }
+}
+
+// Non-blocking line reader for host commands. Over-long lines are dropped
+// whole rather than executed truncated.
+void pollCommands() {
+  while (Serial.available() > 0) {
+    char c = Serial.read();
+    if (c == '\r') continue;
+    if (c == '\n') {
+      cmdBuf[cmdLen] = '\0';
+      if (!cmdOverflow) handleCommand(cmdBuf);
+      cmdLen = 0;
+      cmdOverflow = false;
+    } else if (cmdLen < CMD_MAX_LEN - 1) {
+      cmdBuf[cmdLen++] = c;
+    } else {
+      if (!cmdOverflow) statCmdOverflows++;
+      cmdOverflow = true;
+    }
+  }
+}
 
 void setup() {
-  Serial.begin(9600);
+  loadSettings();
+  Serial.begin(settings.baud);
+  binaryOutput = settings.binary;
   while (!Serial);
-  SPI.begin();          // تهيئة بروتوكول SPI
-  mfrc522.PCD_Init();   // تهيئة القارئ
-  Serial.println("RFID Reader Ready");
+  pinMode(GREEN_LED_PIN, OUTPUT);
+  pinMode(RED_LED_PIN, OUTPUT);
+  pinMode(BUZZER_PIN, OUTPUT);
+  loadAllowlist();
+#if CARD_RECORD_BLOCK
+  loadCardKey();
+#endif
+
+  // Deselect every reader before the bus starts so none of them drives MISO.
+  for (byte r = 0; r < READER_COUNT; r++) {
+    pinMode(READER_SS_PINS[r], OUTPUT);
+    digitalWrite(READER_SS_PINS[r], HIGH);
+  }
+  SPI.begin();
+  for (byte r = 0; r < READER_COUNT; r++) {
+    readers[r].PCD_Init(READER_SS_PINS[r], RST_PIN);
+    setPiccTimeout(readers[r], PICC_TIMEOUT_TICKS);
+    readers[r].PCD_SetAntennaGain(gainMask(settings.gainDb));
+    readerState[r].nextPollAt = 0;
+    readerState[r].lastPollAt = 0;
+    readerState[r].interval = settings.pollIntervalMs;
+    readerState[r].asleep = false;
+
+    int irq = digitalPinToInterrupt(READER_IRQ_PINS[r]);
+    readerState[r].irq = READER_IRQ_PINS[r] != 0 && irq != NOT_AN_INTERRUPT;
+    if (readerState[r].irq) {
+      // The IRQ output is open drain; IRqInv makes it active low.
+      pinMode(READER_IRQ_PINS[r], INPUT_PULLUP);
+      readers[r].PCD_WriteRegister(MFRC522::ComIEnReg, 0xA0);   // IRqInv | RxIEn
+      attachInterrupt(irq, READER_ISRS[r], FALLING);
+    }
+  }
+  reply(F("RFID Reader Ready"));
 }
 
-void loop() {
-  if (!mfrc522.PICC_IsNewCardPresent()) return;
-  if (!mfrc522.PICC_ReadCardSerial()) return;
+// Earliest deadline first among the due readers, ties going round robin
+// from the reader polled last, so a reader with a queue of cards cannot
+// starve the others. Returns -1 if none is due.
+int nextDueReader(unsigned long now) {
+  int best = -1;
+  for (byte k = 1; k <= READER_COUNT; k++) {
+    byte r = (lastPolled + k) % READER_COUNT;
+    const ReaderState &state = readerState[r];
+    if (state.irq || (long)(now - state.nextPollAt) < 0) continue;
+    if (best < 0 || (long)(state.nextPollAt - readerState[best].nextPollAt) < 0) best = r;
+  }
+  if (best >= 0) lastPolled = best;
+  return best;
+}
+
+// Time in the current spell is added when the mode changes or is reported.
+void setPollMode(byte mode, unsigned long now) {
+  if (mode == pollMode) return;
+  modeMs[pollMode] += now - modeSince;
+  modeSince = now;
+  pollMode = mode;
+}
+
+void updatePollMode(unsigned long now) {
+  unsigned long quiet = now - lastCardAt;
+  if (quiet < ACTIVE_HOLD_MS) setPollMode(MODE_ACTIVE, now);
+  else if (SLEEP_AFTER_MS == 0 || quiet < SLEEP_AFTER_MS) setPollMode(MODE_IDLE, now);
+  else setPollMode(MODE_SLEEP, now);
+}
+
+// A tap at one door is likely followed by more: every polled reader goes
+// back to the full rate at once, not at its next backed-off poll.
+void noteCard(unsigned long now) {
+  lastCardAt = now;
+  if (pollMode == MODE_ACTIVE) return;
+  setPollMode(MODE_ACTIVE, now);
+  for (byte r = 0; r < READER_COUNT; r++) {
+    readerState[r].interval = settings.pollIntervalMs;
+    readerState[r].nextPollAt = now;
+  }
+}
+
+// Selects the card that answered the last REQA, gives feedback, logs it
+// (with its card record, if enabled) and halts it so it stays quiet until
+// it leaves the field. firstOfCycle is true for the first card of a
+// readCards() cycle.
+bool readCard(byte r, unsigned long now, bool firstOfCycle) {
+  MFRC522 &rfid = readers[r];
+  unsigned long start = micros();
+  bool selected = rfid.PICC_ReadCardSerial();
+  recordStage(STAGE_SELECT, micros() - start);
+  if (!selected) {
+    statSelectFailed++;
+    return false;
+  }
+
+  byte id = READER_ID_BASE + r;
+  if (isCardToWrite(rfid.uid)) {
+    // The card being issued at the desk: encode it rather than log a tap.
+    writeCardRecord(rfid);
+  } else {
+    // Repeats still get feedback: a student tapping twice wants an answer.
+    signalVerdict(rfid.uid, now, firstOfCycle);
+    if (acceptCard(id, rfid.uid, now, settings.debounceMs)) {
+      byte record[CARD_RECORD_SIZE];
+      logEvent(id, rfid.uid, now, readCardRecord(rfid, record) ? record : NULL);
+    }
+  }
+
+  start = micros();
+  setPiccTimeout(rfid, HALT_TIMEOUT_TICKS);
+  rfid.PICC_HaltA();
+  setPiccTimeout(rfid, PICC_TIMEOUT_TICKS);
+  rfid.PCD_StopCrypto1();
+  recordStage(STAGE_HALT, micros() - start);
+  return true;
+}
+
+bool detectCard(byte r) {
+  unsigned long start = micros();
+  bool present = readers[r].PICC_IsNewCardPresent();
+  recordStage(STAGE_DETECT, micros() - start);
+  return present;
+}
 
-  Serial.print("UID:");
-  for (byte i = 0; i < mfrc522.uid.size; i++) {
-    Serial.print(mfrc522.uid.uidByte[i] < 0x10 ? "0" : "");
-    Serial.print(mfrc522.uid.uidByte[i], HEX);
+// Reads every card in the field, up to MULTI_TAG_MAX, once one has
+// answered REQA. Halted cards stay silent, so each further REQA is
+// answered only by cards not read yet. Returns the number read.
+byte readCards(byte r, unsigned long now) {
+  byte count = 0;
+  while (readCard(r, now, count == 0)) {
+    if (++count >= MULTI_TAG_MAX || !detectCard(r)) break;
   }
-  Serial.println();
-  
-  mfrc522.PICC_HaltA();        // إيقاف البطاقة
-  mfrc522.PCD_StopCrypto1();   // إيقاف التشفير
-  delay(1000);                 // تأخير بسيط
+  return count;
 }
 
+void pollReader(byte r, unsigned long now) {
+  ReaderState &state = readerState[r];
+  unsigned long gap = now - state.lastPollAt;
+  if (gap > statMaxPollGapMs) statMaxPollGapMs = gap;
+  if (gap > MAX_DETECT_MS) statLatePolls++;
+  state.lastPollAt = now;
 
+  if (state.asleep) {
+    unsigned long start = micros();
+    readers[r].PCD_SoftPowerUp();
+    recordStage(STAGE_WAKE, micros() - start);
+    state.asleep = false;
+    statWakes++;
+  }
+
+  if (detectCard(r) && readCards(r, now) > 0) {
+    noteCard(now);
+    state.interval = settings.pollIntervalMs;
+  } else if (pollMode == MODE_SLEEP) {
+    readers[r].PCD_SoftPowerDown();
+    state.asleep = true;
+    state.interval = SLEEP_POLL_MS;
+  } else if (pollMode == MODE_IDLE) {
+    unsigned int next = state.interval ? state.interval * 2 : 1;
+    state.interval = next < IDLE_POLL_MAX_MS ? next : IDLE_POLL_MAX_MS;
+  } else {
+    state.interval = settings.pollIntervalMs;
+  }
+  state.nextPollAt = now + state.interval;
+}
+
+// Starts a REQA and returns at once. A card's ATQA sets RxIRq, which pulls
+// the IRQ pin low and runs the reader's ISR. Five register writes instead
+// of a poll's wait for the response timeout.
+void kickReader(MFRC522 &rfid) {
+  rfid.PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);        // clear all IRQ bits
+  rfid.PCD_WriteRegister(MFRC522::FIFOLevelReg, 0x80);     // flush the FIFO
+  rfid.PCD_WriteRegister(MFRC522::FIFODataReg, MFRC522::PICC_CMD_REQA);
+  rfid.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Transceive);
+  rfid.PCD_WriteRegister(MFRC522::BitFramingReg, 0x87);    // StartSend, 7-bit short frame
+}
+
+void serviceIrqReaders(unsigned long now) {
+  noInterrupts();
+  byte pending = irqPending;
+  irqPending = 0;
+  interrupts();
+
+  for (byte r = 0; r < READER_COUNT; r++) {
+    ReaderState &state = readerState[r];
+    if (!state.irq) continue;
 
-sudo usermod -a -G dialout $USER
-sudo chmod a+rw /dev/ttyACM0
+    if (pending & (1 << r)) {
+      if (readCards(r, now) > 0) noteCard(now);
+      // Select and halt are transceives too and may have raised the IRQ.
+      noInterrupts();
+      irqPending &= ~(1 << r);
+      interrupts();
+    } else if ((long)(now - state.nextPollAt) < 0) {
+      continue;
+    }
+    unsigned long start = micros();
+    kickReader(readers[r]);
+    recordStage(STAGE_DETECT, micros() - start);
+    state.nextPollAt = now + IRQ_KICK_MS;
+  }
+}
+
+void loop() {
+  unsigned long passStart = micros();
+  pollCommands();
+
+  unsigned long now = millis();
+  updatePollMode(now);
+  updateFeedback(now);
+  expireCardWrite(now);
+  serviceAllowlistClear();
+  flushEvents(now);
+  serviceIrqReaders(now);
+
+  // One reader per pass: commands, feedback and the flush above never
+  // wait behind a full sweep of the bus.
+  int r = nextDueReader(now);
+  if (r >= 0) pollReader(r, now);
+
+  recordStage(STAGE_LOOP, micros() - passStart);
+}
@@ -0,0 +1,96 @@
+// frame_bench: FrameDecoder throughput on a board's binary stream.
+//
+// The stream is the mix a busy board sends: full batches (8 events),
+// single scans and the odd text reply. It is fed in chunks of the given
+// sizes, as reads from the serial port would return it, clean and with
+// 1% of its bytes replaced by noise.
+//
+//   frame_bench [MB]        decode about MB megabytes per row (default 64)
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "frame.h"
+
+using namespace reader;
+
+namespace {
+
+double nowNs() {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void putLe32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++) p[i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+std::string boardStream(std::mt19937 &rng, size_t bytes) {
+  std::string stream;
+  uint8_t payload[kFrameMaxPayload], out[255 + kFrameOverhead];
+  uint32_t seq = 1;
+  while (stream.size() < bytes) {
+    size_t len = 0;
+    uint8_t type;
+    int kind = rng() % 16;
+    if (kind < 10) {
+      type = kFrameBatch;
+      putLe32(payload, seq * 40);
+      payload[4] = 8;
+      len = 5;
+      for (int e = 0; e < 8; e++, seq++) {
+        putLe32(payload + len, seq);
+        putLe32(payload + len + 4, seq * 40);
+        payload[len + 8] = 0;
+        payload[len + 9] = 4;
+        for (int b = 0; b < 4; b++) payload[len + 10 + b] = static_cast<uint8_t>(rng());
+        len += 14;
+      }
+    } else if (kind < 15) {
+      type = kFrameScan;
+      len = 4;
+      for (size_t b = 0; b < len; b++) payload[b] = static_cast<uint8_t>(rng());
+    } else {
+      type = kFrameText;
+      len = std::snprintf(reinterpret_cast<char *>(payload), sizeof(payload), "OK AL %u", seq);
+    }
+    size_t n = encodeFrame(type, 0, static_cast<uint16_t>(seq), payload, len, out);
+    stream.append(reinterpret_cast<const char *>(out), n);
+  }
+  return stream;
+}
+
+void run(const std::string &stream, size_t chunk, const char *label) {
+  uint64_t frames = 0;
+  FrameDecoder decoder([&](const Frame &) { frames++; });
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(stream.data());
+
+  double start = nowNs();
+  for (size_t pos = 0; pos < stream.size(); pos += chunk) {
+    decoder.feed(data + pos, std::min(chunk, stream.size() - pos));
+  }
+  double s = (nowNs() - start) / 1e9;
+
+  const FrameDecoder::Counters &c = decoder.counters();
+  std::printf("%-6s %6zu %9.1f %12.0f %10llu %10llu\n", label, chunk, stream.size() / s / 1e6, frames / s,
+              static_cast<unsigned long long>(c.crcErrors), static_cast<unsigned long long>(c.skippedBytes));
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  size_t mb = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+  std::mt19937 rng(1);
+  std::string clean = boardStream(rng, mb << 20);
+  std::string noisy = clean;
+  for (size_t i = 0; i < noisy.size() / 100; i++) noisy[rng() % noisy.size()] = static_cast<char>(rng());
+
+  std::printf("%-6s %6s %9s %12s %10s %10s\n", "stream", "chunk", "MB/s", "frames/s", "crc_errors", "skipped");
+  for (size_t chunk : {1u, 16u, 64u, 4096u}) run(clean, chunk, "clean");
+  for (size_t chunk : {1u, 16u, 64u, 4096u}) run(noisy, chunk, "noisy");
+  return 0;
+}
@@ -0,0 +1,376 @@
+// reader_bench: runs program-pcb.c++ on the simulated board and reports,
+// for that firmware build, how many scans per second reach the host,
+// tap-to-host latency, loop() pass time and bytes on the wire.
+//
+// The harness plays the host: it answers "RFID Reader Ready" with HELLO
+// (after "FMT BIN <baud>" with --binary) and acknowledges every batch
+// after --host-latency-us, like server.js or readerd would.
+//
+// Cards come from --timeline FILE ("<start_ms> <dwell_ms> <reader> <uid>"
+// per line) or from a generated rush: --rush N distinct cards, one every
+// --gap ms, spread over the board's readers, each held for --dwell ms.
+// --group K presents K cards together at the same reader, like a wallet
+// with two cards or two students tapping at once.
+//
+// Builds with CARD_RECORD_BLOCK write a student record into that block of
+// --provisioned PCT percent of the cards (default all), as "CARD WRITE"
+// would at issue time, and count the events that come with one.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "frame.h"
+#include "latency.h"
+#include "sim.h"
+#include "uid.h"
+
+void setup();
+void loop();
+
+#ifndef BENCH_CONFIG_NAME
+#define BENCH_CONFIG_NAME "default"
+#endif
+
+namespace {
+
+struct Options {
+  std::string timeline;
+  int rush = 200;
+  double gapMs = 250;
+  double dwellMs = 400;
+  int group = 1;
+  long binaryBaud = 0;
+  uint64_t hostLatencyUs = 2000;
+  double tailMs = 3000;           // keep running after the last card leaves
+  int provisionedPct = 100;
+};
+
+struct PendingHostWrite {
+  uint64_t dueUs;
+  std::string bytes;
+};
+
+class Bench {
+ public:
+  explicit Bench(Options opts)
+      : opts_(std::move(opts)),
+        decoder_([this](const reader::Frame &frame) { onFrame(frame); }) {}
+
+  int run();
+
+ private:
+  bool loadTimeline(uint64_t t0);
+  void buildRush(uint64_t t0);
+  void hostWrite(const std::string &line);
+  void pumpHost();
+  void onLine(const std::string &line);
+  void onFrame(const reader::Frame &frame);
+  void onText(const std::string &text);
+  void provisionCards();
+  void onEvent(uint8_t readerId, const reader::Uid &uid, bool hasRecord = false);
+
+  Options opts_;
+  reader::FrameDecoder decoder_;
+  bool binary_ = false;
+  std::string lineBuf_;
+  std::deque<PendingHostWrite> pending_;
+
+  size_t delivered_ = 0;
+  size_t duplicates_ = 0;
+  size_t withRecord_ = 0;
+  uint64_t firstStartUs_ = 0;
+  uint64_t lastDeliveryUs_ = 0;
+  reader::LatencyHistogram tapToHost_;
+  reader::LatencyHistogram loopTime_;
+  std::vector<bool> reported_;
+  std::vector<std::string> firmwareStats_;    // the board's own STATS and POLL replies
+  bool statsDone_ = false;
+};
+
+void Bench::hostWrite(const std::string &line) {
+  pending_.push_back({sim::nowUs() + opts_.hostLatencyUs, line + "\n"});
+}
+
+bool Bench::loadTimeline(uint64_t t0) {
+  std::ifstream in(opts_.timeline);
+  if (!in) return false;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream row(line);
+    double startMs, dwellMs;
+    int readerIndex;
+    std::string hex;
+    reader::Uid uid;
+    if (!(row >> startMs >> dwellMs >> readerIndex >> hex) || !reader::uidFromHex(hex, &uid)) {
+      std::fprintf(stderr, "reader_bench: bad timeline line: %s\n", line.c_str());
+      continue;
+    }
+    uint64_t start = t0 + static_cast<uint64_t>(startMs * 1000);
+    sim::addCard(readerIndex, uid.bytes, uid.len, start, start + static_cast<uint64_t>(dwellMs * 1000));
+  }
+  return true;
+}
+
+void Bench::buildRush(uint64_t t0) {
+  int readers = std::max(1, sim::readerCount());
+
+  for (int i = 0; i < opts_.rush; i++) {
+    int tap = i / opts_.group;
+    uint8_t uid[4] = {0x04, static_cast<uint8_t>(i >> 16), static_cast<uint8_t>(i >> 8),
+                      static_cast<uint8_t>(i)};
+    uint64_t start = t0 + static_cast<uint64_t>(tap * opts_.gapMs * 1000);
+    sim::addCard(tap % readers, uid, sizeof(uid), start, start + static_cast<uint64_t>(opts_.dwellMs * 1000));
+  }
+}
+
+// Same block layout and checksum as the firmware's CARD WRITE.
+void Bench::provisionCards() {
+#if defined(CARD_RECORD_BLOCK) && CARD_RECORD_BLOCK
+  std::vector<sim::Card> &cards = sim::cards();
+  for (size_t i = 0; i < cards.size(); i++) {
+    if (static_cast<int>(i % 100) >= opts_.provisionedPct) continue;
+    uint8_t *block = cards[i].blocks[CARD_RECORD_BLOCK];
+    block[0] = 0x5f;
+    for (int b = 0; b < 4; b++) block[8 + b] = static_cast<uint8_t>(i >> (24 - 8 * b));
+    block[12] = static_cast<uint8_t>(1 << (i % 8));
+    uint16_t crc = reader::crc16(block, reader::kCardRecordLen, reader::crc16(cards[i].uid, cards[i].uidLen));
+    block[14] = crc & 0xFF;
+    block[15] = crc >> 8;
+  }
+#endif
+}
+
+void Bench::pumpHost() {
+  while (!pending_.empty() && pending_.front().dueUs <= sim::nowUs()) {
+    sim::hostSend(pending_.front().bytes);
+    pending_.pop_front();
+  }
+
+  std::string tx = sim::takeTx();
+  if (tx.empty()) return;
+
+  if (binary_) {
+    decoder_.feed(reinterpret_cast<const uint8_t *>(tx.data()), tx.size());
+    return;
+  }
+
+  for (char c : tx) {
+    if (c == '\n') {
+      if (!lineBuf_.empty() && lineBuf_.back() == '\r') lineBuf_.pop_back();
+      std::string line;
+      line.swap(lineBuf_);
+      onLine(line);
+    } else {
+      lineBuf_ += c;
+    }
+  }
+}
+
+void Bench::onText(const std::string &text) {
+  if (text.compare(0, 17, "RFID Reader Ready") == 0) {
+    if (opts_.binaryBaud) hostWrite("FMT BIN " + std::to_string(opts_.binaryBaud));
+    else hostWrite("HELLO");
+  } else if (text == "OK FMT") {
+    binary_ = true;
+    hostWrite("HELLO");
+  } else if (text.compare(0, 5, "STAT ") == 0) {
+    firmwareStats_.push_back(text);
+  } else if (text.compare(0, 8, "OK STATS") == 0) {
+    firmwareStats_.push_back(text);
+  } else if (text.compare(0, 7, "OK POLL") == 0) {
+    firmwareStats_.push_back(text);
+    statsDone_ = true;
+  }
+}
+
+void Bench::onLine(const std::string &line) {
+  if (line.compare(0, 4, "UID:") == 0) {
+    // UID:<uid>[:<record>]
+    size_t c1 = line.find(':', 4);
+    reader::Uid uid;
+    if (reader::uidFromHex(line.substr(4, c1 - 4), &uid)) onEvent(0, uid, c1 != std::string::npos);
+  } else if (line.compare(0, 4, "EVT:") == 0) {
+    // EVT:<seq>:<at>:<reader>:<uid>[:<record>]
+    size_t c1 = line.find(':', 4), c2 = line.find(':', c1 + 1), c3 = line.find(':', c2 + 1);
+    size_t c4 = c3 == std::string::npos ? c3 : line.find(':', c3 + 1);
+    reader::Uid uid;
+    if (c3 != std::string::npos && reader::uidFromHex(line.substr(c3 + 1, c4 - c3 - 1), &uid)) {
+      onEvent(static_cast<uint8_t>(std::atoi(line.c_str() + c2 + 1)), uid, c4 != std::string::npos);
+    }
+  } else if (line.compare(0, 4, "END:") == 0) {
+    hostWrite("ACK " + line.substr(4));
+  } else {
+    onText(line);
+  }
+}
+
+void Bench::onFrame(const reader::Frame &frame) {
+  if (frame.type == reader::kFrameScan) {
+    bool hasRecord = frame.payloadLen > sizeof(reader::Uid::bytes);
+    size_t uidLen = frame.payloadLen - (hasRecord ? reader::kCardRecordLen : 0);
+    onEvent(frame.reader, reader::uidFromBytes(frame.payload, uidLen), hasRecord);
+  } else if (frame.type == reader::kFrameBatch) {
+    uint32_t now;
+    std::vector<reader::ScanEvent> events;
+    if (!reader::decodeBatch(frame, &now, &events) || events.empty()) return;
+    for (const reader::ScanEvent &ev : events) {
+      onEvent(ev.reader, reader::uidFromBytes(ev.uid, ev.uidLen), ev.hasRecord);
+    }
+    hostWrite("ACK " + std::to_string(events.back().seq));
+  } else if (frame.type == reader::kFrameText) {
+    onText(std::string(reinterpret_cast<const char *>(frame.payload), frame.payloadLen));
+  }
+}
+
+// Matches the event to the earliest unreported presence of that card.
+void Bench::onEvent(uint8_t readerId, const reader::Uid &uid, bool hasRecord) {
+  uint64_t deliveredAt = sim::txIdleAtUs();
+  std::vector<sim::Card> &cards = sim::cards();
+  for (size_t i = 0; i < cards.size(); i++) {
+    const sim::Card &card = cards[i];
+    if (reported_[i] || card.reader != readerId || card.startUs > sim::nowUs() ||
+        card.uidLen != uid.len || std::memcmp(card.uid, uid.bytes, uid.len) != 0) {
+      continue;
+    }
+    reported_[i] = true;
+    delivered_++;
+    withRecord_ += hasRecord;
+    tapToHost_.record(deliveredAt - card.startUs);
+    lastDeliveryUs_ = std::max(lastDeliveryUs_, deliveredAt);
+    return;
+  }
+  duplicates_++;
+}
+
+int Bench::run() {
+  sim::reset();
+#ifdef READER_IRQ_PIN_LIST
+  // Same wiring as the firmware build, in reader order.
+  const int irqPins[] = {READER_IRQ_PIN_LIST};
+  for (size_t r = 0; r < sizeof(irqPins) / sizeof(irqPins[0]); r++) sim::wireIrq(static_cast<int>(r), irqPins[r]);
+#endif
+  setup();
+  pumpHost();
+
+  uint64_t t0 = sim::nowUs() + 10000;
+  if (!opts_.timeline.empty()) {
+    if (!loadTimeline(t0)) {
+      std::fprintf(stderr, "reader_bench: cannot read %s\n", opts_.timeline.c_str());
+      return 1;
+    }
+  } else {
+    buildRush(t0);
+  }
+
+  provisionCards();
+  std::vector<sim::Card> &cards = sim::cards();
+  reported_.assign(cards.size(), false);
+  uint64_t lastEnd = t0;
+  firstStartUs_ = cards.empty() ? t0 : cards.front().startUs;
+  for (const sim::Card &card : cards) {
+    lastEnd = std::max(lastEnd, card.endUs);
+    firstStartUs_ = std::min(firstStartUs_, card.startUs);
+  }
+  uint64_t endUs = lastEnd + static_cast<uint64_t>(opts_.tailMs * 1000);
+
+  uint64_t passes = 0;
+  uint64_t busyAtStart = sim::readerBusyUs();
+  uint64_t downAtStart = sim::poweredDownUs();
+  uint64_t bytesAtStart = sim::txBytes();
+  while (sim::nowUs() < endUs) {
+    uint64_t before = sim::nowUs();
+    loop();
+    sim::advanceUs(sim::timing().loopOverhead);
+    loopTime_.record(sim::nowUs() - before);
+    passes++;
+    pumpHost();
+  }
+
+  double spanS = (std::max(lastDeliveryUs_, firstStartUs_ + 1) - firstStartUs_) / 1e6;
+  double runS = (sim::nowUs() - firstStartUs_) / 1e6;
+  uint64_t bytes = sim::txBytes() - bytesAtStart;
+  uint64_t busyUs = sim::readerBusyUs() - busyAtStart;
+  uint64_t downUs = sim::poweredDownUs() - downAtStart;
+
+  // The firmware's view of the same run; not counted in the numbers above.
+  hostWrite("STATS");
+  hostWrite("POLL");
+  uint64_t statsDeadline = sim::nowUs() + 1000000;
+  while (!statsDone_ && sim::nowUs() < statsDeadline) {
+    loop();
+    sim::advanceUs(sim::timing().loopOverhead);
+    pumpHost();
+  }
+
+
+  reader::LatencyHistogram tapToSelect;
+  for (const sim::Card &card : cards) {
+    if (card.selectedUs) tapToSelect.record(card.selectedUs - card.startUs);
+  }
+
+  std::printf("config            %s\n", BENCH_CONFIG_NAME);
+  std::printf("cards             %zu presented, %zu delivered, %zu missed, %zu duplicate events\n",
+              cards.size(), delivered_, cards.size() - delivered_, duplicates_);
+#if defined(CARD_RECORD_BLOCK) && CARD_RECORD_BLOCK
+  std::printf("card records      %zu of %zu delivered\n", withRecord_, delivered_);
+#endif
+  std::printf("scans/s           %.2f\n", delivered_ / spanS);
+  std::printf("tap->select       %s\n", tapToSelect.summary().c_str());
+  std::printf("tap->host         %s\n", tapToHost_.summary().c_str());
+  std::printf("loop() pass       %s, %llu passes\n", loopTime_.summary().c_str(),
+              static_cast<unsigned long long>(passes));
+  std::printf("reader bus busy   %.1f%%\n", 100.0 * busyUs / (runS * 1e6));
+  std::printf("powered down      %.1f%% of reader time\n",
+              100.0 * downUs / (runS * 1e6 * std::max(1, sim::readerCount())));
+  std::printf("wire              %llu bytes at %lu baud, %.1f bytes/scan\n",
+              static_cast<unsigned long long>(bytes), sim::baud(),
+              delivered_ ? static_cast<double>(bytes) / delivered_ : 0.0);
+  for (const std::string &line : firmwareStats_) std::printf("firmware          %s\n", line.c_str());
+  return delivered_ == cards.size() ? 0 : 3;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options opts;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const char *v = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (arg == "--timeline" && v) {
+      opts.timeline = v;
+    } else if (arg == "--rush" && v) {
+      opts.rush = std::atoi(v);
+    } else if (arg == "--gap" && v) {
+      opts.gapMs = std::atof(v);
+    } else if (arg == "--dwell" && v) {
+      opts.dwellMs = std::atof(v);
+    } else if (arg == "--group" && v) {
+      opts.group = std::max(1, std::atoi(v));
+    } else if (arg == "--binary" && v) {
+      opts.binaryBaud = std::atol(v);
+    } else if (arg == "--host-latency-us" && v) {
+      opts.hostLatencyUs = std::strtoull(v, nullptr, 10);
+    } else if (arg == "--tail" && v) {
+      opts.tailMs = std::atof(v);
+    } else if (arg == "--provisioned" && v) {
+      opts.provisionedPct = std::atoi(v);
+    } else {
+      std::fprintf(stderr,
+                   "usage: %s [--timeline FILE | --rush N --gap MS --dwell MS --group K]\n"
+                   "          [--binary BAUD] [--host-latency-us US] [--tail MS] [--provisioned PCT]\n",
+                   argv[0]);
+      return 2;
+    }
+    i++;
+  }
+  Bench bench(std::move(opts));
+  return bench.run();
+}
@@ -0,0 +1,195 @@
+// scan_log_bench: what the scan log costs per tap and what a report costs
+// once taps live in the log rather than one Attendance document each.
+//
+// A center of 2000 students and 200 classes taps about 5500 times a day
+// for --days days (default 180), in nearly time order (buffered taps come
+// up to a minute late). Segments are small (256k records) so rotation is
+// part of the append figure. Reported: append, sync, reopen, recovery of
+// a crashed writer's unsynced tail (a forked child that exits without
+// syncing), day and month reports through the time index against a scan
+// of the whole log, one student's month, and export to Attendance rows.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "scan_log.h"
+
+using namespace reader;
+
+namespace {
+
+constexpr uint64_t kDayMs = 24ull * 3600 * 1000;
+constexpr uint64_t kEpochMs = 1767225600000ull;    // 2026-01-01 UTC
+constexpr int kStudents = 2000;
+constexpr int kClasses = 200;
+constexpr int kTapsPerDay = 5500;
+
+double nowNs() {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ObjectId makeId(uint32_t prefix, uint32_t n) {
+  ObjectId id;
+  for (int i = 0; i < 4; i++) id.bytes[i] = static_cast<uint8_t>(prefix >> (24 - 8 * i));
+  for (int i = 0; i < 4; i++) id.bytes[8 + i] = static_cast<uint8_t>(n >> (24 - 8 * i));
+  return id;
+}
+
+std::vector<ScanRecord> makeTaps(int days) {
+  std::mt19937 rng(12);
+  std::vector<ScanRecord> taps;
+  taps.reserve(static_cast<size_t>(days) * kTapsPerDay);
+  for (int day = 0; day < days; day++) {
+    uint64_t dayStart = kEpochMs + day * kDayMs + 8 * 3600 * 1000ull;
+    for (int i = 0; i < kTapsPerDay; i++) {
+      ScanRecord record{};
+      // 12 hours of opening, arrival order, some taps delivered late.
+      uint64_t at = dayStart + static_cast<uint64_t>(i) * 12 * 3600 * 1000 / kTapsPerDay;
+      if (rng() % 20 == 0) at -= rng() % 60000;
+      record.scannedAtMs = at;
+      record.seq = static_cast<uint32_t>(taps.size() + 1);
+      record.reader = static_cast<uint8_t>(rng() % 2);
+      record.uidLen = 4;
+      uint32_t student = rng() % kStudents;
+      std::memcpy(record.uid, &student, 4);
+      record.student = makeId(0x5f000000, student);
+      record.flags = kScanKnown;
+      if (rng() % 10 != 0) {
+        record.cls = makeId(0x6a000000, rng() % kClasses);
+        record.flags |= kScanHasClass;
+      }
+      taps.push_back(record);
+    }
+  }
+  return taps;
+}
+
+template <typename Scan>
+double timeReports(int reports, uint64_t *records, Scan scan) {
+  double start = nowNs();
+  for (int i = 0; i < reports; i++) *records += scan(i);
+  return (nowNs() - start) / reports / 1e3;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  int days = argc > 1 ? std::atoi(argv[1]) : 180;
+  char dir[] = "/tmp/scan_log_bench.XXXXXX";
+  if (!mkdtemp(dir)) {
+    std::perror("scan_log_bench: mkdtemp");
+    return 1;
+  }
+
+  std::vector<ScanRecord> taps = makeTaps(days);
+  ScanLog::Options opts;
+  opts.segmentRecords = 256 * 1024;
+
+  ScanLog log;
+  if (!log.open(dir, opts)) {
+    std::perror("scan_log_bench: open");
+    return 1;
+  }
+  double start = nowNs();
+  for (const ScanRecord &record : taps) log.append(record);
+  double appendNs = (nowNs() - start) / taps.size();
+  start = nowNs();
+  log.sync();
+  double syncMs = (nowNs() - start) / 1e6;
+  size_t segments = log.segmentCount();
+  log.close();
+
+  start = nowNs();
+  log.open(dir, opts);
+  double reopenMs = (nowNs() - start) / 1e6;
+
+  // A writer that dies with 10000 appends not yet synced.
+  const int kTail = 10000;
+  log.close();
+  pid_t child = fork();
+  if (child == 0) {
+    ScanLog writer;
+    if (!writer.open(dir, opts)) _exit(1);
+    for (int i = 0; i < kTail; i++) writer.append(taps[i % taps.size()]);
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(child, &status, 0);
+  start = nowNs();
+  log.open(dir, opts);
+  double recoverMs = (nowNs() - start) / 1e6;
+  uint64_t recovered = log.recoveredRecords();
+
+  std::printf("%zu taps over %d days, %zu segments of %llu records\n", taps.size(), days, segments,
+              static_cast<unsigned long long>(opts.segmentRecords));
+  std::printf("  append           %8.1f ns/tap\n", appendNs);
+  std::printf("  sync (all)       %8.1f ms\n", syncMs);
+  std::printf("  reopen + index   %8.1f ms\n", reopenMs);
+  std::printf("  crash recovery   %8.1f ms, %llu of %d unsynced records recovered\n", recoverMs,
+              static_cast<unsigned long long>(recovered), kTail);
+
+  std::mt19937 rng(5);
+  const int kReports = 50;
+  std::vector<uint64_t> dayStarts(kReports);
+  for (uint64_t &at : dayStarts) at = kEpochMs + (rng() % days) * kDayMs;
+
+  uint64_t dayRecords = 0, fullRecords = 0, monthRecords = 0, studentRecords = 0;
+  double dayUs = timeReports(kReports, &dayRecords, [&](int i) {
+    uint64_t n = 0;
+    log.scanRange(dayStarts[i], dayStarts[i] + kDayMs, [&](uint64_t, const ScanRecord &) { n++; });
+    return n;
+  });
+  double fullUs = timeReports(kReports, &fullRecords, [&](int i) {
+    uint64_t n = 0;
+    for (uint64_t r = 0; r < log.size(); r++) {
+      uint64_t at = log.at(r).scannedAtMs;
+      n += at >= dayStarts[i] && at < dayStarts[i] + kDayMs;
+    }
+    return n;
+  });
+  double monthUs = timeReports(kReports / 5, &monthRecords, [&](int i) {
+    uint64_t n = 0;
+    uint64_t from = kEpochMs + (dayStarts[i] - kEpochMs) / kDayMs / 30 * 30 * kDayMs;
+    log.scanRange(from, from + 30 * kDayMs, [&](uint64_t, const ScanRecord &) { n++; });
+    return n;
+  });
+  double studentUs = timeReports(kReports, &studentRecords, [&](int i) {
+    uint64_t n = 0;
+    log.scanStudent(makeId(0x5f000000, rng() % kStudents), dayStarts[i], dayStarts[i] + 30 * kDayMs,
+                    [&](uint64_t, const ScanRecord &) { n++; });
+    return n;
+  });
+  std::printf("  day report       %8.1f us (%llu taps)   whole-log scan %8.1f us\n", dayUs,
+              static_cast<unsigned long long>(dayRecords / kReports), fullUs);
+  std::printf("  month report     %8.1f us (%llu taps)\n", monthUs,
+              static_cast<unsigned long long>(monthRecords / (kReports / 5)));
+  std::printf("  student, 30 days %8.1f us (%llu taps)\n", studentUs,
+              static_cast<unsigned long long>(studentRecords / kReports));
+
+  // Export as readerd does for EXPORT: one row per tap with a class.
+  start = nowNs();
+  uint64_t rows = 0;
+  size_t bytes = 0;
+  for (uint64_t n = 0; n < log.size(); n++) {
+    const ScanRecord &record = log.at(n);
+    if (!(record.flags & kScanHasClass)) continue;
+    std::string row = objectIdToHex(log.attendanceId(n)) + objectIdToHex(record.student) + objectIdToHex(record.cls);
+    bytes += row.size();
+    rows++;
+  }
+  double exportNs = (nowNs() - start) / rows;
+  std::printf("  export           %8.1f ns/row (%llu rows, %zu id bytes)\n", exportNs,
+              static_cast<unsigned long long>(rows), bytes);
+
+  log.close();
+  std::string cleanup = std::string("rm -rf ") + dir;
+  return std::system(cleanup.c_str()) == 0 ? 0 : 1;
+}
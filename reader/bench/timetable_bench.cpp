@@ -0,0 +1,191 @@
+// timetable_bench: cost of resolving a tap to its class as the center
+// grows, for the compiled Timetable and for the scan server.js does per
+// tap (every session of every class of the student, "HH:MM" parsed each
+// time).
+//
+// Each size N has N students and N/8 classes. A class meets 2 or 3 times
+// a week between 08:00 and 20:00 and holds about 30 students, so a
+// student takes about 4 classes. Reported per operation: single resolve,
+// batch resolve (24 buffered scans, a full reader ring), the linear scan,
+// a class reschedule and an enroll/unenroll pair.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "timetable.h"
+
+using namespace reader;
+
+namespace {
+
+struct ClassDef {
+  std::string id;
+  std::vector<Session> sessions;
+  std::vector<std::string> times;     // "HH:MM", as stored in Mongo
+  std::vector<uint32_t> students;
+};
+
+struct Tap {
+  uint32_t student;
+  int day;
+  int minute;
+};
+
+double nowNs() {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string objectId(const char *prefix, uint32_t n) {
+  char text[32];
+  std::snprintf(text, sizeof(text), "%s%016x", prefix, n);
+  return text;
+}
+
+std::vector<Session> randomSessions(std::mt19937 &rng, std::vector<std::string> *times) {
+  std::vector<Session> sessions;
+  times->clear();
+  int count = 2 + rng() % 2;
+  for (int i = 0; i < count; i++) {
+    uint16_t minute = static_cast<uint16_t>(8 * 60 + (rng() % 24) * 30);
+    sessions.push_back({static_cast<uint8_t>(rng() % 7), minute});
+    char hhmm[8];
+    std::snprintf(hhmm, sizeof(hhmm), "%02d:%02d", minute / 60, minute % 60);
+    times->push_back(hhmm);
+  }
+  return sessions;
+}
+
+// What handleCardScan in server.js does once the student's classes are
+// populated: first class with a session on that day within 30 minutes.
+const std::string *linearResolve(const std::vector<ClassDef> &classes, const std::vector<uint32_t> &mine,
+                                 int day, int minute) {
+  for (uint32_t c : mine) {
+    const ClassDef &cls = classes[c];
+    for (size_t s = 0; s < cls.sessions.size(); s++) {
+      if (cls.sessions[s].day != day) continue;
+      const std::string &time = cls.times[s];
+      size_t colon = time.find(':');
+      int hour = std::atoi(time.substr(0, colon).c_str());
+      int min = std::atoi(time.substr(colon + 1).c_str());
+      if (std::abs(hour * 60 + min - minute) <= 30) return &cls.id;
+    }
+  }
+  return nullptr;
+}
+
+void run(uint32_t studentCount, int taps) {
+  std::mt19937 rng(studentCount);
+  uint32_t classCount = std::max<uint32_t>(1, studentCount / 8);
+
+  std::vector<std::string> studentIds;
+  for (uint32_t s = 0; s < studentCount; s++) studentIds.push_back(objectId("5f00", s));
+
+  std::vector<ClassDef> classes(classCount);
+  std::vector<std::vector<uint32_t>> classesOf(studentCount);
+  for (uint32_t c = 0; c < classCount; c++) {
+    ClassDef &cls = classes[c];
+    cls.id = objectId("6a00", c);
+    cls.sessions = randomSessions(rng, &cls.times);
+    for (int k = 0; k < 30; k++) {
+      uint32_t s = rng() % studentCount;
+      cls.students.push_back(s);
+      classesOf[s].push_back(c);
+    }
+  }
+
+  Timetable timetable;
+  double start = nowNs();
+  for (const ClassDef &cls : classes) {
+    std::vector<std::string> roster;
+    for (uint32_t s : cls.students) roster.push_back(studentIds[s]);
+    timetable.setClass(cls.id, cls.sessions, roster);
+  }
+  double buildMs = (nowNs() - start) / 1e6;
+
+  std::vector<Tap> tapList;
+  for (int i = 0; i < taps; i++) {
+    tapList.push_back({static_cast<uint32_t>(rng() % studentCount), static_cast<int>(rng() % 7),
+                       static_cast<int>(8 * 60 + rng() % (12 * 60))});
+  }
+
+  size_t hits = 0;
+  start = nowNs();
+  for (const Tap &tap : tapList) hits += timetable.resolve(studentIds[tap.student], tap.day, tap.minute) != nullptr;
+  double resolveNs = (nowNs() - start) / taps;
+
+  const size_t kBatch = 24;
+  std::vector<Timetable::Query> queries(kBatch);
+  std::vector<const std::string *> answers(kBatch);
+  size_t batchHits = 0;
+  start = nowNs();
+  for (int i = 0; i + static_cast<int>(kBatch) <= taps; i += kBatch) {
+    for (size_t j = 0; j < kBatch; j++) {
+      const Tap &tap = tapList[i + j];
+      queries[j] = {&studentIds[tap.student], tap.day, tap.minute};
+    }
+    timetable.resolveBatch(queries.data(), kBatch, answers.data());
+    for (const std::string *answer : answers) batchHits += answer != nullptr;
+  }
+  double batchNs = (nowNs() - start) / (taps / kBatch * kBatch);
+
+  size_t linearHits = 0;
+  start = nowNs();
+  for (const Tap &tap : tapList) {
+    linearHits += linearResolve(classes, classesOf[tap.student], tap.day, tap.minute) != nullptr;
+  }
+  double linearNs = (nowNs() - start) / taps;
+
+  // A class moves to new times.
+  const int kUpdates = 2000;
+  std::vector<std::vector<std::string>> rosters(kUpdates);
+  std::vector<std::vector<Session>> moved(kUpdates);
+  std::vector<uint32_t> movedClass(kUpdates);
+  for (int i = 0; i < kUpdates; i++) {
+    movedClass[i] = rng() % classCount;
+    std::vector<std::string> times;
+    moved[i] = randomSessions(rng, &times);
+    for (uint32_t s : classes[movedClass[i]].students) rosters[i].push_back(studentIds[s]);
+  }
+  start = nowNs();
+  for (int i = 0; i < kUpdates; i++) timetable.setClass(classes[movedClass[i]].id, moved[i], rosters[i]);
+  double rescheduleUs = (nowNs() - start) / kUpdates / 1e3;
+
+  // A student joins a class and leaves it again; one already on the
+  // roster would leave it for good, and the rosters would shrink.
+  std::vector<uint32_t> joiner(kUpdates);
+  for (int i = 0; i < kUpdates; i++) {
+    const std::vector<uint32_t> &roster = classes[movedClass[i]].students;
+    do {
+      joiner[i] = rng() % studentCount;
+    } while (std::find(roster.begin(), roster.end(), joiner[i]) != roster.end());
+  }
+  start = nowNs();
+  for (int i = 0; i < kUpdates; i++) {
+    const std::string &cls = classes[movedClass[i]].id;
+    const std::string &student = studentIds[joiner[i]];
+    timetable.enroll(cls, student);
+    timetable.unenroll(cls, student);
+  }
+  double enrollUs = (nowNs() - start) / kUpdates / 1e3;
+
+  std::printf("%8u %7u %8zu %9.1f %10.0f %9.0f %9.0f %11.2f %9.2f   %4.1f%% %4.1f%% %4.1f%%\n",
+              studentCount, classCount, timetable.windowCount(), buildMs, resolveNs, batchNs, linearNs,
+              rescheduleUs, enrollUs, 100.0 * hits / taps, 100.0 * batchHits / (taps / kBatch * kBatch),
+              100.0 * linearHits / taps);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  int taps = argc > 1 ? std::atoi(argv[1]) : 200000;
+  std::printf("%8s %7s %8s %9s %10s %9s %9s %11s %9s   %s\n", "students", "classes", "windows",
+              "build_ms", "resolve_ns", "batch_ns", "linear_ns", "reschedule_us", "enroll_us",
+              "hit rate (index, batch, linear)");
+  for (uint32_t students : {1000u, 4000u, 16000u, 64000u, 256000u}) run(students, taps);
+  return 0;
+}
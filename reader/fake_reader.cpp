@@ -0,0 +1,295 @@
+// fake_reader: stands in for a program-pcb.c++ board on a pseudo-terminal.
+//
+// It prints the pty slave path (pass it to readerd --device), answers
+// HELLO / FMT like the firmware and emits one buffered scan per tap. With
+// --socket it also subscribes to readerd and reports tap-to-event latency,
+// measured from the write() of the scan to the arrival of its JSON event.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "latency.h"
+#include "uid.h"
+
+using namespace reader;
+
+namespace {
+
+struct Options {
+  int count = 1000;
+  double rate = 50;             // taps per second
+  std::string socketPath;
+  std::string uids;             // file with one hex UID per line
+};
+
+uint64_t monotonicUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class FakeReader {
+ public:
+  explicit FakeReader(Options opts) : opts_(std::move(opts)) {}
+  int run();
+
+ private:
+  bool openPty();
+  bool connectDaemon();
+  void pollOnce(int timeoutMs);
+  void onCommand(const std::string &line);
+  void reply(const std::string &text);
+  void tap();
+  void onDaemonLine(const std::string &line);
+  void writeAll(const uint8_t *data, size_t len);
+
+  Options opts_;
+  int master_ = -1;
+  int daemon_ = -1;
+  bool binary_ = false;
+  bool hostReady_ = false;
+  bool subscribed_ = false;
+  uint16_t frameSeq_ = 0;
+  uint32_t nextSeq_ = 1;
+  std::string rx_, daemonRx_;
+  std::vector<Uid> uids_;
+  std::mt19937 rng_{12345};
+  std::unordered_map<uint32_t, uint64_t> sentAt_;
+  LatencyHistogram latency_;
+  uint64_t bootUs_ = monotonicUs();
+};
+
+bool FakeReader::openPty() {
+  master_ = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master_ < 0 || grantpt(master_) != 0 || unlockpt(master_) != 0) return false;
+  fcntl(master_, F_SETFL, fcntl(master_, F_GETFL) | O_NONBLOCK);
+  std::printf("%s\n", ptsname(master_));
+  std::fflush(stdout);
+  return true;
+}
+
+bool FakeReader::connectDaemon() {
+  daemon_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", opts_.socketPath.c_str());
+  if (connect(daemon_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) return false;
+  fcntl(daemon_, F_SETFL, fcntl(daemon_, F_GETFL) | O_NONBLOCK);
+  return true;
+}
+
+void FakeReader::writeAll(const uint8_t *data, size_t len) {
+  while (len) {
+    ssize_t n = write(master_, data, len);
+    if (n < 0) {
+      if (errno != EAGAIN) return;
+      pollfd pfd{master_, POLLOUT, 0};
+      poll(&pfd, 1, 100);
+      continue;
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+void FakeReader::reply(const std::string &text) {
+  if (binary_) {
+    uint8_t frame[300];
+    size_t n = encodeFrame(kFrameText, 0, frameSeq_++, reinterpret_cast<const uint8_t *>(text.data()),
+                           text.size(), frame);
+    writeAll(frame, n);
+  } else {
+    std::string line = text + "\r\n";
+    writeAll(reinterpret_cast<const uint8_t *>(line.data()), line.size());
+  }
+}
+
+void FakeReader::onCommand(const std::string &line) {
+  if (line == "HELLO") {
+    hostReady_ = true;
+    reply("OK HELLO 0 0");
+  } else if (line.compare(0, 8, "FMT BIN ") == 0) {
+    reply("OK FMT");
+    binary_ = true;
+  } else if (line.compare(0, 8, "FMT TXT ") == 0) {
+    reply("OK FMT");
+    binary_ = false;
+  } else if (line.compare(0, 4, "ACK ") == 0) {
+    // Nothing is retained, so there is nothing to drop.
+  } else {
+    reply("ERR UNKNOWN");
+  }
+}
+
+void FakeReader::tap() {
+  const Uid &uid = uids_[rng_() % uids_.size()];
+  uint32_t seq = nextSeq_++;
+  uint32_t now = static_cast<uint32_t>((monotonicUs() - bootUs_) / 1000);
+
+  if (binary_) {
+    uint8_t payload[5 + 10 + 10];
+    size_t n = 0;
+    auto le32 = [&](uint32_t v) {
+      for (int i = 0; i < 4; i++) payload[n++] = v >> (8 * i);
+    };
+    le32(now);
+    payload[n++] = 1;
+    le32(seq);
+    le32(now);
+    payload[n++] = 0;
+    payload[n++] = uid.len;
+    std::memcpy(payload + n, uid.bytes, uid.len);
+    n += uid.len;
+    uint8_t frame[64];
+    size_t len = encodeFrame(kFrameBatch, 0, frameSeq_++, payload, n, frame);
+    sentAt_[seq] = monotonicUs();
+    writeAll(frame, len);
+    return;
+  }
+
+  std::string hex = uidToHex(uid);
+  std::string text = "BATCH:1:" + std::to_string(now) + "\r\n" +
+                     "EVT:" + std::to_string(seq) + ":" + std::to_string(now) + ":0:" + hex + "\r\n" +
+                     "END:" + std::to_string(seq) + "\r\n";
+  sentAt_[seq] = monotonicUs();
+  writeAll(reinterpret_cast<const uint8_t *>(text.data()), text.size());
+}
+
+void FakeReader::onDaemonLine(const std::string &line) {
+  if (line.find("\"type\":\"stats\"") != std::string::npos) subscribed_ = true;
+  size_t pos = line.find("\"seq\":");
+  if (pos == std::string::npos) return;
+  uint32_t seq = std::strtoul(line.c_str() + pos + 6, nullptr, 10);
+  auto it = sentAt_.find(seq);
+  if (it == sentAt_.end()) return;
+  latency_.record(monotonicUs() - it->second);
+  sentAt_.erase(it);
+}
+
+void FakeReader::pollOnce(int timeoutMs) {
+  pollfd pfds[2] = {{master_, POLLIN, 0}, {daemon_, POLLIN, 0}};
+  if (poll(pfds, daemon_ >= 0 ? 2 : 1, timeoutMs) <= 0) return;
+
+  char buf[4096];
+  if (pfds[0].revents & POLLIN) {
+    ssize_t n = read(master_, buf, sizeof(buf));
+    if (n > 0) rx_.append(buf, n);
+    size_t nl;
+    while ((nl = rx_.find('\n')) != std::string::npos) {
+      std::string line = rx_.substr(0, nl);
+      rx_.erase(0, nl + 1);
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      onCommand(line);
+    }
+  }
+
+  if (daemon_ >= 0 && (pfds[1].revents & POLLIN)) {
+    ssize_t n = read(daemon_, buf, sizeof(buf));
+    if (n > 0) daemonRx_.append(buf, n);
+    size_t nl;
+    while ((nl = daemonRx_.find('\n')) != std::string::npos) {
+      onDaemonLine(daemonRx_.substr(0, nl));
+      daemonRx_.erase(0, nl + 1);
+    }
+  }
+}
+
+int FakeReader::run() {
+  if (!opts_.uids.empty()) {
+    FILE *in = std::fopen(opts_.uids.c_str(), "r");
+    char line[256];
+    while (in && std::fgets(line, sizeof(line), in)) {
+      size_t len = std::strcspn(line, "\t \r\n");
+      Uid uid;
+      if (uidFromHex(line, len, &uid)) uids_.push_back(uid);
+    }
+    if (in) std::fclose(in);
+  }
+  if (uids_.empty()) {
+    for (int i = 0; i < 256; i++) {
+      uint8_t bytes[4] = {static_cast<uint8_t>(rng_()), static_cast<uint8_t>(rng_()),
+                          static_cast<uint8_t>(rng_()), static_cast<uint8_t>(i)};
+      uids_.push_back(uidFromBytes(bytes, 4));
+    }
+  }
+
+  if (!openPty()) {
+    std::perror("fake_reader: pty");
+    return 1;
+  }
+  reply("RFID Reader Ready");
+
+  // Wait for the host to open the slave side and say HELLO.
+  while (!hostReady_) pollOnce(100);
+
+  if (!opts_.socketPath.empty()) {
+    while (!connectDaemon()) {
+      close(daemon_);
+      usleep(100000);
+    }
+    // The STATS reply proves readerd has registered us as a client, so
+    // the first tap's event is not published before we are listening.
+    const char stats[] = "STATS\n";
+    if (write(daemon_, stats, sizeof(stats) - 1) < 0) return 1;
+    while (!subscribed_) pollOnce(100);
+  }
+
+  uint64_t intervalUs = static_cast<uint64_t>(1e6 / opts_.rate);
+  uint64_t next = monotonicUs();
+  for (int i = 0; i < opts_.count; i++) {
+    while (monotonicUs() < next) {
+      pollOnce(static_cast<int>(std::max<int64_t>(0, (int64_t)(next - monotonicUs()) / 1000)));
+    }
+    tap();
+    next += intervalUs;
+  }
+
+  // Let the last events arrive.
+  uint64_t deadline = monotonicUs() + 2000000;
+  while (daemon_ >= 0 && !sentAt_.empty() && monotonicUs() < deadline) pollOnce(50);
+
+  if (daemon_ >= 0) {
+    std::fprintf(stderr, "fake_reader: %d taps, tap-to-event %s, lost %zu\n", opts_.count,
+                 latency_.summary().c_str(), sentAt_.size());
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options opts;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--count" && i + 1 < argc) {
+      opts.count = std::atoi(argv[++i]);
+    } else if (arg == "--rate" && i + 1 < argc) {
+      opts.rate = std::atof(argv[++i]);
+    } else if (arg == "--socket" && i + 1 < argc) {
+      opts.socketPath = argv[++i];
+    } else if (arg == "--uids" && i + 1 < argc) {
+      opts.uids = argv[++i];
+    } else {
+      std::fprintf(stderr, "usage: %s [--count N] [--rate TAPS_PER_S] [--socket PATH] [--uids FILE]\n",
+                   argv[0]);
+      return 2;
+    }
+  }
+  if (opts.rate <= 0) opts.rate = 1;
+  FakeReader reader(std::move(opts));
+  return reader.run();
+}
@@ -0,0 +1,182 @@
+#include "frame.h"
+
+#include <cstring>
+
+namespace reader {
+
+namespace {
+
+struct CrcTable {
+  uint16_t entries[256];
+
+  CrcTable() {
+    for (int i = 0; i < 256; i++) {
+      uint16_t crc = i << 8;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+      }
+      entries[i] = crc;
+    }
+  }
+};
+
+const CrcTable kCrcTable;
+
+uint32_t readLe32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+int hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+}  // namespace
+
+CardRecord cardRecordFromBytes(const uint8_t *bytes) {
+  CardRecord record;
+  std::memcpy(record.student, bytes, sizeof(record.student));
+  record.groups = bytes[12] | (bytes[13] << 8);
+  return record;
+}
+
+bool cardRecordFromHex(const char *text, size_t len, CardRecord *out) {
+  if (len != 2 * kCardRecordLen) return false;
+  uint8_t bytes[kCardRecordLen];
+  for (size_t i = 0; i < kCardRecordLen; i++) {
+    int hi = hexDigit(text[2 * i]), lo = hexDigit(text[2 * i + 1]);
+    if (hi < 0 || lo < 0) return false;
+    bytes[i] = static_cast<uint8_t>(hi << 4 | lo);
+  }
+  *out = cardRecordFromBytes(bytes);
+  return true;
+}
+
+uint16_t crc16(const uint8_t *data, size_t len, uint16_t crc) {
+  while (len--) {
+    crc = (crc << 8) ^ kCrcTable.entries[((crc >> 8) ^ *data++) & 0xFF];
+  }
+  return crc;
+}
+
+size_t encodeFrame(uint8_t type, uint8_t reader, uint16_t seq,
+                   const uint8_t *payload, size_t payloadLen, uint8_t *out) {
+  if (payloadLen > kFrameMaxPayload) return 0;
+
+  out[0] = kFrameSync;
+  out[1] = static_cast<uint8_t>(kFrameHeader + payloadLen);
+  out[2] = type;
+  out[3] = reader;
+  out[4] = seq & 0xFF;
+  out[5] = seq >> 8;
+  if (payloadLen) std::memcpy(out + 2 + kFrameHeader, payload, payloadLen);
+
+  size_t end = 2 + kFrameHeader + payloadLen;
+  uint16_t crc = crc16(out + 1, end - 1);
+  out[end] = crc & 0xFF;
+  out[end + 1] = crc >> 8;
+  return end + 2;
+}
+
+bool decodeBatch(const Frame &frame, uint32_t *now, std::vector<ScanEvent> *out) {
+  if (frame.type != kFrameBatch || frame.payloadLen < 5) return false;
+
+  const uint8_t *p = frame.payload;
+  const uint8_t *end = p + frame.payloadLen;
+  *now = readLe32(p);
+  size_t count = p[4];
+  p += 5;
+
+  for (size_t i = 0; i < count; i++) {
+    if (end - p < 10) return false;
+    ScanEvent ev{};
+    ev.seq = readLe32(p);
+    ev.at = readLe32(p + 4);
+    ev.reader = p[8];
+    ev.uidLen = p[9] & ~kEventHasRecord;
+    ev.hasRecord = (p[9] & kEventHasRecord) != 0;
+    p += 10;
+    size_t recordLen = ev.hasRecord ? kCardRecordLen : 0;
+    if (ev.uidLen > sizeof(ev.uid) || static_cast<size_t>(end - p) < ev.uidLen + recordLen) return false;
+    std::memcpy(ev.uid, p, ev.uidLen);
+    p += ev.uidLen;
+    if (ev.hasRecord) ev.record = cardRecordFromBytes(p);
+    p += recordLen;
+    out->push_back(ev);
+  }
+  return p == end;
+}
+
+FrameDecoder::FrameDecoder(Handler handler) : handler_(std::move(handler)) {
+  buf_.reserve(4096);
+}
+
+void FrameDecoder::reset() {
+  buf_.clear();
+  head_ = 0;
+}
+
+void FrameDecoder::feed(const uint8_t *data, size_t len) {
+  buf_.insert(buf_.end(), data, data + len);
+  drain();
+
+  // Compact once the consumed prefix dominates, so long streams do not
+  // grow the buffer or pay for an erase on every frame.
+  if (head_ == buf_.size()) {
+    buf_.clear();
+    head_ = 0;
+  } else if (head_ > buf_.size() / 2) {
+    buf_.erase(buf_.begin(), buf_.begin() + head_);
+    head_ = 0;
+  }
+}
+
+void FrameDecoder::drain() {
+  while (head_ < buf_.size()) {
+    const uint8_t *p = buf_.data() + head_;
+    size_t avail = buf_.size() - head_;
+
+    if (p[0] != kFrameSync) {
+      const void *sync = std::memchr(p, kFrameSync, avail);
+      size_t skip = sync ? static_cast<const uint8_t *>(sync) - p : avail;
+      counters_.skippedBytes += skip;
+      head_ += skip;
+      continue;
+    }
+
+    if (avail < 2) return;
+    size_t len = p[1];
+    if (len < kFrameHeader) {
+      counters_.lengthErrors++;
+      counters_.skippedBytes++;
+      head_++;
+      continue;
+    }
+
+    size_t total = 2 + len + 2;
+    if (avail < total) return;
+
+    uint16_t expected = p[2 + len] | (p[2 + len + 1] << 8);
+    if (crc16(p + 1, 1 + len) != expected) {
+      // Drop only the SYNC byte: a real frame may start inside this one.
+      counters_.crcErrors++;
+      counters_.skippedBytes++;
+      head_++;
+      continue;
+    }
+
+    Frame frame;
+    frame.type = p[2];
+    frame.reader = p[3];
+    frame.seq = p[4] | (p[5] << 8);
+    frame.payload = p + 2 + kFrameHeader;
+    frame.payloadLen = len - kFrameHeader;
+    head_ += total;
+    counters_.frames++;
+    handler_(frame);
+  }
+}
+
+}  // namespace reader
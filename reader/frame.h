@@ -0,0 +1,105 @@
+// Binary frame format emitted by program-pcb.c++ after "FMT BIN".
+//
+//   SYNC LEN TYPE READER SEQ_LO SEQ_HI PAYLOAD... CRC_LO CRC_HI
+//
+// LEN counts TYPE through the end of PAYLOAD. The CRC is CRC-16/CCITT-FALSE
+// over LEN through the end of PAYLOAD. Keep in sync with the firmware.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace reader {
+
+constexpr uint8_t kFrameSync = 0xA5;
+constexpr size_t kFrameHeader = 4;    // TYPE READER SEQ_LO SEQ_HI
+constexpr size_t kFrameOverhead = 2 + kFrameHeader + 2;
+constexpr size_t kFrameMaxPayload = 255 - kFrameHeader;
+
+enum FrameType : uint8_t {
+  kFrameScan = 0x01,
+  kFrameBatch = 0x02,
+  kFrameText = 0x7F,
+};
+
+struct Frame {
+  uint8_t type;
+  uint8_t reader;           // board's first reader id; the scanning reader in kFrameScan
+  uint16_t seq;
+  const uint8_t *payload;   // valid only inside the handler
+  size_t payloadLen;
+};
+
+// Student record the board read from the card's data block (firmware
+// CARD_RECORD_BLOCK): ObjectId[12], then a class-group bitmap u16 LE. It
+// follows the UID in SCAN and BATCH payloads and, as 28 hex digits, in
+// text lines. The board has already checked the block's CRC.
+constexpr size_t kCardRecordLen = 14;
+constexpr uint8_t kEventHasRecord = 0x80;   // flag in a batch event's uidLen byte
+
+struct CardRecord {
+  uint8_t student[12];
+  uint16_t groups;
+};
+
+CardRecord cardRecordFromBytes(const uint8_t *bytes);
+// Exactly 2 * kCardRecordLen hex digits.
+bool cardRecordFromHex(const char *text, size_t len, CardRecord *out);
+
+// One buffered scan from a kFrameBatch payload.
+struct ScanEvent {
+  uint32_t seq;
+  uint32_t at;              // reader millis() when the card was read
+  uint8_t reader;
+  uint8_t uidLen;
+  uint8_t uid[10];
+  bool hasRecord;
+  CardRecord record;
+};
+
+uint16_t crc16(const uint8_t *data, size_t len, uint16_t crc = 0xFFFF);
+
+// Writes one frame into out (at least payloadLen + kFrameOverhead bytes).
+// Returns the number of bytes written, or 0 if the payload is too long.
+size_t encodeFrame(uint8_t type, uint8_t reader, uint16_t seq,
+                   const uint8_t *payload, size_t payloadLen, uint8_t *out);
+
+// Parses a kFrameBatch payload: <now u32><count u8> then per event
+// <seq u32><at u32><reader u8><uidLen u8><uid...>[<record>], a record
+// following when uidLen has kEventHasRecord. Returns false on a malformed
+// payload; out is appended to.
+bool decodeBatch(const Frame &frame, uint32_t *now, std::vector<ScanEvent> *out);
+
+// Incremental decoder for a byte stream that may be cut at any point and
+// may contain noise. Bad frames are skipped by resyncing on the next SYNC
+// byte, so a corrupted frame never reaches the handler.
+class FrameDecoder {
+ public:
+  using Handler = std::function<void(const Frame &)>;
+
+  struct Counters {
+    uint64_t frames = 0;
+    uint64_t crcErrors = 0;
+    uint64_t lengthErrors = 0;
+    uint64_t skippedBytes = 0;
+  };
+
+  explicit FrameDecoder(Handler handler);
+
+  void feed(const uint8_t *data, size_t len);
+  void reset();
+
+  const Counters &counters() const { return counters_; }
+
+ private:
+  void drain();
+
+  Handler handler_;
+  std::vector<uint8_t> buf_;
+  size_t head_ = 0;
+  Counters counters_;
+};
+
+}  // namespace reader
@@ -0,0 +1,73 @@
+// Fixed-memory latency histogram: 64 power-of-two ranges of microseconds,
+// each split into 16 linear sub-buckets, so percentiles are within ~6%.
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace reader {
+
+class LatencyHistogram {
+ public:
+  void record(uint64_t us) {
+    buckets_[bucketOf(us)]++;
+    count_++;
+    if (us > max_) max_ = us;
+  }
+
+  void reset() { *this = LatencyHistogram(); }
+
+  uint64_t count() const { return count_; }
+  uint64_t max() const { return max_; }
+
+  // Upper bound of the bucket holding the q-th quantile (0 < q <= 1).
+  uint64_t percentile(double q) const {
+    if (!count_) return 0;
+    uint64_t rank = static_cast<uint64_t>(q * count_ + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; i++) {
+      seen += buckets_[i];
+      if (seen >= rank) {
+        uint64_t upper = upperBound(i);
+        return upper < max_ ? upper : max_;
+      }
+    }
+    return max_;
+  }
+
+  std::string summary() const {
+    char text[128];
+    std::snprintf(text, sizeof(text), "n=%llu p50=%lluus p99=%lluus max=%lluus",
+                  static_cast<unsigned long long>(count_),
+                  static_cast<unsigned long long>(percentile(0.50)),
+                  static_cast<unsigned long long>(percentile(0.99)),
+                  static_cast<unsigned long long>(max_));
+    return text;
+  }
+
+ private:
+  static constexpr int kSub = 16;
+  static constexpr int kBuckets = 64 * kSub;
+
+  static int bucketOf(uint64_t us) {
+    if (us < kSub) return static_cast<int>(us);
+    int msb = 63 - __builtin_clzll(us);
+    int sub = static_cast<int>((us >> (msb - 4)) & (kSub - 1));
+    return (msb - 3) * kSub + sub;
+  }
+
+  static uint64_t upperBound(int bucket) {
+    if (bucket < kSub) return bucket;
+    int msb = bucket / kSub + 3;
+    uint64_t sub = bucket % kSub;
+    return ((kSub + sub + 1) << (msb - 4)) - 1;
+  }
+
+  uint64_t buckets_[kBuckets] = {};
+  uint64_t count_ = 0;
+  uint64_t max_ = 0;
+};
+
+}  // namespace reader
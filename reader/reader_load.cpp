@@ -0,0 +1,1066 @@
+// reader_load: a Saturday-morning rush on demand. Runs --boards boards,
+// each the real program-pcb.c++ on the simulated board (a sim_board
+// process, --board PATH, by default the one built beside reader_load),
+// behind a pseudo-terminal, and measures what comes out of readerd's
+// socket. The board's readers, record block and every byte on the wire
+// are the firmware's own; --readers may not exceed the build's reader
+// count (sim_board_2readers, sim_board_4readers), and --records needs a
+// CARD_RECORD_BLOCK build (sim_board_record).
+//
+// Load is either generated (--arrival poisson|uniform|burst at --rate taps
+// per second over --seconds) or replayed: --replay FILE takes
+// "<ms> <reader> <uid>" lines or readerd's JSON event lines, --replay-log
+// DIR a readerd --log directory. Replay runs at --speed and squeezes gaps
+// longer than --max-gap-ms. A tap holds the card in the field for
+// --dwell-ms. On top of either:
+//   --records PCT       that share of the cards carry a student record
+//   --duplicate P       a tap is repeated by the same card --duplicate-ms
+//                       later (past the firmware's debounce hold)
+//   --lost-ack P        an ACK line from the host never reaches the board
+//   --corrupt P         a write from the board gets one byte flipped
+//   --disconnect-s S    each board is unplugged on average every S seconds
+//                       for --disconnect-ms, keeping power and its ring
+//
+// With --readerd PATH one readerd per board is started against the board's
+// device link (extra arguments through --readerd-arg); otherwise the pty
+// (or --link-dir link) of each board is printed and --socket gives the
+// daemons to measure, one per board in order. Latency is tap to JSON event,
+// matched on the board, reader and UID, oldest tap first. Taps the firmware
+// did not log (debounced, or the card left first) are counted apart from
+// events it logged and that never arrived. --json adds one summary line
+// for regression tracking.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "latency.h"
+#include "scan_log.h"
+#include "uid.h"
+
+using namespace reader;
+
+namespace {
+
+constexpr uint64_t kDrainUs = 10000000;     // past readerd's 5 s reconnect
+constexpr int kUartFd = 3;                  // sim_board's UART
+
+struct Options {
+  int boards = 1;
+  int readers = 1;
+  std::string arrival = "poisson";
+  double rate = 50;
+  double seconds = 10;
+  int burst = 30;
+  int cards = 2000;
+  std::string uids;
+  std::string replay;
+  std::string replayLog;
+  double speed = 1;
+  uint64_t maxGapMs = 5000;
+  double duplicate = 0;
+  uint64_t duplicateMs = 4000;
+  double lostAck = 0;
+  double corrupt = 0;
+  uint64_t dwellMs = 300;
+  int records = 0;
+  double disconnectS = 0;
+  uint64_t disconnectMs = 2000;
+  bool binary = false;
+  std::string board;
+  std::string linkDir;
+  std::vector<std::string> sockets;
+  std::string readerd;
+  std::vector<std::string> readerdArgs;
+  unsigned seed = 1;
+  bool json = false;
+};
+
+struct Tap {
+  uint64_t atUs;              // from the start of the run
+  uint16_t board;
+  uint8_t reader;
+  Uid uid;
+  bool record;                // the card carries a student record
+  bool operator<(const Tap &other) const { return atUs < other.atUs; }
+};
+
+struct PendingTap {
+  uint64_t atUs;
+  bool record;
+};
+
+struct Totals {
+  uint64_t taps = 0;
+  uint64_t logged = 0;        // events the firmware logged, from STATUS
+  uint64_t resends = 0;
+  uint64_t hostTimeouts = 0;
+  uint64_t boardDrops = 0;
+  uint64_t lostAcks = 0;
+  uint64_t corruptWrites = 0;
+  uint64_t unplugs = 0;
+  uint64_t delivered = 0;
+  uint64_t recordTaps = 0;    // delivered events whose card had a record
+  uint64_t withRecord = 0;    // ... and that came with it
+  uint64_t repeated = 0;      // the same seq published twice
+  uint64_t unexpected = 0;    // no tap of that card pending (corruption)
+  uint64_t daemonDuplicates = 0;
+  uint64_t daemonCrcErrors = 0;
+  uint64_t daemonSkippedBytes = 0;
+};
+
+uint64_t monotonicUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t jsonNumber(const std::string &line, const char *key) {
+  std::string needle = std::string("\"") + key + "\":";
+  size_t pos = line.find(needle);
+  return pos == std::string::npos ? 0 : std::strtoull(line.c_str() + pos + needle.size(), nullptr, 10);
+}
+
+std::string jsonText(const std::string &line, const char *key) {
+  std::string needle = std::string("\"") + key + "\":\"";
+  size_t pos = line.find(needle);
+  if (pos == std::string::npos) return "";
+  pos += needle.size();
+  return line.substr(pos, line.find('"', pos) - pos);
+}
+
+// Writes all of data to a non-blocking fd; false once the other side is
+// gone.
+bool writeAll(int fd, const char *data, size_t len) {
+  while (len) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN) return false;
+      pollfd pfd{fd, POLLOUT, 0};
+      poll(&pfd, 1, 100);
+      continue;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+std::string tapKey(unsigned reader, const std::string &uidHex) { return std::to_string(reader) + ":" + uidHex; }
+
+// sim_board's counters, from its STATUS line.
+struct BoardStatus {
+  unsigned long long logged = 0;
+  unsigned long long dropped = 0;
+  unsigned long long resends = 0;
+  unsigned long long hostTimeouts = 0;
+};
+
+// One sim_board process and the pty readerd opens for it. reader_load sits
+// on the wire between them to inject faults and to unplug the cable.
+class Board {
+ public:
+  Board(int index, const Options &opts, Totals *totals, std::mt19937 *rng)
+      : index_(index), opts_(opts), totals_(totals), rng_(rng) {}
+
+  // Starts sim_board and waits for its READY line.
+  bool start();
+  void stop();
+  bool plugIn();
+  void unplug(uint64_t now);
+  const std::string &device() const { return device_; }
+  int master() const { return master_; }
+  int uart() const { return uart_; }
+  bool ready() const { return hostReady_; }
+  int readers() const { return readers_; }
+  int recordBlock() const { return recordBlock_; }
+
+  void tap(uint8_t reader, const Uid &uid, bool record, uint64_t now);
+  // Host to board: command lines from the pty, less the ACKs lost on purpose.
+  void onHostReadable();
+  // Board to host: the firmware's output onto the pty, if plugged in.
+  void onBoardReadable();
+  bool status(BoardStatus *out);
+  void scheduleUnplug(uint64_t now);
+  // Unplug/replug; returns when it next needs a call.
+  uint64_t service(uint64_t now);
+
+  // Taps not yet seen on the socket, oldest first, by tapKey().
+  std::unordered_map<std::string, std::deque<PendingTap>> pending;
+  std::unordered_set<uint32_t> delivered;
+  uint64_t deliveredCount = 0;
+  uint64_t replugAt = 0;
+  uint64_t nextUnplugAt = UINT64_MAX;
+  bool unplugging = false;        // --disconnect-s, until the load is over
+  uint64_t quietUntil = 0;        // no slave open: a master polls as HUP
+
+ private:
+  bool readControl(std::string *line, int timeoutMs);
+  void writeHost(std::string data);
+
+  int index_;
+  const Options &opts_;
+  Totals *totals_;
+  std::mt19937 *rng_;
+  pid_t pid_ = -1;
+  int control_ = -1;              // sim_board's stdin
+  int replies_ = -1;              // and its stdout
+  int uart_ = -1;
+  std::string repliesRx_;
+  int master_ = -1;
+  std::string device_;
+  std::string rx_;
+  bool hostReady_ = false;        // HELLO went through since plug-in
+  int readers_ = 0;
+  int recordBlock_ = 0;
+};
+
+bool Board::start() {
+  int in[2], out[2], uart[2];
+  if (pipe2(in, O_CLOEXEC) != 0 || pipe2(out, O_CLOEXEC) != 0 ||
+      socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, uart) != 0) {
+    return false;
+  }
+  pid_ = fork();
+  if (pid_ < 0) return false;
+  if (pid_ == 0) {
+    dup2(in[0], STDIN_FILENO);
+    dup2(out[1], STDOUT_FILENO);
+    dup2(uart[1], kUartFd);
+    fcntl(kUartFd, F_SETFD, 0);     // dup2 onto itself keeps FD_CLOEXEC
+    execl(opts_.board.c_str(), opts_.board.c_str(), static_cast<char *>(nullptr));
+    std::perror("reader_load: exec sim_board");
+    _exit(127);
+  }
+  close(in[0]);
+  close(out[1]);
+  close(uart[1]);
+  control_ = in[1];
+  replies_ = out[0];
+  uart_ = uart[0];
+  fcntl(uart_, F_SETFL, fcntl(uart_, F_GETFL) | O_NONBLOCK);
+
+  std::string line;
+  if (!readControl(&line, 5000) || std::sscanf(line.c_str(), "READY %d %d", &readers_, &recordBlock_) != 2) {
+    errno = EPROTO;
+    return false;
+  }
+  return true;
+}
+
+void Board::stop() {
+  if (pid_ <= 0) return;
+  close(control_);              // sim_board exits at EOF
+  if (uart_ >= 0) close(uart_);
+  close(replies_);
+  waitpid(pid_, nullptr, 0);
+  pid_ = -1;
+}
+
+bool Board::readControl(std::string *line, int timeoutMs) {
+  uint64_t deadline = monotonicUs() + static_cast<uint64_t>(timeoutMs) * 1000;
+  for (;;) {
+    size_t nl = repliesRx_.find('\n');
+    if (nl != std::string::npos) {
+      *line = repliesRx_.substr(0, nl);
+      repliesRx_.erase(0, nl + 1);
+      return true;
+    }
+    uint64_t now = monotonicUs();
+    pollfd pfd{replies_, POLLIN, 0};
+    if (now >= deadline || poll(&pfd, 1, static_cast<int>((deadline - now + 999) / 1000)) <= 0) return false;
+    char buf[256];
+    ssize_t n = read(replies_, buf, sizeof(buf));
+    if (n <= 0) return false;
+    repliesRx_.append(buf, n);
+  }
+}
+
+bool Board::status(BoardStatus *out) {
+  const char request[] = "STATUS\n";
+  std::string line;
+  return writeAll(control_, request, sizeof(request) - 1) && readControl(&line, 1000) &&
+         std::sscanf(line.c_str(), "STATUS %llu %llu %llu %llu", &out->logged, &out->dropped, &out->resends,
+                     &out->hostTimeouts) == 4;
+}
+
+// A fresh pty each time, so readerd sees a hang-up and then reopens the
+// same path: with a link directory the link is moved onto the new slave.
+bool Board::plugIn() {
+  master_ = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if (master_ < 0 || grantpt(master_) != 0 || unlockpt(master_) != 0) return false;
+  fcntl(master_, F_SETFL, fcntl(master_, F_GETFL) | O_NONBLOCK);
+  termios tio;
+  if (tcgetattr(master_, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(master_, TCSANOW, &tio);
+  }
+  device_ = ptsname(master_);
+  if (!opts_.linkDir.empty()) {
+    std::string link = opts_.linkDir + "/board" + std::to_string(index_);
+    std::string temp = link + ".new";
+    unlink(temp.c_str());
+    if (symlink(device_.c_str(), temp.c_str()) != 0 || rename(temp.c_str(), link.c_str()) != 0) return false;
+    device_ = link;
+  }
+  return true;
+}
+
+// The board stays powered (and keeps logging); what it writes meanwhile
+// is lost with the cable.
+void Board::unplug(uint64_t now) {
+  close(master_);
+  master_ = -1;
+  rx_.clear();
+  hostReady_ = false;
+  replugAt = now + opts_.disconnectMs * 1000;
+  totals_->unplugs++;
+}
+
+void Board::tap(uint8_t reader, const Uid &uid, bool record, uint64_t now) {
+  std::string hex = uidToHex(uid);
+  std::string line = "TAP " + std::to_string(reader) + " " + hex + " " + std::to_string(opts_.dwellMs) +
+                     (record ? " RECORD\n" : "\n");
+  writeAll(control_, line.data(), line.size());
+  pending[tapKey(reader, hex)].push_back({now, record});
+  totals_->taps++;
+}
+
+void Board::writeHost(std::string data) {
+  if (master_ < 0) return;
+  if (opts_.corrupt > 0 && std::uniform_real_distribution<double>(0, 1)(*rng_) < opts_.corrupt) {
+    data[(*rng_)() % data.size()] ^= static_cast<char>(1 + (*rng_)() % 255);
+    totals_->corruptWrites++;
+  }
+  writeAll(master_, data.data(), data.size());    // fails with nobody on the slave side
+}
+
+void Board::onBoardReadable() {
+  char buf[4096];
+  for (;;) {
+    ssize_t n = read(uart_, buf, sizeof(buf));
+    if (n == 0) {
+      std::fprintf(stderr, "reader_load: board %d: sim_board exited\n", index_);
+      close(uart_);
+      uart_ = -1;
+    }
+    if (n <= 0) return;
+    writeHost(std::string(buf, n));
+  }
+}
+
+void Board::onHostReadable() {
+  char buf[1024];
+  for (;;) {
+    ssize_t n = read(master_, buf, sizeof(buf));
+    if (n <= 0) return;
+    rx_.append(buf, n);
+    size_t nl;
+    while ((nl = rx_.find('\n')) != std::string::npos) {
+      std::string line = rx_.substr(0, nl + 1);
+      rx_.erase(0, nl + 1);
+      if (line.compare(0, 4, "ACK ") == 0 && opts_.lostAck > 0 &&
+          std::uniform_real_distribution<double>(0, 1)(*rng_) < opts_.lostAck) {
+        totals_->lostAcks++;
+        continue;
+      }
+      if (line.compare(0, 5, "HELLO") == 0) hostReady_ = true;
+      if (uart_ >= 0) writeAll(uart_, line.data(), line.size());
+    }
+  }
+}
+
+void Board::scheduleUnplug(uint64_t now) {
+  nextUnplugAt = now + static_cast<uint64_t>(
+      std::exponential_distribution<double>(1.0 / (opts_.disconnectS * 1e6))(*rng_));
+}
+
+uint64_t Board::service(uint64_t now) {
+  if (master_ < 0) {
+    if (now < replugAt) return replugAt;
+    if (!plugIn()) std::fprintf(stderr, "reader_load: board %d: cannot re-plug: %s\n", index_, std::strerror(errno));
+    if (unplugging) scheduleUnplug(now);
+  } else if (now >= nextUnplugAt) {
+    unplug(now);
+    nextUnplugAt = UINT64_MAX;
+    return replugAt;
+  }
+  return nextUnplugAt;
+}
+
+// ---- load ------------------------------------------------------------------
+
+std::vector<Uid> loadCards(const Options &opts, std::mt19937 &rng) {
+  std::vector<Uid> uids;
+  if (!opts.uids.empty()) {
+    FILE *in = std::fopen(opts.uids.c_str(), "r");
+    char line[256];
+    while (in && std::fgets(line, sizeof(line), in)) {
+      size_t len = std::strcspn(line, "\t \r\n");
+      Uid uid;
+      if (uidFromHex(line, len, &uid)) uids.push_back(uid);
+    }
+    if (in) std::fclose(in);
+  }
+  while (uids.empty() || (opts.uids.empty() && uids.size() < static_cast<size_t>(opts.cards))) {
+    uint8_t bytes[4] = {static_cast<uint8_t>(rng()), static_cast<uint8_t>(rng()), static_cast<uint8_t>(rng()),
+                        static_cast<uint8_t>(uids.size())};
+    uids.push_back(uidFromBytes(bytes, 4));
+  }
+  return uids;
+}
+
+// Whether a card was provisioned with a student record: a fixed share of
+// the UIDs, the same on every tap.
+bool carriesRecord(const Options &opts, const Uid &uid) {
+  uint32_t hash = 2166136261u;
+  for (uint8_t i = 0; i < uid.len; i++) hash = (hash ^ uid.bytes[i]) * 16777619u;
+  return static_cast<int>(hash % 100) < opts.records;
+}
+
+// Burst: a class lets out. --burst taps at ten times the mean rate, then
+// quiet long enough to keep the mean.
+std::vector<Tap> generateTaps(const Options &opts, std::mt19937 &rng) {
+  std::vector<Uid> cards = loadCards(opts, rng);
+  std::vector<Tap> taps;
+  std::exponential_distribution<double> poisson(opts.rate);
+  std::exponential_distribution<double> inBurst(opts.rate * 10);
+  double t = 0;
+  int inGroup = 0;
+  while (t < opts.seconds) {
+    if (opts.arrival == "uniform") {
+      t += 1.0 / opts.rate;
+    } else if (opts.arrival == "burst") {
+      if (inGroup == opts.burst) {
+        t += opts.burst / opts.rate * 0.9;
+        inGroup = 0;
+      }
+      t += inBurst(rng);
+      inGroup++;
+    } else {
+      t += poisson(rng);
+    }
+    if (t >= opts.seconds) break;
+    taps.push_back({static_cast<uint64_t>(t * 1e6), static_cast<uint16_t>(rng() % opts.boards),
+                    static_cast<uint8_t>(rng() % opts.readers), cards[rng() % cards.size()], false});
+  }
+  return taps;
+}
+
+void addReplayTap(const Options &opts, uint64_t ms, unsigned reader, const Uid &uid, std::vector<Tap> *taps) {
+  Tap tap;
+  tap.atUs = ms * 1000;     // absolute for now, normalised in timeReplay()
+  tap.board = static_cast<uint16_t>(reader / opts.readers % opts.boards);
+  tap.reader = static_cast<uint8_t>(reader % opts.readers);
+  tap.uid = uid;
+  tap.record = false;
+  taps->push_back(tap);
+}
+
+bool loadReplay(const Options &opts, std::vector<Tap> *taps) {
+  FILE *in = std::fopen(opts.replay.c_str(), "r");
+  if (!in) return false;
+  char line[1024];
+  while (std::fgets(line, sizeof(line), in)) {
+    Uid uid;
+    if (line[0] == '{') {
+      // Captured from readerd's socket.
+      std::string text = line;
+      std::string hex = jsonText(text, "uid");
+      if (text.find("\"scannedAt\":") != std::string::npos && uidFromHex(hex, &uid)) {
+        addReplayTap(opts, jsonNumber(text, "scannedAt"), static_cast<unsigned>(jsonNumber(text, "reader")), uid, taps);
+      }
+      continue;
+    }
+    unsigned long long ms;
+    unsigned reader;
+    char hex[32];
+    if (std::sscanf(line, "%llu %u %31s", &ms, &reader, hex) == 3 && uidFromHex(hex, std::strlen(hex), &uid)) {
+      addReplayTap(opts, ms, reader, uid, taps);
+    }
+  }
+  std::fclose(in);
+  return true;
+}
+
+bool loadReplayLog(const Options &opts, std::vector<Tap> *taps) {
+  ScanLog log;
+  ScanLog::Options logOpts;
+  logOpts.readOnly = true;
+  if (!log.open(opts.replayLog, logOpts)) return false;
+  for (uint64_t n = 0; n < log.size(); n++) {
+    const ScanRecord &record = log.at(n);
+    addReplayTap(opts, record.scannedAtMs, record.reader, uidFromBytes(record.uid, record.uidLen), taps);
+  }
+  return true;
+}
+
+// Trace time to run time: from the first tap, divided by --speed, with
+// idle stretches (nights, breaks) cut to --max-gap-ms.
+void timeReplay(const Options &opts, std::vector<Tap> *taps) {
+  std::stable_sort(taps->begin(), taps->end());
+  uint64_t previous = taps->empty() ? 0 : taps->front().atUs;
+  double t = 0;
+  for (Tap &tap : *taps) {
+    uint64_t gap = std::min(tap.atUs - previous, opts.maxGapMs * 1000);
+    previous = tap.atUs;
+    t += gap / opts.speed;
+    tap.atUs = static_cast<uint64_t>(t);
+  }
+}
+
+void addDuplicates(const Options &opts, std::mt19937 &rng, std::vector<Tap> *taps) {
+  if (opts.duplicate <= 0) return;
+  std::uniform_real_distribution<double> unit(0, 1);
+  size_t count = taps->size();
+  for (size_t i = 0; i < count; i++) {
+    if (unit(rng) >= opts.duplicate) continue;
+    Tap again = (*taps)[i];
+    again.atUs += opts.duplicateMs * 1000;
+    taps->push_back(again);
+  }
+  std::stable_sort(taps->begin(), taps->end());
+}
+
+// ---- measurement side --------------------------------------------------------
+
+class Load {
+ public:
+  explicit Load(Options opts) : opts_(std::move(opts)), rng_(opts_.seed) {}
+  int run();
+
+ private:
+  struct Daemon {
+    pid_t pid = -1;
+    int fd = -1;
+    std::string rx;
+    bool subscribed = false;
+    bool finalStats = false;
+  };
+
+  bool startDaemon(int board);
+  bool connectDaemon(int board);
+  void onDaemonReadable(int board, uint64_t now);
+  void onDaemonLine(int board, const std::string &line, uint64_t now);
+  void pollOnce(uint64_t until);
+  void stopDaemons();
+  void stopBoards();
+  bool drained();
+  void report(uint64_t elapsedUs);
+
+  Options opts_;
+  std::mt19937 rng_;
+  Totals totals_;
+  std::vector<Board> boards_;
+  std::vector<Daemon> daemons_;
+  LatencyHistogram latency_;
+  uint64_t firstEventUs_ = 0;
+  uint64_t lastEventUs_ = 0;
+  std::string tempDir_;
+};
+
+bool Load::startDaemon(int board) {
+  Daemon &daemon = daemons_[board];
+  std::string logPath = tempDir_ + "/readerd" + std::to_string(board) + ".log";
+  std::vector<std::string> args = {opts_.readerd, "--device", boards_[board].device(), "--socket",
+                                   opts_.sockets[board]};
+  if (opts_.binary) args.push_back("--binary");
+  args.insert(args.end(), opts_.readerdArgs.begin(), opts_.readerdArgs.end());
+
+  daemon.pid = fork();
+  if (daemon.pid < 0) return false;
+  if (daemon.pid == 0) {
+    int log = open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (log >= 0) dup2(log, STDERR_FILENO);
+    std::vector<char *> argv;
+    for (std::string &arg : args) argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+    execv(argv[0], argv.data());
+    std::perror("reader_load: exec readerd");
+    _exit(127);
+  }
+  return true;
+}
+
+bool Load::connectDaemon(int board) {
+  Daemon &daemon = daemons_[board];
+  daemon.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", opts_.sockets[board].c_str());
+  if (connect(daemon.fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    close(daemon.fd);
+    daemon.fd = -1;
+    return false;
+  }
+  fcntl(daemon.fd, F_SETFL, fcntl(daemon.fd, F_GETFL) | O_NONBLOCK);
+  // The STATS reply proves readerd has registered us as a client, so the
+  // first tap's event is not published before we are listening.
+  const char stats[] = "STATS\n";
+  return write(daemon.fd, stats, sizeof(stats) - 1) > 0;
+}
+
+void Load::onDaemonLine(int board, const std::string &line, uint64_t now) {
+  Daemon &daemon = daemons_[board];
+  std::string type = jsonText(line, "type");
+  if (type == "stats") {
+    if (daemon.subscribed) {
+      daemon.finalStats = true;
+      totals_.daemonDuplicates += jsonNumber(line, "duplicates");
+      totals_.daemonCrcErrors += jsonNumber(line, "crcErrors");
+      totals_.daemonSkippedBytes += jsonNumber(line, "skippedBytes");
+    }
+    daemon.subscribed = true;
+    return;
+  }
+  if (type != "scan" && type != "unknown-card") return;
+
+  Board &b = boards_[board];
+  uint32_t seq = static_cast<uint32_t>(jsonNumber(line, "seq"));
+  if (seq != 0 && b.delivered.count(seq)) {
+    totals_.repeated++;
+    return;
+  }
+  auto it = b.pending.find(tapKey(static_cast<unsigned>(jsonNumber(line, "reader")), jsonText(line, "uid")));
+  if (it == b.pending.end() || it->second.empty()) {
+    totals_.unexpected++;
+    return;
+  }
+  PendingTap tap = it->second.front();
+  it->second.pop_front();
+  if (it->second.empty()) b.pending.erase(it);
+
+  latency_.record(now - tap.atUs);
+  b.delivered.insert(seq);
+  b.deliveredCount++;
+  totals_.delivered++;
+  if (tap.record) {
+    totals_.recordTaps++;
+    if (line.find("\"card\":") != std::string::npos) totals_.withRecord++;
+  }
+  if (!firstEventUs_) firstEventUs_ = now;
+  lastEventUs_ = now;
+}
+
+void Load::onDaemonReadable(int board, uint64_t now) {
+  Daemon &daemon = daemons_[board];
+  char buf[8192];
+  for (;;) {
+    ssize_t n = read(daemon.fd, buf, sizeof(buf));
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+      close(daemon.fd);
+      daemon.fd = -1;
+      return;
+    }
+    if (n < 0) return;
+    daemon.rx.append(buf, n);
+    size_t start = 0, nl;
+    while ((nl = daemon.rx.find('\n', start)) != std::string::npos) {
+      onDaemonLine(board, daemon.rx.substr(start, nl - start), now);
+      start = nl + 1;
+    }
+    daemon.rx.erase(0, start);
+  }
+}
+
+void Load::pollOnce(uint64_t until) {
+  enum Source { kHost, kBoard, kDaemon };
+  std::vector<pollfd> fds;
+  std::vector<std::pair<Source, size_t>> owner;
+  uint64_t now = monotonicUs();
+  for (size_t i = 0; i < boards_.size(); i++) {
+    if (boards_[i].master() >= 0 && now >= boards_[i].quietUntil) {
+      fds.push_back({boards_[i].master(), POLLIN, 0});
+      owner.emplace_back(kHost, i);
+    }
+    if (boards_[i].uart() >= 0) {
+      fds.push_back({boards_[i].uart(), POLLIN, 0});
+      owner.emplace_back(kBoard, i);
+    }
+    if (i < daemons_.size() && daemons_[i].fd >= 0) {
+      fds.push_back({daemons_[i].fd, POLLIN, 0});
+      owner.emplace_back(kDaemon, i);
+    }
+  }
+  int timeoutMs = until > now ? static_cast<int>((until - now + 999) / 1000) : 0;
+  if (poll(fds.data(), fds.size(), timeoutMs) <= 0) return;
+
+  now = monotonicUs();
+  for (size_t i = 0; i < fds.size(); i++) {
+    if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+    Board &board = boards_[owner[i].second];
+    switch (owner[i].first) {
+      case kHost:
+        if (!(fds[i].revents & POLLIN)) {
+          board.quietUntil = now + 20000;
+          continue;
+        }
+        board.onHostReadable();
+        break;
+      case kBoard:
+        board.onBoardReadable();
+        break;
+      case kDaemon:
+        onDaemonReadable(static_cast<int>(owner[i].second), now);
+        break;
+    }
+  }
+}
+
+// Every event the firmware logged and kept has come out of readerd.
+bool Load::drained() {
+  for (Board &board : boards_) {
+    BoardStatus status;
+    if (!board.status(&status)) return true;
+    if (status.logged - std::min(status.dropped, status.logged) > board.deliveredCount) return false;
+  }
+  return true;
+}
+
+void Load::stopBoards() {
+  for (Board &board : boards_) {
+    BoardStatus status;
+    if (board.status(&status)) {
+      totals_.logged += status.logged;
+      totals_.boardDrops += status.dropped;
+      totals_.resends += status.resends;
+      totals_.hostTimeouts += status.hostTimeouts;
+    }
+    board.stop();
+  }
+}
+
+void Load::stopDaemons() {
+  for (Daemon &daemon : daemons_) {
+    if (daemon.fd >= 0) close(daemon.fd);
+    if (daemon.pid > 0) {
+      kill(daemon.pid, SIGTERM);
+      waitpid(daemon.pid, nullptr, 0);
+    }
+  }
+}
+
+int Load::run() {
+  std::vector<Tap> taps;
+  if (!opts_.replay.empty() || !opts_.replayLog.empty()) {
+    bool ok = !opts_.replay.empty() ? loadReplay(opts_, &taps) : loadReplayLog(opts_, &taps);
+    if (!ok) {
+      std::fprintf(stderr, "reader_load: cannot read %s: %s\n",
+                   (!opts_.replay.empty() ? opts_.replay : opts_.replayLog).c_str(), std::strerror(errno));
+      return 1;
+    }
+    timeReplay(opts_, &taps);
+  } else {
+    taps = generateTaps(opts_, rng_);
+  }
+  addDuplicates(opts_, rng_, &taps);
+  for (Tap &tap : taps) tap.record = carriesRecord(opts_, tap.uid);
+  if (taps.empty()) {
+    std::fprintf(stderr, "reader_load: no taps to play\n");
+    return 1;
+  }
+
+  if (opts_.linkDir.empty() && (!opts_.readerd.empty() || opts_.disconnectS > 0)) {
+    char dir[] = "/tmp/reader_load.XXXXXX";
+    if (!mkdtemp(dir)) {
+      std::perror("reader_load: mkdtemp");
+      return 1;
+    }
+    tempDir_ = opts_.linkDir = dir;
+  } else {
+    tempDir_ = opts_.linkDir;
+  }
+  if (!opts_.readerd.empty()) {
+    opts_.sockets.clear();
+    for (int i = 0; i < opts_.boards; i++) opts_.sockets.push_back(tempDir_ + "/board" + std::to_string(i) + ".sock");
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  boards_.reserve(opts_.boards);
+  for (int i = 0; i < opts_.boards; i++) boards_.emplace_back(i, opts_, &totals_, &rng_);
+  for (Board &board : boards_) {
+    if (!board.start()) {
+      std::fprintf(stderr, "reader_load: cannot start %s: %s\n", opts_.board.c_str(), std::strerror(errno));
+      stopBoards();
+      return 1;
+    }
+  }
+  const Board &first = boards_.front();
+  if (opts_.readers > first.readers() || (opts_.records > 0 && first.recordBlock() == 0)) {
+    std::fprintf(stderr, "reader_load: %s has %d reader(s)%s; pick a sim_board build that fits\n",
+                 opts_.board.c_str(), first.readers(), first.recordBlock() ? "" : " and no card records");
+    stopBoards();
+    return 1;
+  }
+  for (Board &board : boards_) {
+    if (!board.plugIn()) {
+      std::perror("reader_load: pty");
+      stopBoards();
+      return 1;
+    }
+    if (opts_.readerd.empty()) std::printf("%s\n", board.device().c_str());
+  }
+  std::fflush(stdout);
+
+  daemons_.resize(opts_.sockets.size());
+  for (size_t i = 0; i < daemons_.size() && !opts_.readerd.empty(); i++) {
+    if (!startDaemon(static_cast<int>(i))) {
+      std::perror("reader_load: fork");
+      stopBoards();
+      return 1;
+    }
+  }
+
+  // Every board greeted by its host and every socket subscribed.
+  uint64_t deadline = monotonicUs() + 30000000;
+  for (;;) {
+    bool ready = true;
+    for (Board &board : boards_) ready &= board.ready();
+    for (size_t i = 0; i < daemons_.size(); i++) {
+      if (daemons_[i].fd < 0) connectDaemon(static_cast<int>(i));
+      ready &= daemons_[i].subscribed;
+    }
+    if (ready) break;
+    if (monotonicUs() > deadline) {
+      std::fprintf(stderr, "reader_load: hosts did not come up\n");
+      stopDaemons();
+      stopBoards();
+      return 1;
+    }
+    pollOnce(monotonicUs() + 100000);
+  }
+
+  if (opts_.disconnectS > 0) {
+    for (Board &board : boards_) {
+      board.unplugging = true;
+      board.scheduleUnplug(monotonicUs());
+    }
+  }
+
+  uint64_t start = monotonicUs();
+  size_t nextTap = 0;
+  uint64_t drainUntil = UINT64_MAX;
+  for (;;) {
+    uint64_t now = monotonicUs();
+    while (nextTap < taps.size() && start + taps[nextTap].atUs <= now) {
+      const Tap &tap = taps[nextTap++];
+      boards_[tap.board].tap(tap.reader, tap.uid, tap.record, now);
+    }
+    uint64_t wake = nextTap < taps.size() ? start + taps[nextTap].atUs : now + 50000;
+    for (Board &board : boards_) {
+      // Unplugging stops once the load is over, so the tail can drain.
+      if (nextTap == taps.size() && board.unplugging) {
+        board.unplugging = false;
+        if (board.master() >= 0) board.nextUnplugAt = UINT64_MAX;
+      }
+      wake = std::min(wake, board.service(now));
+    }
+
+    // The last card is given its dwell to be read before the boards are
+    // asked whether anything is still on its way.
+    if (nextTap == taps.size() && now >= start + taps.back().atUs + opts_.dwellMs * 1000) {
+      if (drainUntil == UINT64_MAX) drainUntil = now + kDrainUs;
+      if (daemons_.empty() || now >= drainUntil || drained()) break;
+    }
+    pollOnce(std::max(now, wake));
+  }
+  uint64_t elapsed = monotonicUs() - start;
+
+  // readerd's own view: sequence duplicates it dropped, CRC errors.
+  for (size_t i = 0; i < daemons_.size(); i++) {
+    if (daemons_[i].fd < 0) continue;
+    const char stats[] = "STATS\n";
+    if (write(daemons_[i].fd, stats, sizeof(stats) - 1) < 0) continue;
+    uint64_t until = monotonicUs() + 1000000;
+    while (!daemons_[i].finalStats && daemons_[i].fd >= 0 && monotonicUs() < until) pollOnce(until);
+  }
+  stopDaemons();
+  stopBoards();
+  report(elapsed);
+  if (!opts_.readerd.empty()) std::fprintf(stderr, "reader_load: readerd logs in %s\n", tempDir_.c_str());
+  return 0;
+}
+
+void Load::report(uint64_t elapsedUs) {
+  uint64_t notLogged = totals_.taps - std::min(totals_.logged, totals_.taps);
+  uint64_t kept = totals_.logged - std::min(totals_.boardDrops, totals_.logged);
+  uint64_t lost = kept - std::min(totals_.delivered, kept);
+  double spanS = lastEventUs_ > firstEventUs_ ? (lastEventUs_ - firstEventUs_) / 1e6 : 0;
+  double throughput = spanS > 0 ? (totals_.delivered - 1) / spanS : 0;
+  const char *format = opts_.binary ? "binary" : "text";
+  const char *source = !opts_.replay.empty() || !opts_.replayLog.empty() ? "replay" : opts_.arrival.c_str();
+
+  std::printf("reader_load: %d board(s) x %d reader(s), %s, %s, %.1f s\n", opts_.boards, opts_.readers, format,
+              source, elapsedUs / 1e6);
+  std::printf("  taps        %llu, %llu logged (%llu debounced or missed), %llu resends, %llu host timeouts\n",
+              static_cast<unsigned long long>(totals_.taps), static_cast<unsigned long long>(totals_.logged),
+              static_cast<unsigned long long>(notLogged), static_cast<unsigned long long>(totals_.resends),
+              static_cast<unsigned long long>(totals_.hostTimeouts));
+  std::printf("  injected    %llu lost ACKs, %llu corrupted writes, %llu unplugs\n",
+              static_cast<unsigned long long>(totals_.lostAcks), static_cast<unsigned long long>(totals_.corruptWrites),
+              static_cast<unsigned long long>(totals_.unplugs));
+  if (daemons_.empty()) return;
+  std::printf("  delivered   %llu, lost %llu, board drops %llu, repeated %llu, unexpected %llu\n",
+              static_cast<unsigned long long>(totals_.delivered), static_cast<unsigned long long>(lost),
+              static_cast<unsigned long long>(totals_.boardDrops), static_cast<unsigned long long>(totals_.repeated),
+              static_cast<unsigned long long>(totals_.unexpected));
+  if (opts_.records > 0) {
+    std::printf("  records     %llu of %llu events from provisioned cards came with the record\n",
+                static_cast<unsigned long long>(totals_.withRecord),
+                static_cast<unsigned long long>(totals_.recordTaps));
+  }
+  std::printf("  readerd     %llu duplicates dropped, %llu CRC errors, %llu skipped bytes\n",
+              static_cast<unsigned long long>(totals_.daemonDuplicates),
+              static_cast<unsigned long long>(totals_.daemonCrcErrors),
+              static_cast<unsigned long long>(totals_.daemonSkippedBytes));
+  std::printf("  throughput  %.1f events/s\n", throughput);
+  std::printf("  tap->event  p50 %llu  p90 %llu  p99 %llu  p99.9 %llu  max %llu us\n",
+              static_cast<unsigned long long>(latency_.percentile(0.50)),
+              static_cast<unsigned long long>(latency_.percentile(0.90)),
+              static_cast<unsigned long long>(latency_.percentile(0.99)),
+              static_cast<unsigned long long>(latency_.percentile(0.999)),
+              static_cast<unsigned long long>(latency_.max()));
+
+  if (opts_.json) {
+    std::printf("{\"boards\":%d,\"readers\":%d,\"format\":\"%s\",\"source\":\"%s\",\"taps\":%llu,"
+                "\"logged\":%llu,\"delivered\":%llu,\"lost\":%llu,\"boardDrops\":%llu,\"repeated\":%llu,"
+                "\"resends\":%llu,\"records\":%llu,\"duplicates\":%llu,\"crcErrors\":%llu,\"eventsPerS\":%.1f,"
+                "\"p50Us\":%llu,\"p90Us\":%llu,\"p99Us\":%llu,\"p999Us\":%llu,\"maxUs\":%llu}\n",
+                opts_.boards, opts_.readers, format, source, static_cast<unsigned long long>(totals_.taps),
+                static_cast<unsigned long long>(totals_.logged), static_cast<unsigned long long>(totals_.delivered),
+                static_cast<unsigned long long>(lost), static_cast<unsigned long long>(totals_.boardDrops),
+                static_cast<unsigned long long>(totals_.repeated), static_cast<unsigned long long>(totals_.resends),
+                static_cast<unsigned long long>(totals_.withRecord),
+                static_cast<unsigned long long>(totals_.daemonDuplicates),
+                static_cast<unsigned long long>(totals_.daemonCrcErrors), throughput,
+                static_cast<unsigned long long>(latency_.percentile(0.50)),
+                static_cast<unsigned long long>(latency_.percentile(0.90)),
+                static_cast<unsigned long long>(latency_.percentile(0.99)),
+                static_cast<unsigned long long>(latency_.percentile(0.999)),
+                static_cast<unsigned long long>(latency_.max()));
+  }
+}
+
+void usage(const char *argv0) {
+  std::fprintf(stderr,
+               "usage: %s [--boards N] [--readers N] [--binary] [--board PATH]\n"
+               "          [--arrival poisson|uniform|burst] [--rate TAPS_PER_S] [--seconds S] [--burst N]\n"
+               "          [--cards N | --uids FILE] [--replay FILE | --replay-log DIR] [--speed X]\n"
+               "          [--max-gap-ms MS] [--dwell-ms MS] [--records PCT] [--duplicate P]\n"
+               "          [--duplicate-ms MS] [--lost-ack P]\n"
+               "          [--corrupt P] [--disconnect-s S] [--disconnect-ms MS] [--link-dir DIR]\n"
+               "          [--readerd PATH [--readerd-arg ARG]... | --socket PATH...] [--seed N] [--json]\n",
+               argv0);
+}
+
+bool parseOptions(int argc, char **argv, Options *opts) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto value = [&]() -> const char * { return i + 1 < argc ? argv[++i] : nullptr; };
+    const char *v = nullptr;
+
+    if (arg == "--binary") {
+      opts->binary = true;
+    } else if (arg == "--json") {
+      opts->json = true;
+    } else if (arg == "--boards" && (v = value())) {
+      opts->boards = std::max(1, std::atoi(v));
+    } else if (arg == "--readers" && (v = value())) {
+      opts->readers = std::min(8, std::max(1, std::atoi(v)));
+    } else if (arg == "--board" && (v = value())) {
+      opts->board = v;
+    } else if (arg == "--dwell-ms" && (v = value())) {
+      opts->dwellMs = std::strtoull(v, nullptr, 10);
+    } else if (arg == "--records" && (v = value())) {
+      opts->records = std::min(100, std::max(0, std::atoi(v)));
+    } else if (arg == "--arrival" && (v = value())) {
+      opts->arrival = v;
+      if (opts->arrival != "poisson" && opts->arrival != "uniform" && opts->arrival != "burst") return false;
+    } else if (arg == "--rate" && (v = value())) {
+      opts->rate = std::atof(v);
+    } else if (arg == "--seconds" && (v = value())) {
+      opts->seconds = std::atof(v);
+    } else if (arg == "--burst" && (v = value())) {
+      opts->burst = std::max(1, std::atoi(v));
+    } else if (arg == "--cards" && (v = value())) {
+      opts->cards = std::max(1, std::atoi(v));
+    } else if (arg == "--uids" && (v = value())) {
+      opts->uids = v;
+    } else if (arg == "--replay" && (v = value())) {
+      opts->replay = v;
+    } else if (arg == "--replay-log" && (v = value())) {
+      opts->replayLog = v;
+    } else if (arg == "--speed" && (v = value())) {
+      opts->speed = std::atof(v);
+    } else if (arg == "--max-gap-ms" && (v = value())) {
+      opts->maxGapMs = std::strtoull(v, nullptr, 10);
+    } else if (arg == "--duplicate" && (v = value())) {
+      opts->duplicate = std::atof(v);
+    } else if (arg == "--duplicate-ms" && (v = value())) {
+      opts->duplicateMs = std::strtoull(v, nullptr, 10);
+    } else if (arg == "--lost-ack" && (v = value())) {
+      opts->lostAck = std::atof(v);
+    } else if (arg == "--corrupt" && (v = value())) {
+      opts->corrupt = std::atof(v);
+    } else if (arg == "--disconnect-s" && (v = value())) {
+      opts->disconnectS = std::atof(v);
+    } else if (arg == "--disconnect-ms" && (v = value())) {
+      opts->disconnectMs = std::strtoull(v, nullptr, 10);
+    } else if (arg == "--link-dir" && (v = value())) {
+      opts->linkDir = v;
+    } else if (arg == "--socket" && (v = value())) {
+      opts->sockets.push_back(v);
+    } else if (arg == "--readerd" && (v = value())) {
+      opts->readerd = v;
+    } else if (arg == "--readerd-arg" && (v = value())) {
+      opts->readerdArgs.push_back(v);
+    } else if (arg == "--seed" && (v = value())) {
+      opts->seed = static_cast<unsigned>(std::strtoul(v, nullptr, 10));
+    } else {
+      return false;
+    }
+  }
+  if (opts->rate <= 0 || opts->speed <= 0) return false;
+  // A socket per board, in board order.
+  if (!opts->sockets.empty() && static_cast<int>(opts->sockets.size()) != opts->boards) return false;
+  if (opts->board.empty()) {
+    // The sim_board built beside this binary.
+    char self[4096];
+    ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    std::string path = n > 0 ? std::string(self, n) : std::string(argv[0]);
+    size_t slash = path.rfind('/');
+    opts->board = (slash == std::string::npos ? std::string(".") : path.substr(0, slash)) + "/sim_board";
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options opts;
+  if (!parseOptions(argc, argv, &opts)) {
+    usage(argv[0]);
+    return 2;
+  }
+  Load load(std::move(opts));
+  return load.run();
+}
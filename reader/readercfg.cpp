@@ -0,0 +1,114 @@
+// readercfg: reads and changes a board's runtime settings ("CFG" in
+// program-pcb.c++), which the board keeps in EEPROM.
+//
+//   readercfg --socket PATH [get]          through a running readerd
+//   readercfg --device PATH [--baud N] [--binary] [get]
+//                                          on the port itself, readerd stopped
+//   readercfg ... set KEY VALUE [KEY VALUE]...
+//                                          GAIN (dB), DEBOUNCE (ms), BAUD,
+//                                          POLL (ms) or FMT (TXT|BIN)
+//   readercfg ... reset                    the firmware's compile-time defaults
+//
+// The settings are printed afterwards. BAUD and FMT are also the link the
+// board boots with, so restart readerd with a matching --baud, or --binary
+// and --binary-baud.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "serial_port.h"
+#include "settings.h"
+
+using namespace reader;
+
+namespace {
+
+void usage(const char *argv0) {
+  std::fprintf(stderr,
+               "usage: %s (--socket PATH | --device PATH [--baud N] [--binary])\n"
+               "          [get | set KEY VALUE [KEY VALUE]... | reset]\n"
+               "keys: GAIN (18 23 33 38 43 48 dB), DEBOUNCE (ms), BAUD, POLL (ms), FMT (TXT|BIN)\n",
+               argv0);
+}
+
+int connectSocket(const std::string &path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path.c_str());
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  return fd;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  std::string device, socketPath;
+  int baud = 9600;
+  bool binary = false;
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; i++) {
+    std::string arg = argv[i];
+    if (arg == "--binary") {
+      binary = true;
+    } else if (arg == "--device" && i + 1 < argc) {
+      device = argv[++i];
+    } else if (arg == "--socket" && i + 1 < argc) {
+      socketPath = argv[++i];
+    } else if (arg == "--baud" && i + 1 < argc) {
+      baud = std::atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  std::string command = i < argc ? argv[i++] : "get";
+  if (device.empty() == socketPath.empty() || (command == "set" ? i == argc || (argc - i) % 2 != 0 : i != argc)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  int fd = device.empty() ? connectSocket(socketPath) : openSerial(device, baud);
+  if (fd < 0) {
+    std::fprintf(stderr, "readercfg: cannot open %s: %s\n", device.empty() ? socketPath.c_str() : device.c_str(),
+                 std::strerror(errno));
+    return 1;
+  }
+  SettingsClient::Link link = !device.empty() ? (binary ? SettingsClient::Link::kSerialBinary
+                                                        : SettingsClient::Link::kSerialText)
+                                              : SettingsClient::Link::kReaderd;
+  SettingsClient client(fd, link);
+
+  bool ok = true;
+  if (command == "set") {
+    for (; ok && i < argc; i += 2) ok = client.set(argv[i], argv[i + 1]);
+  } else if (command == "reset") {
+    ok = client.reset();
+  } else if (command != "get") {
+    usage(argv[0]);
+    return 2;
+  }
+
+  ReaderSettings settings;
+  if (!ok || !client.get(&settings)) {
+    std::fprintf(stderr, "readercfg: %s\n", client.error().c_str());
+    close(fd);
+    return 1;
+  }
+  std::printf("%s\n", formatSettings(settings).c_str());
+  close(fd);
+  return 0;
+}
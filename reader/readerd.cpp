@@ -0,0 +1,1005 @@
+// readerd: owns the card reader's serial port so scans are never queued
+// behind the web tier's event loop.
+//
+// It speaks the program-pcb.c++ protocol (text or binary frames, HELLO/ACK
+// batches), resolves each UID against an in-memory UidIndex, resolves the
+// student's current class from a compiled Timetable and publishes one JSON
+// line per event to every client of a local Unix socket. Board lines nobody
+// asked for ("RFID Reader Ready", CARD outcomes) go to every client too;
+// replies go to the client whose SEND they answer. With --log, every
+// event is also appended to a ScanLog, from which the web tier takes
+// Attendance in batches (EXPORT / COMMIT). A student record read from the
+// card itself (firmware CARD_RECORD_BLOCK) is published as "card" and
+// names the student when the index does not know the UID.
+//
+// Clients may send, one per line:
+//   PUT <uid> <studentId> [name]   add or replace a card
+//   DEL <uid>                      remove a card
+//   CLEAR                          empty the index and the timetable
+//   LOAD <path>                    reload a snapshot (uid TAB studentId TAB name)
+//   CLASS <classId> <sessions> [studentId...]
+//                                  add or replace a class; sessions are
+//                                  <day>@<HH:MM>,... (day 0 = Sunday) or -
+//   UNCLASS <classId>              remove a class
+//   ENROLL / UNENROLL <classId> <studentId>
+//   SEND <command>                 forward a command to the reader; its OK/ERR
+//                                  reply (and STATS's STAT lines) come back to
+//                                  this client alone as a "reader" event. After
+//                                  "CFG SET BAUD|FMT" the port follows the board
+//   STATS                          reply with counters and latency percentiles
+//   EXPORT [max]                   reply with up to max logged attendance
+//                                  records past the export cursor
+//   COMMIT <next>                  move the export cursor to next
+//
+// Any path works as --device, including the slave side of a pty (see
+// fake_reader), so the daemon can run without hardware.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "latency.h"
+#include "scan_log.h"
+#include "serial_port.h"
+#include "timetable.h"
+#include "uid.h"
+#include "uid_index.h"
+
+using namespace reader;
+
+namespace {
+
+constexpr size_t kMaxClientBacklog = 1 << 20;
+constexpr int kReconnectSeconds = 5;
+constexpr int kStatsLogSeconds = 60;
+constexpr uint64_t kExportMax = 2000;       // keeps a reply well under kMaxClientBacklog
+constexpr int kReplySeconds = 30;           // a command still unanswered by then gets none
+constexpr int kDaemonCommand = -1;          // a command readerd sent itself
+constexpr int kGoneClient = -2;             // its client disconnected since
+
+struct Options {
+  std::string device;
+  int baud = 9600;
+  bool binary = false;
+  int binaryBaud = 115200;
+  std::string snapshot;
+  std::string socketPath = "/tmp/readerd.sock";
+  std::string logDir;
+  uint64_t logSegmentRecords = 1 << 20;
+};
+
+uint64_t monotonicUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t wallMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::string jsonString(const std::string &text) {
+  std::string out = "\"";
+  for (unsigned char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c < 0x20) {
+      char esc[8];
+      std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+      out += esc;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+void usage(const char *argv0) {
+  std::fprintf(stderr,
+               "usage: %s --device PATH [--baud N] [--binary [--binary-baud N]]\n"
+               "          [--snapshot FILE] [--socket PATH] [--log DIR [--log-segment RECORDS]]\n",
+               argv0);
+}
+
+bool parseOptions(int argc, char **argv, Options *opts) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto value = [&]() -> const char * { return i + 1 < argc ? argv[++i] : nullptr; };
+    const char *v = nullptr;
+
+    if (arg == "--binary") {
+      opts->binary = true;
+    } else if (arg == "--device" && (v = value())) {
+      opts->device = v;
+    } else if (arg == "--baud" && (v = value())) {
+      opts->baud = std::atoi(v);
+    } else if (arg == "--binary-baud" && (v = value())) {
+      opts->binaryBaud = std::atoi(v);
+    } else if (arg == "--snapshot" && (v = value())) {
+      opts->snapshot = v;
+    } else if (arg == "--socket" && (v = value())) {
+      opts->socketPath = v;
+    } else if (arg == "--log" && (v = value())) {
+      opts->logDir = v;
+    } else if (arg == "--log-segment" && (v = value())) {
+      opts->logSegmentRecords = std::strtoull(v, nullptr, 10);
+    } else {
+      return false;
+    }
+  }
+  return !opts->device.empty();
+}
+
+// "<uid>" or "<uid>:<record>", the tail of UID: and EVT: lines.
+bool parseUidField(const char *text, Uid *uid, CardRecord *card, bool *hasCard) {
+  const char *colon = std::strchr(text, ':');
+  *hasCard = colon != nullptr;
+  if (!colon) return uidFromHex(text, std::strlen(text), uid);
+  return uidFromHex(text, colon - text, uid) && cardRecordFromHex(colon + 1, std::strlen(colon + 1), card);
+}
+
+// Digits only, unlike strtoul: a damaged field must not read as a number.
+bool parseDecimal(const char **text, uint32_t *out) {
+  const char *p = *text;
+  uint64_t n = 0;
+  while (*p >= '0' && *p <= '9' && n <= UINT32_MAX) n = n * 10 + (*p++ - '0');
+  if (p == *text || n > UINT32_MAX) return false;
+  *out = static_cast<uint32_t>(n);
+  *text = p;
+  return true;
+}
+
+// EVT:<seq>:<at>:<reader>:<uid>[:<record>]
+bool parseEventLine(const std::string &line, ScanEvent *ev) {
+  const char *p = line.c_str() + 4;
+  uint32_t readerId;
+  Uid uid;
+  if (!parseDecimal(&p, &ev->seq) || *p++ != ':' || !parseDecimal(&p, &ev->at) || *p++ != ':' ||
+      !parseDecimal(&p, &readerId) || readerId > 0xFF || *p++ != ':' ||
+      !parseUidField(p, &uid, &ev->record, &ev->hasRecord)) {
+    return false;
+  }
+  ev->reader = static_cast<uint8_t>(readerId);
+  ev->uidLen = static_cast<uint8_t>(uid.len);
+  std::memcpy(ev->uid, uid.bytes, uid.len);
+  return true;
+}
+
+// Whether text, an OK/ERR line from the board, can answer command.
+// Replies name their command ("OK CFG ...", "ERR AL VERSION"); the
+// exceptions are PING's OK PONG, the bare OK of "AL +" and "AL -", and
+// ERR UNKNOWN, which firmware without a command answers it with.
+bool answers(const std::string &command, const std::string &text) {
+  if (text == "ERR UNKNOWN") return true;
+  std::string verb = command.substr(0, command.find(' '));
+  if (verb == "PING") return text == "OK PONG";
+  if (text == "OK") return command.compare(0, 4, "AL +") == 0 || command.compare(0, 4, "AL -") == 0;
+  size_t at = text.compare(0, 3, "OK ") == 0 ? 3 : text.compare(0, 4, "ERR ") == 0 ? 4 : std::string::npos;
+  if (at == std::string::npos || text.compare(at, verb.size(), verb) != 0) return false;
+  return text.size() == at + verb.size() || text[at + verb.size()] == ' ';
+}
+
+bool isReplyLine(const std::string &text) {
+  return text == "OK" || text.compare(0, 3, "OK ") == 0 || text.compare(0, 4, "ERR ") == 0;
+}
+
+class Daemon {
+ public:
+  explicit Daemon(Options opts)
+      : opts_(std::move(opts)),
+        decoder_([this](const Frame &frame) { onFrame(frame); }) {}
+
+  int run();
+
+ private:
+  struct Client {
+    std::string in;
+    std::string out;
+  };
+
+  // A command sent to the board whose reply has not come back yet.
+  struct PendingCommand {
+    int fd;                   // its client, kDaemonCommand or kGoneClient
+    std::string command;
+    int ticksLeft;
+  };
+
+  // Serial side.
+  void openReader();
+  void closeReader(const char *why);
+  void onSerialReadable();
+  void onSerialLine(const std::string &line);
+  void onBatchEnd(const std::string &line);
+  void onFrame(const Frame &frame);
+  void onReaderText(const std::string &text);
+  void sendToReader(const std::string &line, int fd = kDaemonCommand);
+  bool routeReply(const std::string &text);
+  void greetReader();
+  void switchToBinary();
+  void followLink(const std::string &setting);
+
+  // Events.
+  void onEvent(uint32_t seq, uint32_t at, uint32_t readerNow, uint8_t readerId, const Uid &uid,
+               const CardRecord *card);
+  void publish(const std::string &json);
+  uint64_t logEvent(uint32_t seq, uint64_t scannedAt, uint8_t readerId, const Uid &uid,
+                    const StudentRef *student, const std::string *cls);
+  std::string exportJson(uint64_t max) const;
+
+  // Client side.
+  void acceptClients();
+  void onClientReadable(int fd);
+  void onClientWritable(int fd);
+  void onClientCommand(int fd, const std::string &line);
+  void queueToClient(int fd, const std::string &data);
+  void dropClient(int fd);
+  std::string statsJson() const;
+
+  void onTimer();
+  void watch(int fd, uint32_t events);
+
+  Options opts_;
+  int epfd_ = -1;
+  int serialFd_ = -1;
+  int listenFd_ = -1;
+  int signalFd_ = -1;
+  int timerFd_ = -1;
+
+  UidIndex index_;
+  Timetable timetable_;
+  ScanLog log_;
+  bool logging_ = false;
+  FrameDecoder decoder_;
+  std::string lineBuf_;
+  std::map<int, Client> clients_;
+  // The board answers in order, except that a BLOOM "AL BEGIN" answers
+  // late, so a reply goes to the oldest command it can answer.
+  std::deque<PendingCommand> pendingCommands_;
+
+  // Binary negotiation: the reply comes at the old baud, frames at the new.
+  bool negotiated_ = false;
+  int negotiateTicks_ = 0;
+  std::string handshake_;
+
+  // Text batch between its BATCH: and END: lines.
+  bool inBatch_ = false;
+  bool batchDamaged_ = false;
+  uint32_t batchCount_ = 0;
+  uint32_t batchNow_ = 0;
+  std::vector<ScanEvent> batch_;
+
+  bool haveSeq_ = false;
+  uint32_t lastSeq_ = 0;
+  uint64_t chunkAtUs_ = 0;      // when the bytes being parsed were read
+  int reconnectTicks_ = 0;
+  int statsTicks_ = 0;
+
+  uint64_t events_ = 0;
+  uint64_t unknown_ = 0;
+  uint64_t carded_ = 0;         // events that carried a card record
+  uint64_t duplicates_ = 0;
+  uint64_t badBatches_ = 0;     // text batches left for the board to resend
+  LatencyHistogram latency_;
+};
+
+void Daemon::watch(int fd, uint32_t events) {
+  epoll_event ev{};
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) != 0 && errno == EEXIST) {
+    epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev);
+  }
+}
+
+int Daemon::run() {
+  if (!opts_.snapshot.empty()) {
+    size_t skipped = 0;
+    if (!index_.loadSnapshot(opts_.snapshot, &skipped)) {
+      std::fprintf(stderr, "readerd: cannot read snapshot %s: %s\n", opts_.snapshot.c_str(),
+                   std::strerror(errno));
+      return 1;
+    }
+    std::fprintf(stderr, "readerd: loaded %zu cards (%zu bad lines)\n", index_.size(), skipped);
+  }
+
+  if (!opts_.logDir.empty()) {
+    ScanLog::Options logOpts;
+    logOpts.segmentRecords = opts_.logSegmentRecords;
+    if (!log_.open(opts_.logDir, logOpts)) {
+      std::fprintf(stderr, "readerd: cannot open scan log %s: %s\n", opts_.logDir.c_str(), std::strerror(errno));
+      return 1;
+    }
+    logging_ = true;
+    std::fprintf(stderr, "readerd: scan log %s: %llu records (%llu recovered), %llu to export\n",
+                 opts_.logDir.c_str(), static_cast<unsigned long long>(log_.size()),
+                 static_cast<unsigned long long>(log_.recoveredRecords()),
+                 static_cast<unsigned long long>(log_.size() - log_.exportCursor()));
+  }
+
+  epfd_ = epoll_create1(EPOLL_CLOEXEC);
+
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGUSR1);
+  sigprocmask(SIG_BLOCK, &mask, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+  signalFd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  watch(signalFd_, EPOLLIN);
+
+  timerFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  itimerspec tick{};
+  tick.it_interval.tv_sec = 1;
+  tick.it_value.tv_sec = 1;
+  timerfd_settime(timerFd_, 0, &tick, nullptr);
+  watch(timerFd_, EPOLLIN);
+
+  listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (opts_.socketPath.size() >= sizeof(addr.sun_path)) {
+    std::fprintf(stderr, "readerd: socket path too long\n");
+    return 1;
+  }
+  std::strcpy(addr.sun_path, opts_.socketPath.c_str());
+  unlink(opts_.socketPath.c_str());
+  if (bind(listenFd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(listenFd_, 16) != 0) {
+    std::fprintf(stderr, "readerd: cannot listen on %s: %s\n", opts_.socketPath.c_str(),
+                 std::strerror(errno));
+    return 1;
+  }
+  watch(listenFd_, EPOLLIN);
+
+  openReader();
+
+  epoll_event ready[32];
+  for (;;) {
+    int n = epoll_wait(epfd_, ready, 32, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      std::perror("readerd: epoll_wait");
+      return 1;
+    }
+
+    for (int i = 0; i < n; i++) {
+      int fd = ready[i].data.fd;
+      uint32_t events = ready[i].events;
+
+      if (fd == serialFd_) {
+        if (events & EPOLLIN) onSerialReadable();
+        if (serialFd_ >= 0 && (events & (EPOLLHUP | EPOLLERR))) closeReader("hang-up");
+      } else if (fd == listenFd_) {
+        acceptClients();
+      } else if (fd == timerFd_) {
+        uint64_t expirations;
+        while (read(timerFd_, &expirations, sizeof(expirations)) > 0) {}
+        onTimer();
+      } else if (fd == signalFd_) {
+        signalfd_siginfo info;
+        while (read(signalFd_, &info, sizeof(info)) == sizeof(info)) {
+          if (info.ssi_signo == SIGUSR1) {
+            std::fprintf(stderr, "readerd: %s\n", statsJson().c_str());
+          } else {
+            unlink(opts_.socketPath.c_str());
+            std::fprintf(stderr, "readerd: %s\n", statsJson().c_str());
+            return 0;
+          }
+        }
+      } else if (clients_.count(fd)) {
+        if (events & (EPOLLHUP | EPOLLERR)) {
+          dropClient(fd);
+          continue;
+        }
+        if (events & EPOLLIN) onClientReadable(fd);
+        if (clients_.count(fd) && (events & EPOLLOUT)) onClientWritable(fd);
+      }
+    }
+  }
+}
+
+// ---- serial side ---------------------------------------------------------
+
+void Daemon::openReader() {
+  serialFd_ = openSerial(opts_.device, opts_.baud);
+  if (serialFd_ < 0) {
+    std::fprintf(stderr, "readerd: cannot open %s: %s (retrying in %ds)\n", opts_.device.c_str(),
+                 std::strerror(errno), kReconnectSeconds);
+    reconnectTicks_ = kReconnectSeconds;
+    return;
+  }
+
+  std::fprintf(stderr, "readerd: reader on %s\n", opts_.device.c_str());
+  watch(serialFd_, EPOLLIN);
+  lineBuf_.clear();
+  decoder_.reset();
+  negotiated_ = false;
+  handshake_.clear();
+
+  if (opts_.binary) {
+    negotiateTicks_ = 1;
+    sendToReader("FMT BIN " + std::to_string(opts_.binaryBaud));
+  } else {
+    greetReader();
+  }
+}
+
+void Daemon::closeReader(const char *why) {
+  if (serialFd_ < 0) return;
+  std::fprintf(stderr, "readerd: reader closed (%s), reconnecting in %ds\n", why, kReconnectSeconds);
+  pendingCommands_.clear();
+  epoll_ctl(epfd_, EPOLL_CTL_DEL, serialFd_, nullptr);
+  close(serialFd_);
+  serialFd_ = -1;
+  reconnectTicks_ = kReconnectSeconds;
+}
+
+// Every command but ACK gets one reply, which goes back to fd.
+void Daemon::sendToReader(const std::string &line, int fd) {
+  if (serialFd_ < 0) return;
+  if (!line.empty() && line.compare(0, 4, "ACK ") != 0) pendingCommands_.push_back({fd, line, kReplySeconds});
+  std::string data = line + "\n";
+  // Commands are short and the port is otherwise idle on the TX side, so
+  // a partial write only happens if the device went away.
+  if (write(serialFd_, data.data(), data.size()) < 0 && errno != EAGAIN) {
+    closeReader(std::strerror(errno));
+  }
+}
+
+void Daemon::greetReader() {
+  haveSeq_ = false;
+  inBatch_ = false;
+  sendToReader("HELLO");
+}
+
+void Daemon::switchToBinary() {
+  negotiated_ = true;
+  negotiateTicks_ = 0;
+  // The handshake took its OK FMT before it could be routed.
+  pendingCommands_.erase(std::remove_if(pendingCommands_.begin(), pendingCommands_.end(),
+                                        [](const PendingCommand &p) { return p.fd == kDaemonCommand &&
+                                                                             p.command.compare(0, 4, "FMT ") == 0; }),
+                         pendingCommands_.end());
+  if (!setSerialBaud(serialFd_, opts_.binaryBaud)) {
+    std::fprintf(stderr, "readerd: cannot switch to %d baud: %s\n", opts_.binaryBaud,
+                 std::strerror(errno));
+  }
+  decoder_.reset();
+  greetReader();
+}
+
+void Daemon::onSerialReadable() {
+  uint8_t buf[4096];
+  // Handling a chunk may close the port (a failed ACK write), so re-check.
+  while (serialFd_ >= 0) {
+    ssize_t n = read(serialFd_, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EINTR) return;
+      closeReader(std::strerror(errno));
+      return;
+    }
+    if (n == 0) return;
+    chunkAtUs_ = monotonicUs();
+
+    if (opts_.binary && negotiated_) {
+      decoder_.feed(buf, n);
+      continue;
+    }
+
+    if (opts_.binary) {
+      handshake_.append(reinterpret_cast<char *>(buf), n);
+      if (handshake_.find("OK FMT") != std::string::npos) {
+        switchToBinary();
+      } else if (handshake_.size() > 64) {
+        handshake_.erase(0, handshake_.size() - 64);
+      }
+      continue;
+    }
+
+    for (ssize_t i = 0; i < n; i++) {
+      char c = static_cast<char>(buf[i]);
+      if (c == '\n') {
+        if (!lineBuf_.empty() && lineBuf_.back() == '\r') lineBuf_.pop_back();
+        onSerialLine(lineBuf_);
+        lineBuf_.clear();
+      } else if (lineBuf_.size() < 256) {
+        lineBuf_ += c;
+      }
+    }
+  }
+}
+
+void Daemon::onSerialLine(const std::string &line) {
+  Uid uid;
+  CardRecord card;
+  bool hasCard;
+  if (line.compare(0, 4, "UID:") == 0) {
+    if (parseUidField(line.c_str() + 4, &uid, &card, &hasCard)) {
+      onEvent(0, 0, 0, 0, uid, hasCard ? &card : nullptr);
+    }
+  } else if (line.compare(0, 6, "BATCH:") == 0) {
+    // BATCH:<count>:<now>; one still open lost its END line.
+    if (inBatch_) badBatches_++;
+    const char *p = line.c_str() + 6;
+    inBatch_ = parseDecimal(&p, &batchCount_) && *p++ == ':' && parseDecimal(&p, &batchNow_) && *p == '\0';
+    batchDamaged_ = false;
+    batch_.clear();
+  } else if (line.compare(0, 4, "EVT:") == 0) {
+    ScanEvent ev{};
+    if (!inBatch_) return;
+    if (parseEventLine(line, &ev)) {
+      batch_.push_back(ev);
+    } else {
+      batchDamaged_ = true;
+    }
+  } else if (line.compare(0, 4, "END:") == 0) {
+    onBatchEnd(line);
+  } else {
+    onReaderText(line);
+  }
+}
+
+// END:<lastSeq>. The text format has no checksum, so a batch is only
+// taken whole: every EVT line parsed, as many as BATCH: announced, and
+// delivered and acknowledged up to the last seq that follows on from
+// lastSeq - count + 1. Anything else is left for the board to resend
+// after its ACK timeout, and a damaged seq never reaches onEvent.
+void Daemon::onBatchEnd(const std::string &line) {
+  const char *p = line.c_str() + 4;
+  uint32_t last;
+  bool whole = inBatch_ && !batchDamaged_ && batchCount_ > 0 && batch_.size() == batchCount_ &&
+               parseDecimal(&p, &last) && *p == '\0';
+  inBatch_ = false;
+  size_t delivered = 0;
+  if (whole) {
+    uint32_t expected = last - (batchCount_ - 1);
+    for (; delivered < batch_.size() && batch_[delivered].seq == expected + delivered; delivered++) {
+      const ScanEvent &ev = batch_[delivered];
+      onEvent(ev.seq, ev.at, batchNow_, ev.reader, uidFromBytes(ev.uid, ev.uidLen),
+              ev.hasRecord ? &ev.record : nullptr);
+    }
+  }
+  if (delivered < batch_.size() || !whole) badBatches_++;
+  if (delivered) sendToReader("ACK " + std::to_string(batch_[delivered - 1].seq));
+  batch_.clear();
+}
+
+void Daemon::onFrame(const Frame &frame) {
+  if (frame.type == kFrameScan) {
+    // A UID is at most 10 bytes, so a longer payload carries a record.
+    if (frame.payloadLen > sizeof(Uid::bytes)) {
+      if (frame.payloadLen > sizeof(Uid::bytes) + kCardRecordLen) return;
+      size_t uidLen = frame.payloadLen - kCardRecordLen;
+      CardRecord card = cardRecordFromBytes(frame.payload + uidLen);
+      onEvent(0, 0, 0, frame.reader, uidFromBytes(frame.payload, uidLen), &card);
+    } else {
+      onEvent(0, 0, 0, frame.reader, uidFromBytes(frame.payload, frame.payloadLen), nullptr);
+    }
+  } else if (frame.type == kFrameBatch) {
+    uint32_t now;
+    std::vector<ScanEvent> events;
+    if (!decodeBatch(frame, &now, &events) || events.empty()) return;
+    for (const ScanEvent &ev : events) {
+      onEvent(ev.seq, ev.at, now, ev.reader, uidFromBytes(ev.uid, ev.uidLen),
+              ev.hasRecord ? &ev.record : nullptr);
+    }
+    sendToReader("ACK " + std::to_string(events.back().seq));
+  } else if (frame.type == kFrameText) {
+    onReaderText(std::string(reinterpret_cast<const char *>(frame.payload), frame.payloadLen));
+  }
+}
+
+void Daemon::onReaderText(const std::string &text) {
+  if (text.compare(0, 17, "RFID Reader Ready") == 0) {
+    // The board rebooted: it is back in text mode at the boot baud, and
+    // nothing sent before will be answered.
+    pendingCommands_.clear();
+    if (opts_.binary) {
+      setSerialBaud(serialFd_, opts_.baud);
+      negotiated_ = false;
+      negotiateTicks_ = 1;
+      sendToReader("FMT BIN " + std::to_string(opts_.binaryBaud));
+    } else {
+      greetReader();
+    }
+  } else if (text.compare(0, 11, "OK CFG SET ") == 0) {
+    followLink(text.substr(11));
+  }
+  if (!routeReply(text)) publish("{\"type\":\"reader\",\"text\":" + jsonString(text) + "}");
+}
+
+// Sends a reply, or a STAT line ahead of OK STATS, to the client that
+// asked; readerd's own replies stop here. False for unsolicited text.
+bool Daemon::routeReply(const std::string &text) {
+  bool stat = text.compare(0, 5, "STAT ") == 0;
+  if (!stat && !isReplyLine(text)) return false;
+  auto it = std::find_if(pendingCommands_.begin(), pendingCommands_.end(), [&](const PendingCommand &p) {
+    return stat ? p.command.compare(0, 5, "STATS") == 0 : answers(p.command, text);
+  });
+  if (it == pendingCommands_.end()) return false;
+  int fd = it->fd;
+  if (!stat) pendingCommands_.erase(it);
+  if (fd >= 0) queueToClient(fd, "{\"type\":\"reader\",\"text\":" + jsonString(text) + "}\n");
+  return true;
+}
+
+// "CFG SET BAUD <baud>" and "CFG SET FMT TXT|BIN" switch the board's link
+// right after the reply. The options follow too, since the board boots
+// with the stored link and a reconnect has to find it there.
+void Daemon::followLink(const std::string &setting) {
+  bool binary = opts_.binary && negotiated_;
+  if (setting.compare(0, 5, "BAUD ") == 0) {
+    int baud = std::atoi(setting.c_str() + 5);
+    (binary ? opts_.binaryBaud : opts_.baud) = baud;
+    if (!setSerialBaud(serialFd_, baud)) {
+      std::fprintf(stderr, "readerd: cannot switch to %d baud: %s\n", baud, std::strerror(errno));
+    }
+  } else if (setting == "FMT BIN" && !binary) {
+    // A batch cut by the switch is resent after the board's ACK timeout.
+    opts_.binary = true;
+    opts_.binaryBaud = opts_.baud;
+    negotiated_ = true;
+    negotiateTicks_ = 0;
+    decoder_.reset();
+  } else if (setting == "FMT TXT" && binary) {
+    opts_.binary = false;
+    opts_.baud = opts_.binaryBaud;
+    negotiated_ = false;
+    lineBuf_.clear();
+  }
+}
+
+// ---- events --------------------------------------------------------------
+
+// seq 0 marks an unbuffered event (REQUIRE_ACK 0 firmware or SCAN frames).
+// card is the record read from the card, if any.
+void Daemon::onEvent(uint32_t seq, uint32_t at, uint32_t readerNow, uint8_t readerId, const Uid &uid,
+                     const CardRecord *card) {
+  if (seq != 0) {
+    // Re-sent batch after a lost ACK.
+    if (haveSeq_ && static_cast<int32_t>(seq - lastSeq_) <= 0) {
+      duplicates_++;
+      return;
+    }
+    haveSeq_ = true;
+    lastSeq_ = seq;
+  }
+
+  uint64_t scannedAt = wallMs() - (readerNow >= at ? readerNow - at : 0);
+  std::string hex = uidToHex(uid);
+  const StudentRef *student = index_.find(uid);
+  // The index wins: it follows card reassignments the card cannot know of.
+  StudentRef fromCard;
+  if (card) {
+    ObjectId id;
+    std::memcpy(id.bytes, card->student, sizeof(id.bytes));
+    fromCard.studentId = objectIdToHex(id);
+    if (!student) student = &fromCard;
+  }
+
+  char head[160];
+  std::snprintf(head, sizeof(head),
+                "{\"type\":\"%s\",\"uid\":\"%s\",\"seq\":%u,\"reader\":%u,\"scannedAt\":%llu",
+                student ? "scan" : "unknown-card", hex.c_str(), seq, readerId,
+                static_cast<unsigned long long>(scannedAt));
+  std::string json = head;
+  if (student) {
+    json += ",\"student\":" + jsonString(student->studentId);
+    json += ",\"name\":" + jsonString(student->name);
+  }
+  if (card) {
+    json += ",\"card\":{\"student\":\"" + fromCard.studentId + "\",\"groups\":" +
+            std::to_string(card->groups) + "}";
+  }
+  // "class" is only present once a timetable has been pushed; null then
+  // means no session within the window.
+  const std::string *cls = nullptr;
+  if (student && timetable_.classCount()) {
+    time_t seconds = static_cast<time_t>(scannedAt / 1000);
+    tm local;
+    localtime_r(&seconds, &local);
+    cls = timetable_.resolve(student->studentId, local.tm_wday, local.tm_hour * 60 + local.tm_min);
+    json += ",\"class\":" + (cls ? jsonString(*cls) : std::string("null"));
+  }
+  // "record" tells the web tier the tap is in the log and its attendance
+  // will come through EXPORT, so it must not save one itself.
+  if (logging_) {
+    uint64_t record = logEvent(seq, scannedAt, readerId, uid, student, cls);
+    if (record != UINT64_MAX) json += ",\"record\":" + std::to_string(record);
+  }
+  json += "}";
+
+  publish(json);
+  events_++;
+  if (!student) unknown_++;
+  if (card) carded_++;
+  latency_.record(monotonicUs() - chunkAtUs_);
+}
+
+uint64_t Daemon::logEvent(uint32_t seq, uint64_t scannedAt, uint8_t readerId, const Uid &uid,
+                          const StudentRef *student, const std::string *cls) {
+  ScanRecord record{};
+  record.scannedAtMs = scannedAt;
+  record.seq = seq;
+  record.reader = readerId;
+  record.uidLen = uid.len;
+  std::memcpy(record.uid, uid.bytes, uid.len);
+  if (student && objectIdFromHex(student->studentId, &record.student)) record.flags |= kScanKnown;
+  if (cls && (record.flags & kScanKnown) && objectIdFromHex(*cls, &record.cls)) record.flags |= kScanHasClass;
+
+  uint64_t n = log_.append(record);
+  if (n == UINT64_MAX) {
+    std::fprintf(stderr, "readerd: scan log append failed: %s\n", std::strerror(errno));
+  }
+  return n;
+}
+
+// Only taps with a student and a class make an Attendance document; the
+// cursor still moves past the others.
+std::string Daemon::exportJson(uint64_t max) const {
+  uint64_t from = log_.exportCursor();
+  uint64_t next = from;
+  std::string records;
+  for (uint64_t taken = 0; next < log_.size() && taken < max; next++) {
+    const ScanRecord &record = log_.at(next);
+    if ((record.flags & (kScanKnown | kScanHasClass)) != (kScanKnown | kScanHasClass)) continue;
+    if (taken++) records += ',';
+    records += "{\"id\":\"" + objectIdToHex(log_.attendanceId(next)) + "\",\"student\":\"" +
+               objectIdToHex(record.student) + "\",\"class\":\"" + objectIdToHex(record.cls) +
+               "\",\"date\":" + std::to_string(record.scannedAtMs) + "}";
+  }
+  return "{\"type\":\"export\",\"from\":" + std::to_string(from) + ",\"next\":" + std::to_string(next) +
+         ",\"more\":" + (next < log_.size() ? "true" : "false") + ",\"records\":[" + records + "]}";
+}
+
+void Daemon::publish(const std::string &json) {
+  std::string line = json + "\n";
+  std::vector<int> fds;
+  for (auto &entry : clients_) fds.push_back(entry.first);
+  for (int fd : fds) queueToClient(fd, line);
+}
+
+// ---- client side ---------------------------------------------------------
+
+void Daemon::acceptClients() {
+  for (;;) {
+    int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return;
+    clients_[fd];
+    watch(fd, EPOLLIN);
+  }
+}
+
+// Its pending commands stay queued so their replies are still matched,
+// but go nowhere: the fd may be reused by the next client.
+void Daemon::dropClient(int fd) {
+  epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  clients_.erase(fd);
+  for (PendingCommand &pending : pendingCommands_) {
+    if (pending.fd == fd) pending.fd = kGoneClient;
+  }
+}
+
+void Daemon::queueToClient(int fd, const std::string &data) {
+  auto it = clients_.find(fd);
+  if (it == clients_.end()) return;
+  Client &client = it->second;
+  bool idle = client.out.empty();
+  client.out += data;
+  if (client.out.size() > kMaxClientBacklog) {
+    std::fprintf(stderr, "readerd: dropping slow client %d\n", fd);
+    dropClient(fd);
+    return;
+  }
+  if (idle) onClientWritable(fd);
+}
+
+void Daemon::onClientWritable(int fd) {
+  auto it = clients_.find(fd);
+  if (it == clients_.end()) return;
+  Client &client = it->second;
+  while (!client.out.empty()) {
+    ssize_t n = send(fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EAGAIN) break;
+      dropClient(fd);
+      return;
+    }
+    client.out.erase(0, n);
+  }
+  watch(fd, client.out.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT);
+}
+
+void Daemon::onClientReadable(int fd) {
+  char buf[4096];
+  for (;;) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+      dropClient(fd);
+      return;
+    }
+    if (n < 0) break;
+
+    clients_[fd].in.append(buf, n);
+    for (;;) {
+      auto it = clients_.find(fd);
+      if (it == clients_.end()) return;
+      size_t nl = it->second.in.find('\n');
+      if (nl == std::string::npos) break;
+      std::string line = it->second.in.substr(0, nl);
+      it->second.in.erase(0, nl + 1);
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      onClientCommand(fd, line);
+    }
+  }
+}
+
+void Daemon::onClientCommand(int fd, const std::string &line) {
+  size_t sp = line.find(' ');
+  std::string verb = line.substr(0, sp);
+  std::string rest = sp == std::string::npos ? "" : line.substr(sp + 1);
+
+  auto reply = [&](bool ok, const std::string &what) {
+    queueToClient(fd, std::string("{\"type\":\"reply\",\"ok\":") + (ok ? "true" : "false") +
+                          ",\"text\":" + jsonString(what) + "}\n");
+  };
+
+  if (verb == "PUT") {
+    size_t sp1 = rest.find(' ');
+    Uid uid;
+    if (sp1 == std::string::npos || !uidFromHex(rest.data(), sp1, &uid)) {
+      reply(false, "PUT <uid> <studentId> [name]");
+      return;
+    }
+    size_t sp2 = rest.find(' ', sp1 + 1);
+    StudentRef student;
+    student.studentId = rest.substr(sp1 + 1, sp2 == std::string::npos ? std::string::npos : sp2 - sp1 - 1);
+    if (sp2 != std::string::npos) student.name = rest.substr(sp2 + 1);
+    index_.put(uid, std::move(student));
+    reply(true, "PUT");
+  } else if (verb == "DEL") {
+    Uid uid;
+    if (!uidFromHex(rest, &uid)) {
+      reply(false, "DEL <uid>");
+      return;
+    }
+    reply(index_.erase(uid), "DEL");
+  } else if (verb == "CLEAR") {
+    index_.clear();
+    timetable_.clear();
+    reply(true, "CLEAR");
+  } else if (verb == "LOAD") {
+    size_t skipped = 0;
+    bool ok = index_.loadSnapshot(rest, &skipped);
+    reply(ok, ok ? "LOAD " + std::to_string(index_.size()) : std::string("LOAD ") + std::strerror(errno));
+  } else if (verb == "CLASS") {
+    std::istringstream args(rest);
+    std::string classId, sessionText, studentId;
+    std::vector<Session> sessions;
+    if (!(args >> classId >> sessionText) || !parseSessions(sessionText, &sessions)) {
+      reply(false, "CLASS <classId> <day>@<HH:MM>,...|- [studentId...]");
+      return;
+    }
+    std::vector<std::string> students;
+    while (args >> studentId) students.push_back(studentId);
+    timetable_.setClass(classId, sessions, students);
+    reply(true, "CLASS");
+  } else if (verb == "UNCLASS") {
+    reply(timetable_.removeClass(rest), "UNCLASS");
+  } else if (verb == "ENROLL" || verb == "UNENROLL") {
+    size_t sp1 = rest.find(' ');
+    if (sp1 == std::string::npos) {
+      reply(false, verb + " <classId> <studentId>");
+      return;
+    }
+    std::string classId = rest.substr(0, sp1), studentId = rest.substr(sp1 + 1);
+    bool ok = verb == "ENROLL" ? timetable_.enroll(classId, studentId) : timetable_.unenroll(classId, studentId);
+    reply(ok, verb);
+  } else if (verb == "SEND") {
+    sendToReader(rest, fd);
+    reply(serialFd_ >= 0, "SEND");
+  } else if (verb == "STATS") {
+    queueToClient(fd, statsJson() + "\n");
+  } else if (verb == "EXPORT" || verb == "COMMIT") {
+    if (!logging_) {
+      reply(false, verb + " needs --log");
+      return;
+    }
+    if (verb == "EXPORT") {
+      uint64_t max = rest.empty() ? 500 : std::strtoull(rest.c_str(), nullptr, 10);
+      queueToClient(fd, exportJson(std::min(std::max<uint64_t>(max, 1), kExportMax)) + "\n");
+      return;
+    }
+    char *end;
+    uint64_t next = std::strtoull(rest.c_str(), &end, 10);
+    if (rest.empty() || *end || next < log_.exportCursor()) {
+      reply(false, "COMMIT <next>");
+      return;
+    }
+    bool ok = log_.setExportCursor(next);
+    reply(ok, ok ? "COMMIT " + rest : std::string("COMMIT ") + std::strerror(errno));
+  } else if (!verb.empty()) {
+    reply(false, "unknown command " + verb);
+  }
+}
+
+std::string Daemon::statsJson() const {
+  const FrameDecoder::Counters &frames = decoder_.counters();
+  char text[512];
+  std::snprintf(text, sizeof(text),
+                "{\"type\":\"stats\",\"connected\":%s,\"cards\":%zu,\"classes\":%zu,\"events\":%llu,"
+                "\"logged\":%llu,\"exported\":%llu,"
+                "\"unknown\":%llu,\"cardRecords\":%llu,\"duplicates\":%llu,\"badBatches\":%llu,\"crcErrors\":%llu,"
+                "\"skippedBytes\":%llu,"
+                "\"p50Us\":%llu,\"p99Us\":%llu,\"maxUs\":%llu}",
+                serialFd_ >= 0 ? "true" : "false", index_.size(), timetable_.classCount(),
+                static_cast<unsigned long long>(events_),
+                static_cast<unsigned long long>(log_.size()),
+                static_cast<unsigned long long>(log_.exportCursor()),
+                static_cast<unsigned long long>(unknown_),
+                static_cast<unsigned long long>(carded_),
+                static_cast<unsigned long long>(duplicates_),
+                static_cast<unsigned long long>(badBatches_),
+                static_cast<unsigned long long>(frames.crcErrors),
+                static_cast<unsigned long long>(frames.skippedBytes),
+                static_cast<unsigned long long>(latency_.percentile(0.50)),
+                static_cast<unsigned long long>(latency_.percentile(0.99)),
+                static_cast<unsigned long long>(latency_.max()));
+  return text;
+}
+
+void Daemon::onTimer() {
+  // Appends only touch the mapping; this is what puts them on disk.
+  if (logging_ && !log_.sync()) std::fprintf(stderr, "readerd: scan log sync: %s\n", std::strerror(errno));
+
+  if (serialFd_ < 0 && reconnectTicks_ > 0 && --reconnectTicks_ == 0) openReader();
+
+  // A command whose line was lost or overran the board's buffer.
+  while (!pendingCommands_.empty() && --pendingCommands_.front().ticksLeft <= 0) pendingCommands_.pop_front();
+
+  // No "OK FMT" at the boot baud: the board may already be in binary mode
+  // from an earlier session, so ask again at the binary baud.
+  if (serialFd_ >= 0 && opts_.binary && !negotiated_ && negotiateTicks_ > 0 && --negotiateTicks_ == 0) {
+    setSerialBaud(serialFd_, opts_.binaryBaud);
+    sendToReader("FMT BIN " + std::to_string(opts_.binaryBaud));
+  }
+
+  if (++statsTicks_ >= kStatsLogSeconds) {
+    statsTicks_ = 0;
+    if (events_) std::fprintf(stderr, "readerd: %s\n", statsJson().c_str());
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options opts;
+  if (!parseOptions(argc, argv, &opts)) {
+    usage(argv[0]);
+    return 2;
+  }
+  Daemon daemon(std::move(opts));
+  return daemon.run();
+}
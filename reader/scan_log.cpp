@@ -0,0 +1,388 @@
+#include "scan_log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace reader {
+
+namespace {
+
+constexpr char kSegmentMagic[8] = {'S', 'C', 'A', 'N', 'L', 'O', 'G', '1'};
+constexpr uint32_t kSegmentVersion = 1;
+constexpr size_t kHeaderBytes = 4096;
+constexpr uint8_t kRecordMarker = 0xA7;
+constexpr size_t kChecksummed = offsetof(ScanRecord, checksum);
+
+uint32_t fnv1a(const void *data, size_t len) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= p[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+std::string studentKey(const ObjectId &id) {
+  return std::string(reinterpret_cast<const char *>(id.bytes), sizeof(id.bytes));
+}
+
+int hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+}  // namespace
+
+struct ScanLog::SegmentHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+  uint64_t first;
+  uint64_t capacity;
+  uint64_t committed;       // records known to be on disk
+  uint32_t logId;
+};
+
+bool ObjectId::empty() const {
+  for (uint8_t b : bytes) {
+    if (b) return false;
+  }
+  return true;
+}
+
+bool ObjectId::operator==(const ObjectId &other) const {
+  return std::memcmp(bytes, other.bytes, sizeof(bytes)) == 0;
+}
+
+bool objectIdFromHex(const std::string &hex, ObjectId *out) {
+  if (hex.size() != 2 * sizeof(out->bytes)) return false;
+  for (size_t i = 0; i < sizeof(out->bytes); i++) {
+    int hi = hexDigit(hex[2 * i]), lo = hexDigit(hex[2 * i + 1]);
+    if (hi < 0 || lo < 0) return false;
+    out->bytes[i] = static_cast<uint8_t>(hi << 4 | lo);
+  }
+  return true;
+}
+
+std::string objectIdToHex(const ObjectId &id) {
+  static const char kDigits[] = "0123456789abcdef";
+  std::string out;
+  out.reserve(2 * sizeof(id.bytes));
+  for (uint8_t b : id.bytes) {
+    out += kDigits[b >> 4];
+    out += kDigits[b & 0x0F];
+  }
+  return out;
+}
+
+bool isValidRecord(const ScanRecord &record) {
+  return record.marker == kRecordMarker && record.uidLen <= sizeof(record.uid) &&
+         record.checksum == fnv1a(&record, kChecksummed);
+}
+
+ScanRecord *ScanLog::Segment::records() const {
+  return reinterpret_cast<ScanRecord *>(base + kHeaderBytes);
+}
+
+ScanLog::~ScanLog() { close(); }
+
+std::string ScanLog::segmentPath(uint64_t index) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "/scans-%06llu.seg", static_cast<unsigned long long>(index));
+  return dir_ + name;
+}
+
+bool ScanLog::openSegment(uint64_t index, bool create, Segment *out) {
+  static_assert(sizeof(SegmentHeader) <= kHeaderBytes, "header fits its page");
+  std::string path = segmentPath(index);
+  int fd = ::open(path.c_str(), (opts_.readOnly ? O_RDONLY : O_RDWR) | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0),
+                  0644);
+  if (fd < 0) return false;
+
+  size_t bytes;
+  if (create) {
+    bytes = kHeaderBytes + opts_.segmentRecords * sizeof(ScanRecord);
+    // Reserve the blocks now: a store into a hole the disk cannot back
+    // would be a SIGBUS rather than an error.
+    int err = posix_fallocate(fd, 0, static_cast<off_t>(bytes));
+    if (err != 0) {
+      ::close(fd);
+      unlink(path.c_str());
+      errno = err;
+      return false;
+    }
+  } else {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < kHeaderBytes) {
+      ::close(fd);
+      errno = EINVAL;
+      return false;
+    }
+    bytes = static_cast<size_t>(st.st_size);
+  }
+
+  void *base = mmap(nullptr, bytes, opts_.readOnly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    int err = errno;
+    ::close(fd);
+    errno = err;
+    return false;
+  }
+
+  Segment segment;
+  segment.fd = fd;
+  segment.base = static_cast<uint8_t *>(base);
+  segment.bytes = bytes;
+
+  SegmentHeader *header = segment.header();
+  if (create) {
+    std::memcpy(header->magic, kSegmentMagic, sizeof(kSegmentMagic));
+    header->version = kSegmentVersion;
+    header->recordSize = sizeof(ScanRecord);
+    header->first = count_;
+    header->capacity = opts_.segmentRecords;
+    header->committed = 0;
+    header->logId = logId_;
+  } else if (std::memcmp(header->magic, kSegmentMagic, sizeof(kSegmentMagic)) != 0 ||
+             header->version != kSegmentVersion || header->recordSize != sizeof(ScanRecord) ||
+             header->capacity % kBlockRecords != 0 ||
+             kHeaderBytes + header->capacity * sizeof(ScanRecord) > bytes) {
+    munmap(base, bytes);
+    ::close(fd);
+    errno = EINVAL;
+    return false;
+  }
+  segment.first = header->first;
+  segment.capacity = header->capacity;
+  *out = segment;
+  return true;
+}
+
+// Records past the header's committed count were stored but maybe not
+// flushed; the run of valid ones after it is what survived.
+uint64_t ScanLog::recover(const Segment &segment) const {
+  const ScanRecord *records = segment.records();
+  uint64_t n = std::min(segment.header()->committed, segment.capacity);
+  while (n < segment.capacity && isValidRecord(records[n])) n++;
+  return n;
+}
+
+bool ScanLog::open(const std::string &dir, const Options &opts) {
+  close();
+  opts_ = opts;
+  opts_.segmentRecords = std::max<uint64_t>(kBlockRecords, opts.segmentRecords);
+  opts_.segmentRecords = (opts_.segmentRecords + kBlockRecords - 1) / kBlockRecords * kBlockRecords;
+  dir_ = dir;
+
+  if (!opts_.readOnly && mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) return false;
+
+  for (uint64_t index = 0;; index++) {
+    Segment segment;
+    if (!openSegment(index, false, &segment)) {
+      if (errno == ENOENT) break;
+      int err = errno;
+      close();
+      errno = err;
+      return false;
+    }
+    segments_.push_back(segment);
+  }
+  if (segments_.empty() && opts_.readOnly) {
+    errno = ENOENT;
+    return false;
+  }
+
+  for (size_t i = 0; i < segments_.size(); i++) {
+    Segment &segment = segments_[i];
+    uint64_t valid = recover(segment);
+    bool last = i + 1 == segments_.size();
+    // A segment is synced in full before the next one is created, so only
+    // the last can be short; anything else is damage, not a crash.
+    if (segment.first != count_ || (!last && valid != segment.capacity)) {
+      close();
+      errno = EBADMSG;
+      return false;
+    }
+    recovered_ += valid - std::min(segment.header()->committed, valid);
+    segment.synced = valid;
+
+    const ScanRecord *records = segment.records();
+    for (uint64_t r = 0; r < valid; r++) indexRecord(count_ + r, records[r]);
+    count_ += valid;
+
+    // Clear what follows the last good record, torn or stale, so nothing
+    // left there can pass for a record once new ones are written before it.
+    if (last && !opts_.readOnly) {
+      ScanRecord *tail = segment.records();
+      for (uint64_t r = valid; r < segment.capacity && tail[r].marker != 0; r++) {
+        tail[r] = ScanRecord{};
+      }
+      segment.header()->committed = valid;
+    }
+  }
+  if (!segments_.empty()) logId_ = segments_.front().header()->logId;
+  if (logId_ == 0) logId_ = (std::random_device()() & 0xFFFFFF) | 1;
+
+  FILE *cursor = std::fopen((dir_ + "/export.cursor").c_str(), "r");
+  if (cursor) {
+    unsigned long long n = 0;
+    if (std::fscanf(cursor, "%llu", &n) == 1) exportCursor_ = std::min<uint64_t>(n, count_);
+    std::fclose(cursor);
+  }
+  return true;
+}
+
+void ScanLog::close() {
+  if (!opts_.readOnly) sync();
+  for (Segment &segment : segments_) {
+    munmap(segment.base, segment.bytes);
+    ::close(segment.fd);
+  }
+  segments_.clear();
+  blocks_.clear();
+  byStudent_.clear();
+  count_ = 0;
+  recovered_ = 0;
+  exportCursor_ = 0;
+  logId_ = 0;
+}
+
+bool ScanLog::addSegment() {
+  if (!sync()) return false;
+  Segment segment;
+  if (!openSegment(segments_.size(), true, &segment)) return false;
+  segments_.push_back(segment);
+  return true;
+}
+
+uint64_t ScanLog::append(ScanRecord record) {
+  if (segments_.empty() || count_ == segments_.back().first + segments_.back().capacity) {
+    if (!addSegment()) return UINT64_MAX;
+  }
+  Segment &segment = segments_.back();
+
+  record.marker = kRecordMarker;
+  record.checksum = fnv1a(&record, kChecksummed);
+  std::memcpy(&segment.records()[count_ - segment.first], &record, sizeof(record));
+
+  uint64_t n = count_++;
+  indexRecord(n, record);
+  return n;
+}
+
+bool ScanLog::sync() {
+  bool ok = true;
+  for (Segment &segment : segments_) {
+    if (count_ < segment.first) continue;      // not loaded (failed open)
+    uint64_t used = std::min(count_ - segment.first, segment.capacity);
+    if (segment.synced == used) continue;
+
+    long page = sysconf(_SC_PAGESIZE);
+    size_t from = (kHeaderBytes + segment.synced * sizeof(ScanRecord)) / page * page;
+    size_t to = kHeaderBytes + used * sizeof(ScanRecord);
+    ok &= msync(segment.base + from, to - from, MS_SYNC) == 0;
+    // The count goes out after the records it covers.
+    segment.header()->committed = used;
+    ok &= msync(segment.base, kHeaderBytes, MS_SYNC) == 0;
+    segment.synced = used;
+  }
+  return ok;
+}
+
+const ScanRecord &ScanLog::at(uint64_t n) const {
+  auto it = std::upper_bound(segments_.begin(), segments_.end(), n,
+                             [](uint64_t value, const Segment &segment) { return value < segment.first; });
+  const Segment &segment = *(it - 1);
+  return segment.records()[n - segment.first];
+}
+
+void ScanLog::indexRecord(uint64_t n, const ScanRecord &record) {
+  uint64_t ms = record.scannedAtMs;
+  if (n / kBlockRecords == blocks_.size()) {
+    uint64_t runMax = blocks_.empty() ? ms : std::max(blocks_.back().runMaxMs, ms);
+    blocks_.push_back({ms, ms, runMax});
+  } else {
+    Block &block = blocks_.back();
+    block.minMs = std::min(block.minMs, ms);
+    block.maxMs = std::max(block.maxMs, ms);
+    block.runMaxMs = std::max(block.runMaxMs, ms);
+  }
+  if (record.flags & kScanKnown) byStudent_[studentKey(record.student)].push_back(n);
+}
+
+// Blocks before the first whose running maximum reaches fromMs hold
+// nothing at or after fromMs.
+size_t ScanLog::firstBlockFor(uint64_t fromMs) const {
+  auto it = std::lower_bound(blocks_.begin(), blocks_.end(), fromMs,
+                             [](const Block &block, uint64_t value) { return block.runMaxMs < value; });
+  return static_cast<size_t>(it - blocks_.begin());
+}
+
+// Records are appended in arrival order, and buffered taps arrive a little
+// late, so timestamps are only nearly sorted: every block from the first
+// candidate on is checked against its own min/max and either skipped
+// whole or read straight through.
+void ScanLog::scanRange(uint64_t fromMs, uint64_t toMs, const Visitor &visit) const {
+  for (size_t b = firstBlockFor(fromMs); b < blocks_.size(); b++) {
+    const Block &block = blocks_[b];
+    if (block.maxMs < fromMs || block.minMs >= toMs) continue;
+
+    uint64_t first = b * kBlockRecords;
+    uint64_t end = std::min<uint64_t>(first + kBlockRecords, count_);
+    const ScanRecord *records = &at(first);     // a block never spans segments
+    for (uint64_t n = first; n < end; n++) {
+      const ScanRecord &record = records[n - first];
+      if (record.scannedAtMs >= fromMs && record.scannedAtMs < toMs) visit(n, record);
+    }
+  }
+}
+
+void ScanLog::scanStudent(const ObjectId &student, uint64_t fromMs, uint64_t toMs, const Visitor &visit) const {
+  auto it = byStudent_.find(studentKey(student));
+  if (it == byStudent_.end()) return;
+  for (uint64_t n : it->second) {
+    const ScanRecord &record = at(n);
+    if (record.scannedAtMs >= fromMs && record.scannedAtMs < toMs) visit(n, record);
+  }
+}
+
+bool ScanLog::setExportCursor(uint64_t n) {
+  if (n > count_) {
+    errno = ERANGE;
+    return false;
+  }
+  std::string path = dir_ + "/export.cursor";
+  std::string temp = path + ".tmp";
+  FILE *file = std::fopen(temp.c_str(), "w");
+  if (!file) return false;
+  bool ok = std::fprintf(file, "%llu\n", static_cast<unsigned long long>(n)) > 0 && std::fflush(file) == 0 &&
+            fsync(fileno(file)) == 0;
+  ok &= std::fclose(file) == 0;
+  if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) return false;
+  exportCursor_ = n;
+  return true;
+}
+
+// Laid out like a Mongo ObjectId: 4-byte big-endian seconds, then the
+// log's 3-byte id and the record number in the remaining 5 bytes.
+ObjectId ScanLog::attendanceId(uint64_t n) const {
+  ObjectId id;
+  uint32_t seconds = static_cast<uint32_t>(at(n).scannedAtMs / 1000);
+  for (int i = 0; i < 4; i++) id.bytes[i] = static_cast<uint8_t>(seconds >> (24 - 8 * i));
+  for (int i = 0; i < 3; i++) id.bytes[4 + i] = static_cast<uint8_t>(logId_ >> (16 - 8 * i));
+  for (int i = 0; i < 5; i++) id.bytes[7 + i] = static_cast<uint8_t>(n >> (32 - 8 * i));
+  return id;
+}
+
+}  // namespace reader
@@ -0,0 +1,140 @@
+// Append-only scan log kept by readerd, so a tap costs a memcpy into a
+// mapped file instead of a database write.
+//
+// The log is a directory of segment files, scans-<n>.seg, each a 4 KiB
+// header followed by fixed 64-byte records, preallocated and mapped
+// shared. A full segment is left as is and the next one is created. The
+// header's committed count is advanced by sync(); records past it are
+// checked one by one on open (marker byte + checksum), so a crash loses
+// at most a torn last record.
+//
+// In memory the log keeps a sparse time index (min/max timestamp per
+// block of kBlockRecords) and every student's record numbers, so a day's
+// or a month's report and one student's history are sequential scans.
+// Attendance leaves the log in batches through the export cursor.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "uid.h"
+
+namespace reader {
+
+// Mongo ObjectId, 12 bytes; all zero when absent.
+struct ObjectId {
+  uint8_t bytes[12] = {};
+
+  bool empty() const;
+  bool operator==(const ObjectId &other) const;
+};
+
+bool objectIdFromHex(const std::string &hex, ObjectId *out);
+std::string objectIdToHex(const ObjectId &id);
+
+struct ScanRecord {
+  uint64_t scannedAtMs;       // wall clock, ms since the epoch
+  uint32_t seq;               // reader's event sequence, 0 if unbuffered
+  uint8_t reader;
+  uint8_t uidLen;
+  uint8_t flags;              // kScanKnown, kScanHasClass
+  uint8_t marker;             // kRecordMarker once written
+  uint8_t uid[10];
+  uint8_t reserved[2];
+  ObjectId student;
+  ObjectId cls;
+  uint8_t reserved2[8];
+  uint32_t checksum;          // FNV-1a over the bytes above
+};
+static_assert(sizeof(ScanRecord) == 64, "ScanRecord is the on-disk layout");
+
+constexpr uint8_t kScanKnown = 0x01;
+constexpr uint8_t kScanHasClass = 0x02;
+
+class ScanLog {
+ public:
+  static constexpr size_t kBlockRecords = 256;
+
+  struct Options {
+    uint64_t segmentRecords = 1 << 20;   // 64 MiB per segment
+    bool readOnly = false;               // for tools reading beside readerd
+  };
+
+  ScanLog() = default;
+  ~ScanLog();
+  ScanLog(const ScanLog &) = delete;
+  ScanLog &operator=(const ScanLog &) = delete;
+
+  // Opens or creates the log in dir and recovers it. Returns false with
+  // errno set on failure.
+  bool open(const std::string &dir, const Options &opts);
+  void close();
+
+  // Fills in marker and checksum. Returns the record number.
+  uint64_t append(ScanRecord record);
+  // Flushes appended records to disk and advances the committed counts.
+  bool sync();
+
+  uint64_t size() const { return count_; }
+  const ScanRecord &at(uint64_t n) const;
+  size_t segmentCount() const { return segments_.size(); }
+  uint64_t recoveredRecords() const { return recovered_; }
+
+  using Visitor = std::function<void(uint64_t n, const ScanRecord &record)>;
+  // Records with fromMs <= scannedAtMs < toMs, in log order.
+  void scanRange(uint64_t fromMs, uint64_t toMs, const Visitor &visit) const;
+  void scanStudent(const ObjectId &student, uint64_t fromMs, uint64_t toMs, const Visitor &visit) const;
+
+  // Records below the cursor have been exported. Persisted atomically.
+  uint64_t exportCursor() const { return exportCursor_; }
+  bool setExportCursor(uint64_t n);
+  // Deterministic ObjectId for record n's Attendance document, so a batch
+  // exported twice (crash before the cursor moved) upserts the same rows.
+  ObjectId attendanceId(uint64_t n) const;
+
+ private:
+  struct SegmentHeader;
+
+  struct Segment {
+    int fd = -1;
+    uint8_t *base = nullptr;
+    size_t bytes = 0;
+    uint64_t first = 0;         // global number of the segment's record 0
+    uint64_t capacity = 0;
+    uint64_t synced = 0;        // records flushed by sync()
+    SegmentHeader *header() const { return reinterpret_cast<SegmentHeader *>(base); }
+    ScanRecord *records() const;
+  };
+
+  struct Block {
+    uint64_t minMs;
+    uint64_t maxMs;
+    uint64_t runMaxMs;          // max over this and all earlier blocks
+  };
+
+  bool openSegment(uint64_t index, bool create, Segment *out);
+  bool addSegment();
+  uint64_t recover(const Segment &segment) const;
+  void indexRecord(uint64_t n, const ScanRecord &record);
+  size_t firstBlockFor(uint64_t fromMs) const;
+  std::string segmentPath(uint64_t index) const;
+
+  Options opts_;
+  std::string dir_;
+  std::vector<Segment> segments_;
+  uint64_t count_ = 0;
+  uint64_t recovered_ = 0;
+  uint64_t exportCursor_ = 0;
+  uint32_t logId_ = 0;
+
+  std::vector<Block> blocks_;
+  std::unordered_map<std::string, std::vector<uint64_t>> byStudent_;   // key: 12 raw bytes
+};
+
+bool isValidRecord(const ScanRecord &record);
+
+}  // namespace reader
@@ -0,0 +1,182 @@
+// scanlog: reads readerd's scan log (--log DIR) without the daemon.
+//
+//   scanlog DIR stats
+//   scanlog DIR range FROM TO [STUDENT]    taps in [FROM, TO), one per line;
+//                                          FROM/TO are YYYY-MM-DD (local
+//                                          midnight) or ms since the epoch
+//   scanlog DIR export [--max N] [--commit]
+//                                          attendance past the export cursor
+//                                          as mongoimport JSON lines
+//
+// export --commit moves the cursor, so use it only while readerd is not
+// exporting the same log to the web tier.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include "scan_log.h"
+#include "uid.h"
+
+using namespace reader;
+
+namespace {
+
+void usage(const char *argv0) {
+  std::fprintf(stderr,
+               "usage: %s DIR stats\n"
+               "       %s DIR range FROM TO [STUDENT]\n"
+               "       %s DIR export [--max N] [--commit]\n",
+               argv0, argv0, argv0);
+}
+
+bool parseTime(const char *text, uint64_t *ms) {
+  int year, month, day;
+  char tail;
+  if (std::sscanf(text, "%d-%d-%d%c", &year, &month, &day, &tail) == 3) {
+    tm local{};
+    local.tm_year = year - 1900;
+    local.tm_mon = month - 1;
+    local.tm_mday = day;
+    local.tm_isdst = -1;
+    time_t seconds = mktime(&local);
+    if (seconds == -1) return false;
+    *ms = static_cast<uint64_t>(seconds) * 1000;
+    return true;
+  }
+  char *end;
+  *ms = std::strtoull(text, &end, 10);
+  return end != text && *end == 0;
+}
+
+std::string localTime(uint64_t ms) {
+  time_t seconds = static_cast<time_t>(ms / 1000);
+  tm local;
+  localtime_r(&seconds, &local);
+  char text[32];
+  size_t n = std::strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local);
+  std::snprintf(text + n, sizeof(text) - n, ".%03u", static_cast<unsigned>(ms % 1000));
+  return text;
+}
+
+int stats(const ScanLog &log) {
+  uint64_t known = 0, withClass = 0, first = UINT64_MAX, last = 0;
+  for (uint64_t n = 0; n < log.size(); n++) {
+    const ScanRecord &record = log.at(n);
+    known += (record.flags & kScanKnown) != 0;
+    withClass += (record.flags & kScanHasClass) != 0;
+    first = std::min(first, record.scannedAtMs);
+    last = std::max(last, record.scannedAtMs);
+  }
+  std::printf("records   %llu in %zu segment(s), %llu past the last sync\n",
+              static_cast<unsigned long long>(log.size()), log.segmentCount(),
+              static_cast<unsigned long long>(log.recoveredRecords()));
+  std::printf("students  %llu known, %llu with a class\n", static_cast<unsigned long long>(known),
+              static_cast<unsigned long long>(withClass));
+  std::printf("exported  %llu (cursor)\n", static_cast<unsigned long long>(log.exportCursor()));
+  if (log.size()) std::printf("span      %s .. %s\n", localTime(first).c_str(), localTime(last).c_str());
+  return 0;
+}
+
+int range(const ScanLog &log, uint64_t fromMs, uint64_t toMs, const char *studentHex) {
+  uint64_t count = 0;
+  auto print = [&](uint64_t n, const ScanRecord &record) {
+    std::printf("%llu\t%s\t%u\t%s\t%s\t%s\n", static_cast<unsigned long long>(n),
+                localTime(record.scannedAtMs).c_str(), record.reader,
+                uidToHex(uidFromBytes(record.uid, record.uidLen)).c_str(),
+                record.flags & kScanKnown ? objectIdToHex(record.student).c_str() : "-",
+                record.flags & kScanHasClass ? objectIdToHex(record.cls).c_str() : "-");
+    count++;
+  };
+  if (studentHex) {
+    ObjectId student;
+    if (!objectIdFromHex(studentHex, &student)) {
+      std::fprintf(stderr, "scanlog: bad student id %s\n", studentHex);
+      return 2;
+    }
+    log.scanStudent(student, fromMs, toMs, print);
+  } else {
+    log.scanRange(fromMs, toMs, print);
+  }
+  std::fprintf(stderr, "scanlog: %llu taps\n", static_cast<unsigned long long>(count));
+  return 0;
+}
+
+// Extended JSON as mongoimport reads it; _id is deterministic, so import
+// with --mode=upsert and a batch exported twice lands once.
+int exportRecords(ScanLog &log, uint64_t max, bool commit) {
+  uint64_t n = log.exportCursor(), written = 0;
+  for (; n < log.size() && written < max; n++) {
+    const ScanRecord &record = log.at(n);
+    if ((record.flags & (kScanKnown | kScanHasClass)) != (kScanKnown | kScanHasClass)) continue;
+    std::printf("{\"_id\":{\"$oid\":\"%s\"},\"student\":{\"$oid\":\"%s\"},\"class\":{\"$oid\":\"%s\"},"
+                "\"date\":{\"$date\":{\"$numberLong\":\"%llu\"}},\"status\":\"present\"}\n",
+                objectIdToHex(log.attendanceId(n)).c_str(), objectIdToHex(record.student).c_str(),
+                objectIdToHex(record.cls).c_str(), static_cast<unsigned long long>(record.scannedAtMs));
+    written++;
+  }
+  if (std::fflush(stdout) != 0) {
+    std::perror("scanlog: write");
+    return 1;
+  }
+  std::fprintf(stderr, "scanlog: %llu attendance records, cursor %llu -> %llu\n",
+               static_cast<unsigned long long>(written), static_cast<unsigned long long>(log.exportCursor()),
+               static_cast<unsigned long long>(n));
+  if (commit && !log.setExportCursor(n)) {
+    std::fprintf(stderr, "scanlog: cannot move the export cursor: %s\n", std::strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    usage(argv[0]);
+    return 2;
+  }
+  std::string command = argv[2];
+
+  ScanLog log;
+  ScanLog::Options opts;
+  opts.readOnly = true;
+  if (!log.open(argv[1], opts)) {
+    std::fprintf(stderr, "scanlog: cannot open %s: %s\n", argv[1], std::strerror(errno));
+    return 1;
+  }
+
+  if (command == "stats" && argc == 3) return stats(log);
+
+  if (command == "range" && (argc == 5 || argc == 6)) {
+    uint64_t fromMs, toMs;
+    if (!parseTime(argv[3], &fromMs) || !parseTime(argv[4], &toMs)) {
+      usage(argv[0]);
+      return 2;
+    }
+    return range(log, fromMs, toMs, argc == 6 ? argv[5] : nullptr);
+  }
+
+  if (command == "export") {
+    uint64_t max = UINT64_MAX;
+    bool commit = false;
+    for (int i = 3; i < argc; i++) {
+      if (std::strcmp(argv[i], "--commit") == 0) {
+        commit = true;
+      } else if (std::strcmp(argv[i], "--max") == 0 && i + 1 < argc) {
+        max = std::strtoull(argv[++i], nullptr, 10);
+      } else {
+        usage(argv[0]);
+        return 2;
+      }
+    }
+    return exportRecords(log, max, commit);
+  }
+
+  usage(argv[0]);
+  return 2;
+}
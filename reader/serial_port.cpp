@@ -0,0 +1,75 @@
+#include "serial_port.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace reader {
+
+namespace {
+
+speed_t speedFor(int baud) {
+  switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 500000: return B500000;
+    case 921600: return B921600;
+    case 1000000: return B1000000;
+    case 2000000: return B2000000;
+    default: return 0;
+  }
+}
+
+}  // namespace
+
+bool setSerialBaud(int fd, int baud) {
+  speed_t speed = speedFor(baud);
+  if (!speed) {
+    errno = EINVAL;
+    return false;
+  }
+
+  termios tio;
+  if (tcgetattr(fd, &tio) != 0) return false;
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+int openSerial(const std::string &path, int baud) {
+  int fd = open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) return -1;
+
+  termios tio;
+  if (tcgetattr(fd, &tio) != 0) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+  // Keep DTR up on close so boards with auto-reset do not lose their
+  // buffered scans when the daemon restarts.
+  tio.c_cflag &= ~HUPCL;
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+
+  if (tcsetattr(fd, TCSANOW, &tio) != 0 || !setSerialBaud(fd, baud)) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  return fd;
+}
+
+}  // namespace reader
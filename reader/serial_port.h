@@ -0,0 +1,15 @@
+// termios helpers for the reader's USB serial port (or a pty stand-in).
+#pragma once
+
+#include <string>
+
+namespace reader {
+
+// Opens path non-blocking in raw 8N1 mode at baud. Returns the fd, or -1
+// with errno set. Baud rates the kernel does not know fail with EINVAL.
+int openSerial(const std::string &path, int baud);
+
+// Changes the speed of an open port, e.g. after "FMT BIN <baud>".
+bool setSerialBaud(int fd, int baud);
+
+}  // namespace reader
@@ -0,0 +1,236 @@
+#include "settings.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "serial_port.h"
+
+namespace reader {
+
+namespace {
+
+const char *const kSettingKeys[] = {"GAIN", "DEBOUNCE", "BAUD", "POLL", "FMT"};
+
+int64_t monotonicMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// The string value of "name":"..." in one of readerd's JSON lines. Only
+// the escapes readerd's jsonString writes are undone.
+bool jsonString(const std::string &line, const char *name, std::string *out) {
+  std::string key = std::string("\"") + name + "\":\"";
+  size_t i = line.find(key);
+  if (i == std::string::npos) return false;
+  out->clear();
+  for (i += key.size(); i < line.size(); i++) {
+    char c = line[i];
+    if (c == '"') return true;
+    if (c != '\\' || i + 1 >= line.size()) {
+      out->push_back(c);
+    } else if (line[++i] == 'u' && i + 4 < line.size()) {
+      out->push_back(static_cast<char>(std::strtoul(line.substr(i + 1, 4).c_str(), nullptr, 16)));
+      i += 4;
+    } else {
+      out->push_back(line[i]);
+    }
+  }
+  return false;
+}
+
+// The answer to a CFG command; "ERR UNKNOWN" from firmware without one, or
+// readerd's own refusal. Another client's "ERR AL ..." is not.
+bool isReply(const std::string &text) {
+  return text.compare(0, 6, "OK CFG") == 0 || text.compare(0, 7, "ERR CFG") == 0 || text == "ERR UNKNOWN" ||
+         text.compare(0, 12, "ERR readerd:") == 0;
+}
+
+}  // namespace
+
+bool isSettingKey(const std::string &key) {
+  for (const char *name : kSettingKeys) {
+    if (key == name) return true;
+  }
+  return false;
+}
+
+bool parseSettings(const std::string &reply, ReaderSettings *out) {
+  if (reply.compare(0, 7, "OK CFG ") != 0) return false;
+  ReaderSettings settings;
+  int seen = 0;
+  size_t pos = 7;
+  while (pos < reply.size()) {
+    size_t end = reply.find(' ', pos);
+    if (end == std::string::npos) end = reply.size();
+    std::string field = reply.substr(pos, end - pos);
+    pos = end + 1;
+    size_t eq = field.find('=');
+    if (eq == std::string::npos) return false;
+    std::string key = field.substr(0, eq), value = field.substr(eq + 1);
+    char *rest;
+    unsigned long n = std::strtoul(value.c_str(), &rest, 10);
+    bool number = !value.empty() && *rest == '\0';
+    if (key == "GAIN" && number) {
+      settings.gainDb = static_cast<int>(n);
+    } else if (key == "DEBOUNCE" && number) {
+      settings.debounceMs = static_cast<uint32_t>(n);
+    } else if (key == "BAUD" && number) {
+      settings.baud = static_cast<uint32_t>(n);
+    } else if (key == "POLL" && number) {
+      settings.pollIntervalMs = static_cast<uint32_t>(n);
+    } else if (key == "FMT" && (value == "TXT" || value == "BIN")) {
+      settings.binary = value == "BIN";
+    } else {
+      continue;               // a key from newer firmware
+    }
+    seen++;
+  }
+  if (seen < 5) return false;
+  *out = settings;
+  return true;
+}
+
+std::string formatSettings(const ReaderSettings &settings) {
+  char text[96];
+  std::snprintf(text, sizeof(text), "GAIN=%d DEBOUNCE=%u BAUD=%u POLL=%u FMT=%s", settings.gainDb,
+                settings.debounceMs, settings.baud, settings.pollIntervalMs, settings.binary ? "BIN" : "TXT");
+  return text;
+}
+
+SettingsClient::SettingsClient(int fd, Link link, int timeoutMs)
+    : fd_(fd),
+      link_(link),
+      timeoutMs_(timeoutMs),
+      decoder_([this](const Frame &frame) {
+        if (frame.type == kFrameText) {
+          pending_.emplace_back(reinterpret_cast<const char *>(frame.payload), frame.payloadLen);
+        }
+      }) {}
+
+bool SettingsClient::get(ReaderSettings *out) {
+  std::string reply;
+  if (!command("CFG GET", &reply)) return false;
+  if (!parseSettings(reply, out)) {
+    error_ = "unexpected reply: " + reply;
+    return false;
+  }
+  return true;
+}
+
+bool SettingsClient::set(const std::string &key, const std::string &value) {
+  if (!isSettingKey(key)) {
+    error_ = "unknown setting " + key;
+    return false;
+  }
+  std::string reply;
+  if (!command("CFG SET " + key + " " + value, &reply)) return false;
+
+  // The board switched right after its reply; so does a direct link.
+  if (link_ == Link::kReaderd) return true;
+  if (key == "BAUD" && !setSerialBaud(fd_, std::atoi(value.c_str()))) {
+    error_ = std::string("cannot switch to ") + value + " baud: " + std::strerror(errno);
+    return false;
+  }
+  if (key == "FMT") {
+    link_ = value == "BIN" ? Link::kSerialBinary : Link::kSerialText;
+    lineBuf_.clear();
+    decoder_.reset();
+  }
+  return true;
+}
+
+bool SettingsClient::reset() {
+  std::string reply;
+  return command("CFG RESET", &reply);
+}
+
+bool SettingsClient::command(const std::string &line, std::string *reply) {
+  pending_.clear();
+  std::string data = (link_ == Link::kReaderd ? "SEND " : "") + line + "\n";
+  if (write(fd_, data.data(), data.size()) != static_cast<ssize_t>(data.size())) {
+    error_ = std::string("write: ") + std::strerror(errno);
+    return false;
+  }
+
+  int64_t deadline = monotonicMs() + timeoutMs_;
+  while (nextText(reply, deadline)) {
+    if (!isReply(*reply)) continue;
+    if (reply->compare(0, 2, "OK") == 0) return true;
+    error_ = *reply;
+    return false;
+  }
+  return false;
+}
+
+// Next line of board text, reading more as needed until deadlineMs.
+bool SettingsClient::nextText(std::string *text, int64_t deadlineMs) {
+  for (;;) {
+    if (!pending_.empty()) {
+      *text = pending_.front();
+      pending_.erase(pending_.begin());
+      return true;
+    }
+
+    int64_t left = deadlineMs - monotonicMs();
+    if (left <= 0) {
+      error_ = "no reply from the reader";
+      return false;
+    }
+    pollfd pfd{fd_, POLLIN, 0};
+    int ready = poll(&pfd, 1, static_cast<int>(left));
+    if (ready < 0 && errno != EINTR) {
+      error_ = std::string("poll: ") + std::strerror(errno);
+      return false;
+    }
+    if (ready <= 0) continue;
+
+    char buf[1024];
+    ssize_t n = read(fd_, buf, sizeof(buf));
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+    if (n <= 0) {
+      error_ = n == 0 ? "connection closed" : std::string("read: ") + std::strerror(errno);
+      return false;
+    }
+    if (link_ == Link::kSerialBinary) {
+      decoder_.feed(reinterpret_cast<const uint8_t *>(buf), n);
+      continue;
+    }
+    lineBuf_.append(buf, n);
+    std::vector<std::string> lines;
+    takeLines(&lines);
+    for (const std::string &line : lines) {
+      if (link_ == Link::kSerialText) {
+        pending_.push_back(line);
+        continue;
+      }
+      // readerd: board text comes as "reader" events; a failed SEND (no
+      // reader connected) as a reply with "ok":false.
+      std::string field;
+      if (line.find("\"type\":\"reader\"") != std::string::npos && jsonString(line, "text", &field)) {
+        pending_.push_back(field);
+      } else if (line.find("\"type\":\"reply\",\"ok\":false") != std::string::npos) {
+        jsonString(line, "text", &field);
+        pending_.push_back("ERR readerd: " + field);
+      }
+    }
+  }
+}
+
+void SettingsClient::takeLines(std::vector<std::string> *lines) {
+  size_t start = 0, nl;
+  while ((nl = lineBuf_.find('\n', start)) != std::string::npos) {
+    size_t end = nl > start && lineBuf_[nl - 1] == '\r' ? nl - 1 : nl;
+    lines->push_back(lineBuf_.substr(start, end - start));
+    start = nl + 1;
+  }
+  lineBuf_.erase(0, start);
+}
+
+}  // namespace reader
@@ -0,0 +1,70 @@
+// Runtime settings of a program-pcb.c++ board ("CFG"), and a client that
+// reads and changes them over the board's own serial port or through
+// readerd's socket.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "frame.h"
+
+namespace reader {
+
+// Mirrors the firmware's Settings, which the board keeps in EEPROM. baud
+// and binary are the link it boots with; a session's "FMT" leaves them.
+struct ReaderSettings {
+  int gainDb = 33;
+  uint32_t debounceMs = 3000;
+  uint32_t baud = 9600;
+  uint32_t pollIntervalMs = 0;
+  bool binary = false;
+};
+
+// Keys of "CFG SET": GAIN, DEBOUNCE, BAUD, POLL, FMT.
+bool isSettingKey(const std::string &key);
+
+// Parses the board's "OK CFG GAIN=.. DEBOUNCE=.. BAUD=.. POLL=.. FMT=.." reply.
+bool parseSettings(const std::string &reply, ReaderSettings *out);
+
+// "GAIN=33 DEBOUNCE=3000 BAUD=9600 POLL=0 FMT=TXT", as the board lists them.
+std::string formatSettings(const ReaderSettings &settings);
+
+// One CFG command at a time, waiting up to timeoutMs for the board's
+// answer. Other output (scans, batches, replies to other commands) is
+// skipped. A direct serial link must be the port's only user: stop readerd
+// first. The client never ACKs, so batches stay on the board for readerd.
+class SettingsClient {
+ public:
+  enum class Link {
+    kSerialText,      // the board's port in text mode
+    kSerialBinary,    // the board's port after "FMT BIN"
+    kReaderd,         // readerd's Unix socket; commands go through SEND
+  };
+
+  SettingsClient(int fd, Link link, int timeoutMs = 2000);
+
+  bool get(ReaderSettings *out);
+  // Applies and stores one setting. On a serial link the client follows
+  // a BAUD or FMT change itself; readerd does the same for its port.
+  bool set(const std::string &key, const std::string &value);
+  bool reset();
+
+  Link link() const { return link_; }
+  const std::string &error() const { return error_; }
+
+ private:
+  bool command(const std::string &line, std::string *reply);
+  bool nextText(std::string *text, int64_t deadlineMs);
+  void takeLines(std::vector<std::string> *texts);
+
+  int fd_;
+  Link link_;
+  int timeoutMs_;
+  std::string lineBuf_;
+  std::vector<std::string> pending_;   // board text not consumed yet
+  FrameDecoder decoder_;
+  std::string error_;
+};
+
+}  // namespace reader
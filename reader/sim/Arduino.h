@@ -0,0 +1,92 @@
+// Host stand-in for the Arduino core, just enough for program-pcb.c++.
+// Time is virtual: it only moves when the firmware waits on the simulated
+// hardware (SPI, RF timeouts, a full UART buffer) or the harness advances
+// it. See sim.h for the harness side.
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define NOT_AN_INTERRUPT -1
+#define DEC 10
+#define HEX 16
+
+// avr/pgmspace.h, which the real Arduino.h pulls in. The host has one
+// address space, so a string kept in flash is an ordinary string here.
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*reinterpret_cast<const uint8_t *>(addr))
+#define pgm_read_dword(addr) (*reinterpret_cast<const uint32_t *>(addr))
+#define pgm_read_ptr(addr) (*reinterpret_cast<const void *const *>(addr))
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define memcpy_P memcpy
+#define snprintf_P snprintf
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(PSTR(s)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int digitalPinToInterrupt(uint8_t pin);   // pins 2 and 3, as on the Uno
+void attachInterrupt(int interrupt, void (*isr)(), int mode);
+void detachInterrupt(int interrupt);
+void noInterrupts();
+void interrupts();
+
+class HardwareSerial {
+ public:
+  void begin(unsigned long baud);
+  void end();
+  explicit operator bool() const { return true; }
+
+  int available();
+  int read();
+  int peek();
+  void flush();
+
+  size_t write(uint8_t b);
+  size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *text) { return write(reinterpret_cast<const uint8_t *>(text), strlen(text)); }
+
+  size_t print(const char *text) { return write(text); }
+  size_t print(const __FlashStringHelper *text) { return write(reinterpret_cast<const char *>(text)); }
+  size_t print(char c) { return write(static_cast<uint8_t>(c)); }
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned int value, int base = DEC) { return print(static_cast<unsigned long>(value), base); }
+  size_t print(int value, int base = DEC) { return print(static_cast<long>(value), base); }
+  size_t print(unsigned char value, int base = DEC) { return print(static_cast<unsigned long>(value), base); }
+
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(T value) { return print(value) + println(); }
+  template <typename T>
+  size_t println(T value, int base) { return print(value, base) + println(); }
+};
+
+extern HardwareSerial Serial;
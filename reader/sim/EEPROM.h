@@ -0,0 +1,38 @@
+// Simulated 1 KiB EEPROM (ATmega328P size), erased to 0xFF like new parts.
+#pragma once
+
+#include "Arduino.h"
+
+class EEPROMClass {
+ public:
+  static const uint16_t kSize = 1024;
+
+  EEPROMClass() { memset(data_, 0xFF, sizeof(data_)); }
+
+  uint16_t length() const { return kSize; }
+  uint8_t read(int addr) const { return data_[addr % kSize]; }
+  void write(int addr, uint8_t value);
+  void update(int addr, uint8_t value) {
+    if (read(addr) != value) write(addr, value);
+  }
+
+  template <typename T>
+  T &get(int addr, T &value) const {
+    memcpy(&value, data_ + addr, sizeof(T));
+    return value;
+  }
+
+  template <typename T>
+  const T &put(int addr, const T &value) {
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(&value);
+    for (size_t i = 0; i < sizeof(T); i++) update(addr + i, p[i]);
+    return value;
+  }
+
+  uint8_t *raw() { return data_; }
+
+ private:
+  uint8_t data_[kSize];
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,154 @@
+// Simulated MFRC522 with the same API subset as the Arduino MFRC522
+// library. Card presence comes from the sim timeline; each call charges
+// the virtual clock according to sim::Timing and the chip's own timeout
+// register, so tuning TReloadReg shows up in the benchmarks.
+#pragma once
+
+#include "Arduino.h"
+
+class MFRC522 {
+ public:
+  static const byte MF_KEY_SIZE = 6;
+
+  enum PCD_Register : byte {
+    CommandReg = 0x01 << 1,
+    ComIEnReg = 0x02 << 1,
+    DivIEnReg = 0x03 << 1,
+    ComIrqReg = 0x04 << 1,
+    DivIrqReg = 0x05 << 1,
+    ErrorReg = 0x06 << 1,
+    Status1Reg = 0x07 << 1,
+    Status2Reg = 0x08 << 1,
+    FIFODataReg = 0x09 << 1,
+    FIFOLevelReg = 0x0A << 1,
+    ControlReg = 0x0C << 1,
+    BitFramingReg = 0x0D << 1,
+    CollReg = 0x0E << 1,
+    ModeReg = 0x11 << 1,
+    TxModeReg = 0x12 << 1,
+    RxModeReg = 0x13 << 1,
+    TxControlReg = 0x14 << 1,
+    TxASKReg = 0x15 << 1,
+    ModWidthReg = 0x24 << 1,
+    RFCfgReg = 0x26 << 1,
+    TModeReg = 0x2A << 1,
+    TPrescalerReg = 0x2B << 1,
+    TReloadRegH = 0x2C << 1,
+    TReloadRegL = 0x2D << 1,
+    VersionReg = 0x37 << 1
+  };
+
+  enum PCD_Command : byte {
+    PCD_Idle = 0x00,
+    PCD_CalcCRC = 0x03,
+    PCD_Transmit = 0x04,
+    PCD_Receive = 0x08,
+    PCD_Transceive = 0x0C,
+    PCD_MFAuthent = 0x0E,
+    PCD_SoftReset = 0x0F
+  };
+
+  enum PCD_RxGain : byte {
+    RxGain_18dB = 0x00 << 4,
+    RxGain_23dB = 0x01 << 4,
+    RxGain_18dB_2 = 0x02 << 4,
+    RxGain_23dB_2 = 0x03 << 4,
+    RxGain_33dB = 0x04 << 4,
+    RxGain_38dB = 0x05 << 4,
+    RxGain_43dB = 0x06 << 4,
+    RxGain_48dB = 0x07 << 4,
+    RxGain_min = 0x00 << 4,
+    RxGain_avg = 0x04 << 4,
+    RxGain_max = 0x07 << 4
+  };
+
+  enum PICC_Command : byte {
+    PICC_CMD_REQA = 0x26,
+    PICC_CMD_WUPA = 0x52,
+    PICC_CMD_HLTA = 0x50,
+    PICC_CMD_MF_AUTH_KEY_A = 0x60,
+    PICC_CMD_MF_AUTH_KEY_B = 0x61,
+    PICC_CMD_MF_READ = 0x30,
+    PICC_CMD_MF_WRITE = 0xA0
+  };
+
+  enum StatusCode : byte {
+    STATUS_OK,
+    STATUS_ERROR,
+    STATUS_COLLISION,
+    STATUS_TIMEOUT,
+    STATUS_NO_ROOM,
+    STATUS_INTERNAL_ERROR,
+    STATUS_INVALID,
+    STATUS_CRC_WRONG,
+    STATUS_MIFARE_NACK = 0xff
+  };
+
+  typedef struct {
+    byte size;
+    byte uidByte[10];
+    byte sak;
+  } Uid;
+
+  typedef struct {
+    byte keyByte[MF_KEY_SIZE];
+  } MIFARE_Key;
+
+  Uid uid;
+
+  MFRC522() {}
+  MFRC522(byte chipSelectPin, byte resetPowerDownPin) : ss_(chipSelectPin), rst_(resetPowerDownPin) {}
+
+  void PCD_Init() { PCD_Init(ss_, rst_); }
+  void PCD_Init(byte chipSelectPin, byte resetPowerDownPin);
+  void PCD_Reset();
+
+  void PCD_WriteRegister(PCD_Register reg, byte value);
+  void PCD_WriteRegister(PCD_Register reg, byte count, byte *values);
+  byte PCD_ReadRegister(PCD_Register reg);
+  void PCD_SetRegisterBitMask(PCD_Register reg, byte mask);
+  void PCD_ClearRegisterBitMask(PCD_Register reg, byte mask);
+
+  void PCD_AntennaOn();
+  void PCD_AntennaOff();
+  byte PCD_GetAntennaGain();
+  void PCD_SetAntennaGain(byte mask);
+  void PCD_SoftPowerDown();
+  void PCD_SoftPowerUp();
+
+  StatusCode PICC_RequestA(byte *bufferATQA, byte *bufferSize);
+  StatusCode PICC_WakeupA(byte *bufferATQA, byte *bufferSize);
+  StatusCode PICC_Select(Uid *uid, byte validBits = 0);
+  StatusCode PICC_HaltA();
+
+  StatusCode PCD_Authenticate(byte command, byte blockAddr, MIFARE_Key *key, Uid *uid);
+  void PCD_StopCrypto1();
+  StatusCode MIFARE_Read(byte blockAddr, byte *buffer, byte *bufferSize);
+  StatusCode MIFARE_Write(byte blockAddr, byte *buffer, byte bufferSize);
+
+  bool PICC_IsNewCardPresent();
+  bool PICC_ReadCardSerial();
+
+  // Simulation only: which timeline reader this instance is (init order).
+  int simReader() const { return reader_; }
+
+ private:
+  StatusCode requestOrWakeup(bool wakeup);
+  void startTransceive();
+  uint64_t timeoutUs() const;
+  void chargeTimeout();
+  bool answerWithin(uint64_t us);
+  // Lowest UID among the cards in this reader's field, or -1.
+  int cardInField(bool includeHalted) const;
+  void noteDetected();
+
+  byte ss_ = 0;
+  byte rst_ = 0;
+  int reader_ = -1;
+  byte regs_[64] = {};
+  bool ready_ = false;            // a card answered the last REQA/WUPA
+  int selected_ = -1;             // card in ACTIVE state
+  int authSector_ = -1;
+  bool poweredDown_ = false;
+  byte fifo_ = 0;                 // last byte written to FIFODataReg
+};
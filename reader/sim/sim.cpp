@@ -0,0 +1,564 @@
+#include "sim.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "MFRC522.h"
+#include "SPI.h"
+
+HardwareSerial Serial;
+SPIClass SPI;
+EEPROMClass EEPROM;
+
+namespace sim {
+
+namespace {
+
+struct State {
+  Timing timing;
+  uint64_t now = 0;
+  std::vector<Card> cards;
+
+  unsigned long baud = 9600;
+  bool serialOpen = false;
+  std::string rx;
+  size_t rxPos = 0;
+  std::string tx;
+  uint64_t txBytes = 0;
+  uint64_t txIdleAt = 0;
+
+  uint64_t readerBusy = 0;
+  int readersInitialised = 0;
+  uint64_t poweredDown = 0;             // closed power-down spells, summed
+  uint64_t downSince[16] = {};
+  bool down[16] = {};
+  int pins[64] = {};
+  int pinRises[64] = {};
+
+  int irqPins[16] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+  int irqsToDrop[16] = {};
+  void (*isrs[2])() = {};
+  bool interruptsOn = true;
+  std::vector<std::pair<uint64_t, int>> pendingIrqs;   // (at, interrupt)
+};
+
+State &state() {
+  static State s;
+  return s;
+}
+
+// Arduino's HardwareSerial TX ring; writes beyond it block until drained.
+const uint64_t kTxBuffer = 64;
+
+uint64_t byteUs() {
+  return 10000000ULL / state().baud;   // 8N1 = 10 bits per byte
+}
+
+// Runs the ISRs whose trigger time has passed, unless interrupts are off.
+void runDueIrqs() {
+  State &s = state();
+  if (!s.interruptsOn) return;
+  for (size_t i = 0; i < s.pendingIrqs.size();) {
+    if (s.pendingIrqs[i].first > s.now) {
+      i++;
+      continue;
+    }
+    void (*isr)() = s.isrs[s.pendingIrqs[i].second];
+    s.pendingIrqs.erase(s.pendingIrqs.begin() + i);
+    if (isr) isr();
+  }
+}
+
+void setPoweredDown(int reader, bool down) {
+  State &s = state();
+  if (reader < 0 || s.down[reader & 15] == down) return;
+  if (down) s.downSince[reader & 15] = s.now;
+  else s.poweredDown += s.now - s.downSince[reader & 15];
+  s.down[reader & 15] = down;
+}
+
+}  // namespace
+
+Timing &timing() { return state().timing; }
+uint64_t nowUs() { return state().now; }
+
+void advanceUs(uint64_t us) {
+  state().now += us;
+  runDueIrqs();
+}
+
+size_t addCard(int reader, const uint8_t *uid, uint8_t uidLen, uint64_t startUs, uint64_t endUs) {
+  Card card;
+  std::memset(&card, 0, sizeof(card));
+  card.reader = reader;
+  card.uidLen = uidLen;
+  std::memcpy(card.uid, uid, uidLen);
+  card.startUs = startUs;
+  card.endUs = endUs;
+  // Transport keys FF..FF, access bits FF 07 80 69 in every sector trailer.
+  for (int sector = 0; sector < 16; sector++) {
+    uint8_t *trailer = card.blocks[sector * 4 + 3];
+    std::memset(trailer, 0xFF, 16);
+    trailer[6] = 0xFF;
+    trailer[7] = 0x07;
+    trailer[8] = 0x80;
+    trailer[9] = 0x69;
+  }
+  state().cards.push_back(card);
+  return state().cards.size() - 1;
+}
+
+std::vector<Card> &cards() { return state().cards; }
+
+void hostSend(const std::string &bytes) { state().rx += bytes; }
+
+std::string takeTx() {
+  std::string out;
+  out.swap(state().tx);
+  return out;
+}
+
+uint64_t txBytes() { return state().txBytes; }
+uint64_t txIdleAtUs() { return std::max(state().txIdleAt, state().now); }
+unsigned long baud() { return state().baud; }
+
+uint64_t readerBusyUs() { return state().readerBusy; }
+
+uint64_t poweredDownUs() {
+  const State &s = state();
+  uint64_t us = s.poweredDown;
+  for (int r = 0; r < 16; r++) {
+    if (s.down[r]) us += s.now - s.downSince[r];
+  }
+  return us;
+}
+
+void chargeReader(uint64_t us) {
+  state().readerBusy += us;
+  advanceUs(us);
+}
+
+void wireIrq(int reader, int pin) { state().irqPins[reader & 15] = pin; }
+
+void raiseIrq(int reader, uint64_t at) {
+  if (state().irqsToDrop[reader & 15] > 0) {
+    state().irqsToDrop[reader & 15]--;
+    return;
+  }
+  int interrupt = digitalPinToInterrupt(state().irqPins[reader & 15]);
+  if (interrupt != NOT_AN_INTERRUPT) state().pendingIrqs.emplace_back(at, interrupt);
+}
+
+void dropIrqs(int reader, int count) { state().irqsToDrop[reader & 15] = count; }
+
+int pinState(int pin) { return state().pins[pin & 63]; }
+int pinRises(int pin) { return state().pinRises[pin & 63]; }
+int readerCount() { return state().readersInitialised; }
+
+void reset() {
+  Timing timing = state().timing;
+  state() = State();
+  state().timing = timing;
+}
+
+}  // namespace sim
+
+// ---- Arduino core --------------------------------------------------------
+
+unsigned long millis() { return static_cast<uint32_t>(sim::nowUs() / 1000); }
+unsigned long micros() { return static_cast<uint32_t>(sim::nowUs()); }
+void delay(unsigned long ms) { sim::advanceUs(ms * 1000ULL); }
+void delayMicroseconds(unsigned int us) { sim::advanceUs(us); }
+
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t pin, uint8_t value) {
+  int &level = sim::state().pins[pin & 63];
+  if (value && !level) sim::state().pinRises[pin & 63]++;
+  level = value;
+}
+int digitalRead(uint8_t pin) { return sim::state().pins[pin & 63]; }
+int digitalPinToInterrupt(uint8_t pin) { return pin == 2 ? 0 : pin == 3 ? 1 : NOT_AN_INTERRUPT; }
+
+// The MFRC522 IRQ is only ever wired for one edge, so the mode is not checked.
+void attachInterrupt(int interrupt, void (*isr)(), int) {
+  if (interrupt >= 0 && interrupt < 2) sim::state().isrs[interrupt] = isr;
+}
+
+void detachInterrupt(int interrupt) {
+  if (interrupt >= 0 && interrupt < 2) sim::state().isrs[interrupt] = nullptr;
+}
+
+void noInterrupts() { sim::state().interruptsOn = false; }
+
+void interrupts() {
+  sim::state().interruptsOn = true;
+  sim::runDueIrqs();
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+  sim::state().baud = baud ? baud : 9600;
+  sim::state().serialOpen = true;
+}
+
+void HardwareSerial::end() {
+  flush();
+  sim::state().serialOpen = false;
+}
+
+int HardwareSerial::available() {
+  sim::State &s = sim::state();
+  return static_cast<int>(s.rx.size() - s.rxPos);
+}
+
+int HardwareSerial::read() {
+  sim::State &s = sim::state();
+  if (s.rxPos >= s.rx.size()) return -1;
+  int c = static_cast<uint8_t>(s.rx[s.rxPos++]);
+  if (s.rxPos == s.rx.size()) {
+    s.rx.clear();
+    s.rxPos = 0;
+  }
+  return c;
+}
+
+int HardwareSerial::peek() {
+  sim::State &s = sim::state();
+  return s.rxPos < s.rx.size() ? static_cast<uint8_t>(s.rx[s.rxPos]) : -1;
+}
+
+void HardwareSerial::flush() {
+  sim::State &s = sim::state();
+  if (s.txIdleAt > s.now) s.now = s.txIdleAt;
+}
+
+size_t HardwareSerial::write(uint8_t b) { return write(&b, 1); }
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+  sim::State &s = sim::state();
+  uint64_t perByte = sim::byteUs();
+  uint64_t start = std::max(s.txIdleAt, s.now);
+  s.txIdleAt = start + size * perByte;
+
+  // Block while more than a TX buffer's worth is still queued.
+  uint64_t queued = (s.txIdleAt - s.now) / perByte;
+  if (queued > sim::kTxBuffer) s.now += (queued - sim::kTxBuffer) * perByte;
+
+  s.tx.append(reinterpret_cast<const char *>(buffer), size);
+  s.txBytes += size;
+  return size;
+}
+
+size_t HardwareSerial::print(unsigned long value, int base) {
+  char text[40];
+  if (base == HEX) snprintf(text, sizeof(text), "%lX", value);
+  else snprintf(text, sizeof(text), "%lu", value);
+  return write(text);
+}
+
+size_t HardwareSerial::print(long value, int base) {
+  if (base == HEX) return print(static_cast<unsigned long>(value), base);
+  char text[40];
+  snprintf(text, sizeof(text), "%ld", value);
+  return write(text);
+}
+
+void EEPROMClass::write(int addr, uint8_t value) {
+  data_[addr % kSize] = value;
+  sim::advanceUs(sim::timing().eepromWrite);
+}
+
+// ---- MFRC522 -------------------------------------------------------------
+
+void MFRC522::PCD_Init(byte chipSelectPin, byte resetPowerDownPin) {
+  ss_ = chipSelectPin;
+  rst_ = resetPowerDownPin;
+  if (reader_ < 0) reader_ = sim::state().readersInitialised++;
+  PCD_Reset();
+  // Same timer setup as the real library: 25 us ticks, 25 ms timeout.
+  PCD_WriteRegister(TModeReg, 0x80);
+  PCD_WriteRegister(TPrescalerReg, 0xA9);
+  PCD_WriteRegister(TReloadRegH, 0x03);
+  PCD_WriteRegister(TReloadRegL, 0xE8);
+  PCD_WriteRegister(TxASKReg, 0x40);
+  PCD_WriteRegister(ModeReg, 0x3D);
+  PCD_AntennaOn();
+}
+
+void MFRC522::PCD_Reset() {
+  std::memset(regs_, 0, sizeof(regs_));
+  regs_[RFCfgReg >> 1] = RxGain_48dB | 0x08;
+  regs_[VersionReg >> 1] = 0x92;
+  ready_ = false;
+  selected_ = -1;
+  authSector_ = -1;
+  poweredDown_ = false;
+  sim::setPoweredDown(reader_, false);
+  sim::chargeReader(sim::timing().spiRegister + 50);
+}
+
+void MFRC522::PCD_WriteRegister(PCD_Register reg, byte value) {
+  if (reg == ComIrqReg) {
+    // Set1 (bit 7) selects whether the marked bits are set or cleared.
+    if (value & 0x80) regs_[reg >> 1] |= value & 0x7F;
+    else regs_[reg >> 1] &= ~value;
+  } else {
+    regs_[reg >> 1] = value;
+  }
+  if (reg == FIFODataReg) fifo_ = value;
+  sim::chargeReader(sim::timing().spiRegister);
+  if (reg == BitFramingReg && (value & 0x80) && (regs_[CommandReg >> 1] & 0x0F) == PCD_Transceive) {
+    startTransceive();
+  }
+}
+
+void MFRC522::PCD_WriteRegister(PCD_Register reg, byte count, byte *values) {
+  for (byte i = 0; i < count; i++) regs_[reg >> 1] = values[i];
+  sim::chargeReader(sim::timing().spiRegister + count);
+}
+
+byte MFRC522::PCD_ReadRegister(PCD_Register reg) {
+  sim::chargeReader(sim::timing().spiRegister);
+  return regs_[reg >> 1];
+}
+
+void MFRC522::PCD_SetRegisterBitMask(PCD_Register reg, byte mask) {
+  PCD_WriteRegister(reg, PCD_ReadRegister(reg) | mask);
+}
+
+void MFRC522::PCD_ClearRegisterBitMask(PCD_Register reg, byte mask) {
+  PCD_WriteRegister(reg, PCD_ReadRegister(reg) & ~mask);
+}
+
+void MFRC522::PCD_AntennaOn() { PCD_SetRegisterBitMask(TxControlReg, 0x03); }
+void MFRC522::PCD_AntennaOff() { PCD_ClearRegisterBitMask(TxControlReg, 0x03); }
+byte MFRC522::PCD_GetAntennaGain() { return PCD_ReadRegister(RFCfgReg) & (0x07 << 4); }
+
+void MFRC522::PCD_SetAntennaGain(byte mask) {
+  if (PCD_GetAntennaGain() != mask) {
+    PCD_ClearRegisterBitMask(RFCfgReg, 0x07 << 4);
+    PCD_SetRegisterBitMask(RFCfgReg, mask & (0x07 << 4));
+  }
+}
+
+void MFRC522::PCD_SoftPowerDown() {
+  PCD_SetRegisterBitMask(CommandReg, 1 << 4);
+  poweredDown_ = true;
+  sim::setPoweredDown(reader_, true);
+}
+
+void MFRC522::PCD_SoftPowerUp() {
+  PCD_ClearRegisterBitMask(CommandReg, 1 << 4);
+  if (poweredDown_) sim::chargeReader(sim::timing().powerUp);
+  poweredDown_ = false;
+  sim::setPoweredDown(reader_, false);
+}
+
+// The chip's timer: prescaler from TModeReg/TPrescalerReg, reload from
+// TReloadReg, as configured by the firmware.
+uint64_t MFRC522::timeoutUs() const {
+  uint32_t prescaler = ((regs_[TModeReg >> 1] & 0x0F) << 8) | regs_[TPrescalerReg >> 1];
+  uint32_t reload = (regs_[TReloadRegH >> 1] << 8) | regs_[TReloadRegL >> 1];
+  return static_cast<uint64_t>(reload + 1) * (2 * prescaler + 1) / 13.56;
+}
+
+void MFRC522::chargeTimeout() { sim::chargeReader(timeoutUs()); }
+
+// An answer that takes us arrives only if the timer has not run out by
+// then; otherwise the library gives up at the timeout.
+bool MFRC522::answerWithin(uint64_t us) {
+  if (us > timeoutUs()) {
+    chargeTimeout();
+    return false;
+  }
+  sim::chargeReader(us);
+  return true;
+}
+
+// A transceive the firmware started itself and does not wait for (IRQ
+// detect mode). Only REQA/WUPA are modelled: an answering card sets RxIRq,
+// which drives the IRQ pin if RxIEn is enabled. No answer raises nothing;
+// TimerIRq is not modelled.
+void MFRC522::startTransceive() {
+  if (fifo_ != PICC_CMD_REQA && fifo_ != PICC_CMD_WUPA) return;
+  selected_ = -1;
+  authSector_ = -1;
+  bool antennaOn = (regs_[TxControlReg >> 1] & 0x03) != 0;
+  int card = poweredDown_ || !antennaOn ? -1 : cardInField(fifo_ == PICC_CMD_WUPA);
+  ready_ = card >= 0;
+  if (!ready_) return;
+  noteDetected();
+
+  byte enabled = regs_[ComIEnReg >> 1] & 0x7F;
+  bool lineWasActive = (regs_[ComIrqReg >> 1] & enabled) != 0;
+  regs_[ComIrqReg >> 1] |= 0x20;
+  if (!lineWasActive && (enabled & 0x20)) sim::raiseIrq(reader_, sim::nowUs() + sim::timing().reqaAnswer);
+}
+
+int MFRC522::cardInField(bool includeHalted) const {
+  uint64_t now = sim::nowUs();
+  int best = -1;
+  std::vector<sim::Card> &cards = sim::cards();
+  for (size_t i = 0; i < cards.size(); i++) {
+    const sim::Card &card = cards[i];
+    if (card.reader != reader_ || now < card.startUs || now >= card.endUs) continue;
+    if (card.halted && !includeHalted) continue;
+    if (best < 0 || std::memcmp(card.uid, cards[best].uid, 10) < 0) best = static_cast<int>(i);
+  }
+  return best;
+}
+
+// Stamps the cards answering a REQA/WUPA just sent (halted ones were
+// woken first if it was a WUPA).
+void MFRC522::noteDetected() {
+  uint64_t now = sim::nowUs();
+  for (sim::Card &c : sim::cards()) {
+    if (c.reader == reader_ && now >= c.startUs && now < c.endUs && !c.halted && !c.detectedUs) c.detectedUs = now;
+  }
+}
+
+MFRC522::StatusCode MFRC522::requestOrWakeup(bool wakeup) {
+  // Register setup and FIFO load done by PCD_TransceiveData.
+  sim::chargeReader(6 * sim::timing().spiRegister);
+  selected_ = -1;
+  authSector_ = -1;
+
+  bool antennaOn = (regs_[TxControlReg >> 1] & 0x03) != 0;
+  int card = poweredDown_ || !antennaOn ? -1 : cardInField(wakeup);
+  if (card < 0) {
+    ready_ = false;
+    chargeTimeout();
+    return STATUS_TIMEOUT;
+  }
+
+  if (wakeup) {
+    for (sim::Card &c : sim::cards()) {
+      if (c.reader == reader_ && sim::nowUs() >= c.startUs && sim::nowUs() < c.endUs) c.halted = false;
+    }
+  }
+  noteDetected();
+  ready_ = true;
+  sim::chargeReader(sim::timing().reqaAnswer);
+  return STATUS_OK;
+}
+
+MFRC522::StatusCode MFRC522::PICC_RequestA(byte *bufferATQA, byte *bufferSize) {
+  if (!bufferATQA || *bufferSize < 2) return STATUS_NO_ROOM;
+  StatusCode status = requestOrWakeup(false);
+  if (status == STATUS_OK) {
+    bufferATQA[0] = 0x04;
+    bufferATQA[1] = 0x00;
+    *bufferSize = 2;
+  }
+  return status;
+}
+
+MFRC522::StatusCode MFRC522::PICC_WakeupA(byte *bufferATQA, byte *bufferSize) {
+  if (!bufferATQA || *bufferSize < 2) return STATUS_NO_ROOM;
+  StatusCode status = requestOrWakeup(true);
+  if (status == STATUS_OK) {
+    bufferATQA[0] = 0x04;
+    bufferATQA[1] = 0x00;
+    *bufferSize = 2;
+  }
+  return status;
+}
+
+// Anticollision always resolves to the lowest UID among the woken cards.
+MFRC522::StatusCode MFRC522::PICC_Select(Uid *out, byte) {
+  int card = ready_ ? cardInField(false) : -1;
+  if (card < 0) {
+    chargeTimeout();
+    return STATUS_TIMEOUT;
+  }
+
+  sim::Card &c = sim::cards()[card];
+  int levels = c.uidLen <= 4 ? 1 : c.uidLen <= 7 ? 2 : 3;
+  sim::chargeReader(static_cast<uint64_t>(levels) * sim::timing().selectLevel);
+
+  out->size = c.uidLen;
+  std::memcpy(out->uidByte, c.uid, c.uidLen);
+  out->sak = 0x08;
+  if (!c.selectedUs) c.selectedUs = sim::nowUs();
+  selected_ = card;
+  ready_ = false;
+  return STATUS_OK;
+}
+
+// HLTA has no answer: the library reports success when the timer expires.
+MFRC522::StatusCode MFRC522::PICC_HaltA() {
+  sim::chargeReader(4 * sim::timing().spiRegister);
+  if (selected_ >= 0) sim::cards()[selected_].halted = true;
+  selected_ = -1;
+  authSector_ = -1;
+  chargeTimeout();
+  return STATUS_OK;
+}
+
+// A card that does not answer (not selected, wrong key, no such block)
+// leaves the library waiting out the timer, as does a slow answer.
+MFRC522::StatusCode MFRC522::PCD_Authenticate(byte command, byte blockAddr, MIFARE_Key *key, Uid *) {
+  authSector_ = -1;
+  if (selected_ < 0 || blockAddr >= 64) {
+    chargeTimeout();
+    return STATUS_TIMEOUT;
+  }
+
+  const uint8_t *trailer = sim::cards()[selected_].blocks[(blockAddr / 4) * 4 + 3];
+  const uint8_t *expected = command == PICC_CMD_MF_AUTH_KEY_B ? trailer + 10 : trailer;
+  if (std::memcmp(expected, key->keyByte, MF_KEY_SIZE) != 0) {
+    chargeTimeout();
+    return STATUS_TIMEOUT;
+  }
+  if (!answerWithin(sim::timing().mifareAuth)) return STATUS_TIMEOUT;
+  authSector_ = blockAddr / 4;
+  regs_[Status2Reg >> 1] |= 0x08;
+  return STATUS_OK;
+}
+
+void MFRC522::PCD_StopCrypto1() {
+  PCD_ClearRegisterBitMask(Status2Reg, 0x08);
+  authSector_ = -1;
+}
+
+MFRC522::StatusCode MFRC522::MIFARE_Read(byte blockAddr, byte *buffer, byte *bufferSize) {
+  if (!buffer || *bufferSize < 18) return STATUS_NO_ROOM;
+  if (selected_ < 0 || authSector_ != blockAddr / 4) {
+    chargeTimeout();
+    return STATUS_TIMEOUT;
+  }
+  if (!answerWithin(sim::timing().mifareRead)) return STATUS_TIMEOUT;
+
+  std::memcpy(buffer, sim::cards()[selected_].blocks[blockAddr], 16);
+  buffer[16] = buffer[17] = 0;   // CRC_A, not checked by callers
+  *bufferSize = 18;
+  return STATUS_OK;
+}
+
+MFRC522::StatusCode MFRC522::MIFARE_Write(byte blockAddr, byte *buffer, byte bufferSize) {
+  if (!buffer || bufferSize < 16) return STATUS_INVALID;
+  if (selected_ < 0 || authSector_ != blockAddr / 4) {
+    chargeTimeout();
+    return STATUS_TIMEOUT;
+  }
+  if (!answerWithin(sim::timing().mifareWrite)) return STATUS_TIMEOUT;
+
+  std::memcpy(sim::cards()[selected_].blocks[blockAddr], buffer, 16);
+  return STATUS_OK;
+}
+
+bool MFRC522::PICC_IsNewCardPresent() {
+  // The library resets the baud rates and modulation width first.
+  PCD_WriteRegister(TxModeReg, 0x00);
+  PCD_WriteRegister(RxModeReg, 0x00);
+  PCD_WriteRegister(ModWidthReg, 0x26);
+  byte atqa[2];
+  byte size = sizeof(atqa);
+  StatusCode result = PICC_RequestA(atqa, &size);
+  return result == STATUS_OK || result == STATUS_COLLISION;
+}
+
+bool MFRC522::PICC_ReadCardSerial() {
+  return PICC_Select(&uid) == STATUS_OK;
+}
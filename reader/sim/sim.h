@@ -0,0 +1,81 @@
+// Harness side of the simulated board: virtual clock, card timeline,
+// the host end of the UART and the cost model. The firmware only sees
+// the Arduino/MFRC522 API in Arduino.h, SPI.h, EEPROM.h and MFRC522.h.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace sim {
+
+// Microseconds charged to the virtual clock for each kind of work. The
+// defaults are for an ATmega328P at 16 MHz driving an MFRC522 at 4 MHz SPI.
+struct Timing {
+  uint32_t spiRegister = 8;       // one register read or write incl. CS toggle
+  uint32_t reqaAnswer = 150;      // REQA/WUPA -> ATQA
+  uint32_t selectLevel = 1200;    // anticollision + select, per cascade level
+  uint32_t mifareAuth = 3000;
+  uint32_t mifareRead = 2500;
+  uint32_t mifareWrite = 10000;   // both halves, up to the ACK after the card's EEPROM write
+  uint32_t powerUp = 1000;        // SoftPowerUp oscillator restart
+  uint32_t eepromWrite = 3300;    // per byte actually written
+  uint32_t loopOverhead = 20;     // firmware work per loop() pass
+};
+
+struct Card {
+  int reader;
+  uint8_t uidLen;
+  uint8_t uid[10];
+  uint64_t startUs;               // card enters the field
+  uint64_t endUs;                 // card leaves the field
+  bool halted;                    // HLTA received during this presence
+  uint64_t detectedUs;            // first REQA/WUPA it answered, 0 if never
+  uint64_t selectedUs;            // first successful select, 0 if never
+  uint8_t blocks[64][16];         // MIFARE Classic 1K contents
+};
+
+Timing &timing();
+
+uint64_t nowUs();
+void advanceUs(uint64_t us);
+
+// Adds a card presence and returns its index in cards().
+size_t addCard(int reader, const uint8_t *uid, uint8_t uidLen, uint64_t startUs, uint64_t endUs);
+std::vector<Card> &cards();
+
+// Host end of the UART. hostSend() bytes are readable by the firmware
+// immediately; takeTx() returns what the firmware wrote since last time.
+void hostSend(const std::string &bytes);
+std::string takeTx();
+uint64_t txBytes();
+uint64_t txIdleAtUs();            // when the last queued byte leaves the wire
+unsigned long baud();
+
+// Time the firmware spent blocked in reader calls.
+uint64_t readerBusyUs();
+void chargeReader(uint64_t us);
+// Time readers spent in soft power-down, summed over readers. A reader
+// still powered down counts up to now.
+uint64_t poweredDownUs();
+
+int pinState(int pin);
+// LOW to HIGH writes to a pin since reset(), i.e. the pulses it gave.
+int pinRises(int pin);
+
+// Connects a reader's IRQ output to an Arduino pin. The simulated MFRC522
+// calls raiseIrq() when that output goes active; the ISR attached to the
+// pin runs at the first clock advance at or after `at`.
+void wireIrq(int reader, int pin);
+void raiseIrq(int reader, uint64_t at);
+// Loses the reader's next count IRQs, as missed edges would.
+void dropIrqs(int reader, int count);
+
+// MFRC522 instances that have run PCD_Init, i.e. the firmware's reader count.
+int readerCount();
+
+// Restores power-on state (clock, timeline, UART, pins). EEPROM is kept,
+// like on real hardware.
+void reset();
+
+}  // namespace sim
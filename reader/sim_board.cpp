@@ -0,0 +1,180 @@
+// sim_board: program-pcb.c++ on the simulated board, held to the wall
+// clock so a host can talk to it as to a board on a serial port.
+// reader_load starts one per emulated board; the sim keeps its state in
+// globals, so it is one board per process.
+//
+// fd 3 is the board's UART: bytes read from it reach Serial, and what the
+// firmware writes comes out once the simulated wire has carried it at the
+// current baud. Control lines come on stdin and answers go to stdout:
+//
+//   TAP <reader> <uid> <dwell_ms> [RECORD]   a card enters the field now;
+//                                            RECORD provisions its record
+//   STATUS     -> STATUS <logged> <dropped> <resends> <host_timeouts>
+//
+// Once setup() has run it prints "READY <readers> <record_block>" (0 in a
+// build without CARD_RECORD_BLOCK). It exits when stdin or the UART closes.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "sim.h"
+#include "uid.h"
+
+void setup();
+void loop();
+
+// program-pcb.c++ counters.
+extern uint32_t nextEventSeq;
+extern uint32_t statDropped;
+extern uint32_t statBatchResends;
+extern uint32_t statHostTimeouts;
+
+#ifndef CARD_RECORD_BLOCK
+#define CARD_RECORD_BLOCK 0
+#endif
+
+namespace {
+
+constexpr int kUartFd = 3;
+constexpr size_t kPruneCards = 64;
+
+struct TxChunk {
+  uint64_t atUs;              // sim time the last byte leaves the wire
+  std::string bytes;
+};
+
+uint64_t monotonicUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool writeAll(int fd, const char *data, size_t len) {
+  while (len) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+// A record for the student the UID stands for, laid out as "CARD WRITE"
+// leaves it: the UID's bytes as the ObjectId's tail, group 1, CRC seeded
+// with the UID.
+void provisionRecord(sim::Card &card) {
+#if CARD_RECORD_BLOCK
+  uint8_t *block = card.blocks[CARD_RECORD_BLOCK];
+  std::memset(block, 0, 16);
+  block[0] = 0x5f;
+  std::memcpy(block + 12 - std::min<uint8_t>(card.uidLen, 7), card.uid, std::min<uint8_t>(card.uidLen, 7));
+  block[12] = 0x01;
+  uint16_t crc = reader::crc16(block, reader::kCardRecordLen, reader::crc16(card.uid, card.uidLen));
+  block[14] = crc & 0xFF;
+  block[15] = crc >> 8;
+#else
+  (void)card;
+#endif
+}
+
+// Cards only accumulate, and every REQA walks the list; once none is in a
+// field any more it can be dropped whole between loop() passes.
+void pruneCards() {
+  std::vector<sim::Card> &cards = sim::cards();
+  if (cards.size() < kPruneCards) return;
+  uint64_t now = sim::nowUs();
+  for (const sim::Card &card : cards) {
+    if (card.endUs > now) return;
+  }
+  cards.clear();
+}
+
+void onControl(const std::string &line) {
+  char command[16], hex[32], record[16] = "";
+  unsigned readerIndex = 0;
+  unsigned long dwellMs = 0;
+  int fields = std::sscanf(line.c_str(), "%15s %u %31s %lu %15s", command, &readerIndex, hex, &dwellMs, record);
+  if (fields >= 1 && std::strcmp(command, "STATUS") == 0) {
+    std::printf("STATUS %lu %lu %lu %lu\n", static_cast<unsigned long>(nextEventSeq - 1),
+                static_cast<unsigned long>(statDropped), static_cast<unsigned long>(statBatchResends),
+                static_cast<unsigned long>(statHostTimeouts));
+    std::fflush(stdout);
+    return;
+  }
+  reader::Uid uid;
+  if (fields < 4 || std::strcmp(command, "TAP") != 0 || !reader::uidFromHex(hex, std::strlen(hex), &uid)) {
+    std::fprintf(stderr, "sim_board: bad control line: %s\n", line.c_str());
+    return;
+  }
+  uint64_t now = sim::nowUs();
+  size_t index = sim::addCard(static_cast<int>(readerIndex), uid.bytes, uid.len, now, now + dwellMs * 1000);
+  if (std::strcmp(record, "RECORD") == 0) provisionRecord(sim::cards()[index]);
+}
+
+}  // namespace
+
+int main() {
+  uint64_t origin = monotonicUs();
+  sim::reset();
+  setup();
+  std::printf("READY %d %d\n", sim::readerCount(), CARD_RECORD_BLOCK);
+  std::fflush(stdout);
+
+  std::deque<TxChunk> tx;
+  std::string control;
+  char buf[4096];
+  for (;;) {
+    // Catch the board up with the wall clock; a pass that waits on the
+    // readers may leave it a little ahead, and it then sits out the poll.
+    uint64_t wall = monotonicUs() - origin;
+    while (sim::nowUs() < wall) {
+      loop();
+      sim::advanceUs(sim::timing().loopOverhead);
+      std::string bytes = sim::takeTx();
+      if (!bytes.empty()) tx.push_back({sim::txIdleAtUs(), std::move(bytes)});
+    }
+    pruneCards();
+
+    wall = monotonicUs() - origin;
+    while (!tx.empty() && tx.front().atUs <= wall) {
+      if (!writeAll(kUartFd, tx.front().bytes.data(), tx.front().bytes.size())) return 0;
+      tx.pop_front();
+    }
+
+    // At least a millisecond, so an idle board does not spin.
+    uint64_t wake = sim::nowUs();
+    if (!tx.empty()) wake = std::min(wake, tx.front().atUs);
+    wake = std::max(wake, wall + 1000);
+    pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {kUartFd, POLLIN, 0}};
+    if (poll(fds, 2, static_cast<int>((wake - wall + 999) / 1000)) <= 0) continue;
+
+    if (fds[0].revents & (POLLIN | POLLHUP)) {
+      ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+      if (n <= 0) return 0;
+      control.append(buf, n);
+      size_t nl;
+      while ((nl = control.find('\n')) != std::string::npos) {
+        onControl(control.substr(0, nl));
+        control.erase(0, nl + 1);
+      }
+    }
+    if (fds[1].revents & (POLLIN | POLLHUP)) {
+      ssize_t n = read(kUartFd, buf, sizeof(buf));
+      if (n <= 0) return 0;
+      sim::hostSend(std::string(buf, n));
+    }
+  }
+}
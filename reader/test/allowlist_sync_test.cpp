@@ -0,0 +1,120 @@
+// A full allowlist sync as server.js sends it (AL BEGIN 0, one "AL +" per
+// card, AL END), on the firmware and simulated EEPROM. In uidKey order
+// every add appends one entry; in arbitrary order most adds shift the
+// tail of the sorted list, a few EEPROM writes per entry moved. A BLOOM
+// rewrite over that list then clears the data area without holding up
+// loop().
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "EEPROM.h"
+#include "check.h"
+#include "firmware_host.h"
+
+namespace {
+
+// The firmware's uidKey (FNV-1a), as server.js computes it to sort.
+uint32_t uidKey(const std::string &hex) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < hex.size(); i += 2) {
+    h ^= std::stoul(hex.substr(i, 2), nullptr, 16);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+struct Sync {
+  uint64_t totalUs = 0;
+  uint64_t maxUs = 0;
+};
+
+Sync fullSync(test::FirmwareHost &host, const std::vector<std::string> &uids) {
+  Sync sync;
+  CHECK(host.command("AL BEGIN 0 1") == "OK AL BEGIN");
+  for (const std::string &uid : uids) {
+    uint64_t us;
+    CHECK(host.command("AL + " + uid, &us) == "OK");
+    sync.totalUs += us;
+    sync.maxUs = std::max(sync.maxUs, us);
+  }
+  CHECK(host.command("AL END") == "OK AL END");
+  CHECK(host.command("AL VER").compare(0, 11, "OK AL 1 " + std::to_string(uids.size())) == 0);
+  return sync;
+}
+
+bool sawLine(const test::FirmwareHost &host, const std::string &line) {
+  return std::find(host.lines().begin(), host.lines().end(), line) != host.lines().end();
+}
+
+// The longest loop() pass since STATS RESET, from the LOOP stage.
+unsigned long maxLoopUs(test::FirmwareHost &host) {
+  CHECK(host.command("STATS").compare(0, 8, "OK STATS") == 0);
+  for (const std::string &line : host.lines()) {
+    unsigned long count, minUs, meanUs, maxUs;
+    if (std::sscanf(line.c_str(), "STAT LOOP %lu %lu %lu %lu", &count, &minUs, &meanUs, &maxUs) == 4) return maxUs;
+  }
+  CHECK(false);
+  return 0;
+}
+
+// BEGIN BLOOM over a full sorted list: about 800 set bytes to zero, a
+// couple per pass, with the sync held shut until the last one.
+void bloomRewrite(test::FirmwareHost &host) {
+  uint64_t start = sim::nowUs();
+  host.send("AL BEGIN 0 2 BLOOM 3");
+  host.run(100000);
+  // Timed from after BEGIN itself, which stores the header.
+  CHECK(host.command("STATS RESET") == "OK STATS RESET");
+  CHECK(host.command("AL + 01020304") == "ERR AL BUSY");
+  CHECK(host.command("AL VER").compare(0, 8, "OK AL 0 ") == 0);
+  while (!sawLine(host, "OK AL BEGIN")) {
+    CHECK(sim::nowUs() - start < 10000000);
+    host.run(100000);
+  }
+  std::printf("bloom clear: %.1f s\n", (sim::nowUs() - start) / 1e6);
+  for (size_t addr = 80; addr < EEPROM.length(); addr++) CHECK(EEPROM.raw()[addr] == 0);
+  CHECK(maxLoopUs(host) < 20000);
+
+  CHECK(host.command("AL + 01020304") == "OK");
+  CHECK(host.command("AL END") == "OK AL END");
+  CHECK(host.command("AL VER").compare(0, 12, "OK AL 2 1 1 ") == 0);
+}
+
+}  // namespace
+
+int main() {
+  std::mt19937 rng(4);
+  std::vector<std::string> uids;
+  for (int i = 0; i < 200; i++) {
+    char hex[9];
+    std::snprintf(hex, sizeof(hex), "%08X", static_cast<unsigned>(rng()));
+    uids.push_back(hex);
+  }
+
+  test::FirmwareHost host;
+  std::memset(EEPROM.raw(), 0xFF, EEPROM.length());
+  CHECK(host.boot());
+  Sync unsorted = fullSync(host, uids);
+
+  std::sort(uids.begin(), uids.end(),
+            [](const std::string &a, const std::string &b) { return uidKey(a) < uidKey(b); });
+  std::memset(EEPROM.raw(), 0xFF, EEPROM.length());
+  CHECK(host.boot());
+  Sync sorted = fullSync(host, uids);
+
+  std::printf("unsorted: %.1f s, slowest add %.1f ms\n", unsorted.totalUs / 1e6, unsorted.maxUs / 1e3);
+  std::printf("sorted:   %.1f s, slowest add %.1f ms\n", sorted.totalUs / 1e6, sorted.maxUs / 1e3);
+  // One 4-byte entry is 13.2 ms of EEPROM writes, plus the command and
+  // its reply at 9600 baud.
+  CHECK(sorted.maxUs < 25000);
+  CHECK(sorted.totalUs < uids.size() * 25000);
+  CHECK(unsorted.totalUs > 10 * sorted.totalUs);
+
+  bloomRewrite(host);
+  return 0;
+}
@@ -0,0 +1,62 @@
+// CARD WRITE and the record read on tap, against the MFRC522 timer as the
+// firmware programs it. A write's ACK comes about 10 ms after the command,
+// twice the 5 ms a REQA poll waits, so the record exchange has to run
+// under its own, longer timeout; an answer later than that is a timeout.
+
+#include <cstring>
+#include <string>
+
+#include "check.h"
+#include "firmware_host.h"
+
+namespace {
+
+const uint8_t kUid[4] = {0xDE, 0xAD, 0xBE, 0xEF};
+const char kRecordHex[] = "5F00000000000000000000A10300";   // student, groups 0x0003 LE
+
+bool sawLine(const test::FirmwareHost &host, const std::string &prefix, const std::string &suffix = "") {
+  for (const std::string &line : host.lines()) {
+    if (line.compare(0, prefix.size(), prefix) == 0 && line.size() >= suffix.size() &&
+        line.compare(line.size() - suffix.size(), suffix.size(), suffix) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Holds the card on reader 0 for 300 ms, with the blocks it carries, and
+// returns its index.
+size_t tap(test::FirmwareHost &host, const uint8_t (*blocks)[16]) {
+  uint64_t now = sim::nowUs();
+  size_t card = sim::addCard(0, kUid, sizeof(kUid), now, now + 300000);
+  if (blocks) std::memcpy(sim::cards()[card].blocks, blocks, sizeof(sim::cards()[card].blocks));
+  host.run(400000);
+  return card;
+}
+
+}  // namespace
+
+int main() {
+  test::FirmwareHost host;
+  CHECK(host.boot());
+  CHECK(host.command("HELLO").compare(0, 8, "OK HELLO") == 0);
+
+  CHECK(host.command("CARD WRITE DEADBEEF 5F00000000000000000000A1 3") == "OK CARD WRITE");
+  size_t written = tap(host, nullptr);
+  CHECK(sawLine(host, "CARD DEADBEEF OK"));
+  uint8_t blocks[64][16];
+  std::memcpy(blocks, sim::cards()[written].blocks, sizeof(blocks));
+  CHECK(blocks[4][0] == 0x5F && blocks[4][11] == 0xA1 && blocks[4][12] == 0x03 && blocks[4][13] == 0x00);
+
+  // The card's next tap is logged with the record it now carries.
+  CHECK(host.command("PING").compare(0, 2, "OK") == 0);
+  tap(host, blocks);
+  CHECK(sawLine(host, "EVT:1:", std::string(":DEADBEEF:") + kRecordHex));
+
+  // A card slower than the record timeout does not get its write.
+  sim::timing().mifareWrite = 13000;
+  CHECK(host.command("CARD WRITE DEADBEEF 5F00000000000000000000B2 1") == "OK CARD WRITE");
+  tap(host, blocks);
+  CHECK(sawLine(host, "CARD DEADBEEF ERR"));
+  return 0;
+}
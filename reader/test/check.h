@@ -0,0 +1,14 @@
+// Assertions for the tests in this directory. A failed CHECK prints the
+// condition and ends the test with status 1, which ctest reports.
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+#define CHECK(cond)                                                                   \
+  do {                                                                                \
+    if (!(cond)) {                                                                    \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);   \
+      std::exit(1);                                                                   \
+    }                                                                                 \
+  } while (0)
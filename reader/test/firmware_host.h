@@ -0,0 +1,123 @@
+// The host end for tests that link program-pcb.c++ against the simulated
+// board: boots it, sends command lines and runs loop() on the virtual
+// clock until the board's answer comes back. Text lines and TEXT frames
+// (after "FMT BIN") both come out as lines.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "frame.h"
+#include "sim.h"
+
+void setup();
+void loop();
+
+namespace test {
+
+class FirmwareHost {
+ public:
+  FirmwareHost() : decoder_([this](const reader::Frame &frame) { onFrame(frame); }) {}
+
+  // Power-on: the board runs setup() with whatever EEPROM holds. Returns
+  // false unless it announces itself.
+  bool boot() {
+    sim::reset();
+    lines_.clear();
+    lineBuf_.clear();
+    decoder_.reset();
+#ifdef READER_IRQ_PIN_LIST
+    // Same wiring as the firmware build, in reader order.
+    const int irqPins[] = {READER_IRQ_PIN_LIST};
+    for (size_t r = 0; r < sizeof(irqPins) / sizeof(irqPins[0]); r++) sim::wireIrq(static_cast<int>(r), irqPins[r]);
+#endif
+    setup();
+    std::string tx = sim::takeTx();
+    // On a stored binary link the greeting is a TEXT frame.
+    binary_ = !tx.empty() && static_cast<uint8_t>(tx[0]) == reader::kFrameSync;
+    consume(tx);
+    return !lines_.empty() && lines_.front() == "RFID Reader Ready";
+  }
+
+  void send(const std::string &line) { sim::hostSend(line + "\n"); }
+
+  // Sends line and returns the first "OK ..." or "ERR ..." that follows,
+  // or "" after timeoutUs of board time. deviceUs, if given, is how long
+  // the board took to answer.
+  std::string command(const std::string &line, uint64_t *deviceUs = nullptr, uint64_t timeoutUs = 5000000) {
+    lines_.clear();
+    uint64_t start = sim::nowUs();
+    send(line);
+    std::string reply;
+    bool found = runUntil([&](const std::string &text) {
+      if (text.compare(0, 2, "OK") != 0 && text.compare(0, 4, "ERR ") != 0) return false;
+      reply = text;
+      return true;
+    }, timeoutUs);
+    if (deviceUs) *deviceUs = sim::txIdleAtUs() - start;
+    return found ? reply : std::string();
+  }
+
+  // Runs loop() for us of board time.
+  void run(uint64_t us) {
+    runUntil([](const std::string &) { return false; }, us);
+  }
+
+  // The link switched (FMT BIN, CFG SET FMT): decode frames from now on.
+  void setBinary(bool binary) {
+    binary_ = binary;
+    lineBuf_.clear();
+    decoder_.reset();
+  }
+
+  // Every line seen since the last command() or boot().
+  const std::vector<std::string> &lines() const { return lines_; }
+
+ private:
+  template <typename Match>
+  bool runUntil(Match match, uint64_t timeoutUs) {
+    uint64_t end = sim::nowUs() + timeoutUs;
+    size_t checked = lines_.size();
+    while (sim::nowUs() < end) {
+      loop();
+      sim::advanceUs(sim::timing().loopOverhead);
+      pump();
+      for (; checked < lines_.size(); checked++) {
+        if (match(lines_[checked])) return true;
+      }
+    }
+    return false;
+  }
+
+  void pump() { consume(sim::takeTx()); }
+
+  void consume(const std::string &tx) {
+    if (binary_) {
+      decoder_.feed(reinterpret_cast<const uint8_t *>(tx.data()), tx.size());
+      return;
+    }
+    for (char c : tx) {
+      if (c != '\n') {
+        lineBuf_ += c;
+        continue;
+      }
+      if (!lineBuf_.empty() && lineBuf_.back() == '\r') lineBuf_.pop_back();
+      lines_.push_back(lineBuf_);
+      lineBuf_.clear();
+    }
+  }
+
+  void onFrame(const reader::Frame &frame) {
+    if (frame.type == reader::kFrameText) {
+      lines_.emplace_back(reinterpret_cast<const char *>(frame.payload), frame.payloadLen);
+    }
+  }
+
+  reader::FrameDecoder decoder_;
+  bool binary_ = false;
+  std::string lineBuf_;
+  std::vector<std::string> lines_;
+};
+
+}  // namespace test
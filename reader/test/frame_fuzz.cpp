@@ -0,0 +1,130 @@
+// FrameDecoder against damaged streams, with a fixed seed.
+//
+//   - A frame with one or two bits flipped never reaches the handler, and
+//     the valid frame after it does, whatever the flip did to LEN.
+//   - Valid frames separated by random bytes and cut-off frames, fed in
+//     random chunk sizes, come out in order and no noise does.
+
+#include <cstring>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "frame.h"
+
+using namespace reader;
+
+namespace {
+
+// Frames are compared as their re-encoded bytes.
+std::string bytesOf(const Frame &frame) {
+  uint8_t out[255 + kFrameOverhead];
+  size_t n = encodeFrame(frame.type, frame.reader, frame.seq, frame.payload, frame.payloadLen, out);
+  return std::string(reinterpret_cast<const char *>(out), n);
+}
+
+std::string randomFrame(std::mt19937 &rng) {
+  static const uint8_t kTypes[] = {kFrameScan, kFrameBatch, kFrameText};
+  uint8_t payload[kFrameMaxPayload];
+  size_t len = rng() % 64;
+  for (size_t i = 0; i < len; i++) payload[i] = static_cast<uint8_t>(rng());
+  uint8_t out[255 + kFrameOverhead];
+  size_t n = encodeFrame(kTypes[rng() % 3], static_cast<uint8_t>(rng()), static_cast<uint16_t>(rng()), payload,
+                         len, out);
+  return std::string(reinterpret_cast<const char *>(out), n);
+}
+
+void feed(FrameDecoder &decoder, const std::string &bytes) {
+  decoder.feed(reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size());
+}
+
+void bitFlips() {
+  std::mt19937 rng(2);
+  std::vector<std::string> seen;
+  FrameDecoder decoder([&](const Frame &frame) { seen.push_back(bytesOf(frame)); });
+  // Enough filler for the largest LEN a flip can produce.
+  const std::string filler(255 + kFrameOverhead, '\0');
+
+  for (int i = 0; i < 50000; i++) {
+    std::string damaged = randomFrame(rng);
+    std::string next = randomFrame(rng);
+    size_t bits = damaged.size() * 8;
+    size_t a = rng() % bits, b = rng() % bits;
+    damaged[a / 8] ^= static_cast<char>(1 << (a % 8));
+    if (i % 2 && b != a) damaged[b / 8] ^= static_cast<char>(1 << (b % 8));
+    if (static_cast<uint8_t>(damaged[0]) != kFrameSync) continue;   // a flipped SYNC is plain noise
+
+    seen.clear();
+    feed(decoder, damaged + next + filler);
+    CHECK(seen.size() == 1);
+    CHECK(seen[0] == next);
+  }
+  CHECK(decoder.counters().crcErrors > 0);
+}
+
+void noiseAndTruncation() {
+  std::mt19937 rng(3);
+  std::string stream;
+  std::vector<std::string> sent;
+  std::set<std::string> cut;      // frames the stream carries only a prefix of
+  for (int i = 0; i < 20000; i++) {
+    switch (rng() % 4) {
+      case 0: {
+        size_t n = rng() % 48;
+        for (size_t k = 0; k < n; k++) stream += static_cast<char>(rng());
+        break;
+      }
+      case 1: {
+        std::string frame = randomFrame(rng);
+        cut.insert(frame);
+        stream += frame.substr(0, 1 + rng() % (frame.size() - 1));
+        break;
+      }
+      default:
+        break;
+    }
+    sent.push_back(randomFrame(rng));
+    stream += sent.back();
+  }
+  stream += std::string(255 + kFrameOverhead, '\0');
+
+  std::vector<std::string> seen;
+  FrameDecoder decoder([&](const Frame &frame) { seen.push_back(bytesOf(frame)); });
+  for (size_t pos = 0; pos < stream.size();) {
+    size_t n = std::min<size_t>(1 + rng() % 100, stream.size() - pos);
+    feed(decoder, stream.substr(pos, n));
+    pos += n;
+  }
+
+  // A prefix missing only its last CRC byte is completed by the next
+  // SYNC when that byte happens to be 0xA5: the board's own frame comes
+  // out, and the one whose SYNC it took is lost. Anything else delivered
+  // would be a phantom, anything else missing a failed resync.
+  size_t next = 0, completed = 0, lost = 0;
+  for (const std::string &frame : seen) {
+    if (next < sent.size() && frame == sent[next]) {
+      next++;
+      continue;
+    }
+    CHECK(cut.count(frame) == 1);
+    completed++;
+    CHECK(next < sent.size());
+    next++;
+    lost++;
+  }
+  CHECK(next == sent.size());
+  CHECK(lost == completed);
+  CHECK(completed < sent.size() / 1000);
+  CHECK(decoder.counters().frames == seen.size());
+  CHECK(decoder.counters().skippedBytes > 0);
+}
+
+}  // namespace
+
+int main() {
+  bitFlips();
+  noiseAndTruncation();
+  return 0;
+}
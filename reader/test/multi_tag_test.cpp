@@ -0,0 +1,75 @@
+// Two cards in one reader's field, as a wallet holding a student card and
+// a bank card: one detection cycle reads both, logs them back to back and
+// gives the gate a single verdict, green since one of them is allowed.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "check.h"
+#include "firmware_host.h"
+
+namespace {
+
+// program-pcb.c++'s feedback pins.
+constexpr int kGreenPin = 5;
+constexpr int kRedPin = 6;
+constexpr int kBuzzerPin = 4;
+
+// Anticollision resolves the lowest UID first, so the allowed card is read
+// ahead of the denied one.
+const uint8_t kAllowed[4] = {0x11, 0x22, 0x33, 0x44};
+const uint8_t kDenied[4] = {0xAA, 0xBB, 0xCC, 0xDD};
+
+struct Event {
+  unsigned long seq = 0;
+  unsigned long at = 0;
+};
+
+// The first EVT line for uidHex since the last command.
+bool findEvent(const test::FirmwareHost &host, const std::string &uidHex, Event *out) {
+  for (const std::string &line : host.lines()) {
+    char uid[32];
+    if (std::sscanf(line.c_str(), "EVT:%lu:%lu:%*u:%31[0-9A-F]", &out->seq, &out->at, uid) == 3 && uidHex == uid) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+int main() {
+  test::FirmwareHost host;
+  CHECK(host.boot());
+  CHECK(host.command("HELLO").compare(0, 8, "OK HELLO") == 0);
+  CHECK(host.command("AL BEGIN 0 1") == "OK AL BEGIN");
+  CHECK(host.command("AL + 11223344") == "OK");
+  CHECK(host.command("AL END") == "OK AL END");
+  CHECK(host.command("PING").compare(0, 2, "OK") == 0);
+
+  uint64_t now = sim::nowUs();
+  sim::addCard(0, kDenied, sizeof(kDenied), now, now + 300000);
+  sim::addCard(0, kAllowed, sizeof(kAllowed), now, now + 300000);
+  host.run(200000);
+
+  Event allowed, denied;
+  CHECK(findEvent(host, "11223344", &allowed));
+  CHECK(findEvent(host, "AABBCCDD", &denied));
+  CHECK(denied.seq == allowed.seq + 1);
+  CHECK(denied.at == allowed.at);
+  CHECK(sim::pinRises(kGreenPin) == 1);
+  CHECK(sim::pinRises(kRedPin) == 0);
+  CHECK(sim::pinRises(kBuzzerPin) == 0);
+
+  // The denied card alone, while the green is still lit, starts a cycle
+  // of its own and turns the gate red.
+  CHECK(sim::pinState(kGreenPin) == 1);
+  now = sim::nowUs();
+  uint8_t other[4] = {0xAA, 0xBB, 0xCC, 0xDE};
+  sim::addCard(0, other, sizeof(other), now, now + 300000);
+  host.run(50000);
+  CHECK(sim::pinRises(kRedPin) == 1);
+  CHECK(sim::pinState(kGreenPin) == 0);
+  return 0;
+}
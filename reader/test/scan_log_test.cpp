@@ -0,0 +1,215 @@
+// ScanLog reopened after damage: a writer that dies with an unsynced and
+// torn tail, then segments cut short or torn before the last one. A
+// crashed writer is a forked child that exits without closing the log.
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "scan_log.h"
+
+using namespace reader;
+
+namespace {
+
+constexpr uint64_t kSegment = ScanLog::kBlockRecords;
+constexpr off_t kHeaderBytes = 4096;
+constexpr off_t kCommittedOffset = 32;          // SegmentHeader::committed
+constexpr uint64_t kEpochMs = 1767225600000ull;    // 2026-01-01 UTC
+
+ScanRecord makeRecord(uint64_t n) {
+  ScanRecord record{};
+  record.scannedAtMs = kEpochMs + n * 1000;
+  record.seq = static_cast<uint32_t>(n + 1);
+  record.reader = static_cast<uint8_t>(n % 4);
+  record.uidLen = 4;
+  for (int i = 0; i < 4; i++) record.uid[i] = static_cast<uint8_t>(n >> (24 - 8 * i));
+  record.flags = kScanKnown;
+  record.student.bytes[0] = 0x5f;
+  record.student.bytes[11] = static_cast<uint8_t>(n % 8);
+  return record;
+}
+
+bool sameRecord(const ScanRecord &record, uint64_t n) {
+  ScanRecord want = makeRecord(n);
+  return record.scannedAtMs == want.scannedAtMs && record.seq == want.seq &&
+         std::memcmp(record.uid, want.uid, sizeof(want.uid)) == 0 && record.student == want.student;
+}
+
+std::string segmentFile(const std::string &dir, int index) {
+  char name[32];
+  std::snprintf(name, sizeof(name), "/scans-%06d.seg", index);
+  return dir + name;
+}
+
+off_t recordOffset(uint64_t n) {
+  return kHeaderBytes + static_cast<off_t>((n % kSegment) * sizeof(ScanRecord));
+}
+
+// Flips one byte of record n where it lies on disk, as a write cut off
+// halfway through would leave it.
+void tear(const std::string &dir, uint64_t n) {
+  int fd = ::open(segmentFile(dir, static_cast<int>(n / kSegment)).c_str(), O_RDWR);
+  CHECK(fd >= 0);
+  off_t at = recordOffset(n) + offsetof(ScanRecord, uid);
+  uint8_t byte = 0;
+  CHECK(pread(fd, &byte, 1, at) == 1);
+  byte ^= 0x40;
+  CHECK(pwrite(fd, &byte, 1, at) == 1);
+  ::close(fd);
+}
+
+off_t fileSize(const std::string &path) {
+  struct stat st;
+  CHECK(stat(path.c_str(), &st) == 0);
+  return st.st_size;
+}
+
+std::string readFile(const std::string &path) {
+  std::string bytes(static_cast<size_t>(fileSize(path)), '\0');
+  int fd = ::open(path.c_str(), O_RDONLY);
+  CHECK(fd >= 0);
+  CHECK(read(fd, &bytes[0], bytes.size()) == static_cast<ssize_t>(bytes.size()));
+  ::close(fd);
+  return bytes;
+}
+
+void writeFile(const std::string &path, const std::string &bytes) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_TRUNC);
+  CHECK(fd >= 0);
+  CHECK(write(fd, bytes.data(), bytes.size()) == static_cast<ssize_t>(bytes.size()));
+  ::close(fd);
+}
+
+// Appends records up to synced and syncs, appends on up to total, then
+// dies without syncing or closing.
+void crashWriter(const std::string &dir, const ScanLog::Options &opts, uint64_t synced, uint64_t total) {
+  pid_t child = fork();
+  CHECK(child >= 0);
+  if (child == 0) {
+    ScanLog writer;
+    if (!writer.open(dir, opts)) _exit(1);
+    for (uint64_t n = writer.size(); n < synced; n++) writer.append(makeRecord(n));
+    if (!writer.sync()) _exit(1);
+    for (uint64_t n = synced; n < total; n++) writer.append(makeRecord(n));
+    if (!writer.setExportCursor(total)) _exit(1);
+    _exit(0);
+  }
+  int status = 0;
+  CHECK(waitpid(child, &status, 0) == child);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+void checkRecords(const ScanLog &log, uint64_t count) {
+  CHECK(log.size() == count);
+  for (uint64_t n = 0; n < count; n++) CHECK(sameRecord(log.at(n), n));
+
+  uint64_t seen = 0;
+  log.scanRange(kEpochMs, kEpochMs + count * 1000, [&](uint64_t n, const ScanRecord &) { CHECK(n == seen++); });
+  CHECK(seen == count);
+}
+
+// The writer synced 300 records and stored 10 more; the 6th of those is
+// torn. The 5 before it survive; the 4 after it go with it.
+void tornTail(const std::string &dir, const ScanLog::Options &opts) {
+  crashWriter(dir, opts, 300, 310);
+  tear(dir, 305);
+
+  ScanLog log;
+  CHECK(log.open(dir, opts));
+  CHECK(log.segmentCount() == 2);
+  CHECK(log.recoveredRecords() == 5);
+  checkRecords(log, 305);
+  CHECK(log.exportCursor() == 305);
+
+  // The records after the torn one were cleared on open, so the one
+  // written in its place does not make them valid again.
+  CHECK(log.append(makeRecord(305)) == 305);
+  log.close();
+  CHECK(log.open(dir, opts));
+  CHECK(log.recoveredRecords() == 0);
+  checkRecords(log, 306);
+  log.close();
+
+  // A second crash after that recovers the unsynced tail in full.
+  crashWriter(dir, opts, 306, 320);
+  CHECK(log.open(dir, opts));
+  CHECK(log.recoveredRecords() == 14);
+  checkRecords(log, 320);
+  log.close();
+}
+
+// Segments are preallocated, so a last segment shorter than its header
+// says was cut by something other than a crash: open refuses it rather
+// than map records that are not there, and leaves the file alone.
+void truncatedSegment(const std::string &dir, const ScanLog::Options &opts) {
+  std::string last = segmentFile(dir, 1);
+  std::string saved = readFile(last);
+  CHECK(truncate(last.c_str(), recordOffset(kSegment + 100)) == 0);
+
+  ScanLog log;
+  errno = 0;
+  CHECK(!log.open(dir, opts));
+  CHECK(errno == EINVAL);
+  CHECK(fileSize(last) == recordOffset(kSegment + 100));
+
+  CHECK(truncate(last.c_str(), kHeaderBytes / 2) == 0);
+  errno = 0;
+  CHECK(!log.open(dir, opts));
+  CHECK(errno == EINVAL);
+
+  writeFile(last, saved);
+}
+
+// Only the last segment can be short after a crash. An earlier one whose
+// header lost its committed count is still read back record by record,
+// but a torn record in it is damage, and the log will not open past it.
+void tornEarlierSegment(const std::string &dir, const ScanLog::Options &opts) {
+  int fd = ::open(segmentFile(dir, 0).c_str(), O_RDWR);
+  CHECK(fd >= 0);
+  uint64_t committed = 0;
+  CHECK(pwrite(fd, &committed, sizeof(committed), kCommittedOffset) == sizeof(committed));
+  ::close(fd);
+
+  ScanLog log;
+  CHECK(log.open(dir, opts));
+  CHECK(log.recoveredRecords() == kSegment);
+  checkRecords(log, 320);
+  log.close();
+
+  tear(dir, 100);
+  errno = 0;
+  CHECK(!log.open(dir, opts));
+  CHECK(errno == EBADMSG);
+
+  ScanLog::Options readOnly = opts;
+  readOnly.readOnly = true;
+  errno = 0;
+  CHECK(!log.open(dir, readOnly));
+  CHECK(errno == EBADMSG);
+}
+
+}  // namespace
+
+int main() {
+  char dir[] = "/tmp/scan_log_test.XXXXXX";
+  CHECK(mkdtemp(dir));
+
+  ScanLog::Options opts;
+  opts.segmentRecords = kSegment;
+  tornTail(dir, opts);
+  truncatedSegment(dir, opts);
+  tornEarlierSegment(dir, opts);
+
+  std::string cleanup = std::string("rm -rf ") + dir;
+  return std::system(cleanup.c_str()) == 0 ? 0 : 1;
+}
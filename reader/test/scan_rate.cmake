@@ -0,0 +1,25 @@
+# Runs two reader_bench builds on the same rush and fails unless NEW
+# delivers every card and at least MIN_GAIN times the scans/s of OLD.
+#
+#   cmake -DNEW=reader_bench -DOLD=reader_bench_delay1000 -DMIN_GAIN=3
+#         "-DARGS=--rush;200;--gap;250;--dwell;400" -P scan_rate.cmake
+
+foreach(build NEW OLD)
+  execute_process(COMMAND ${${build}} ${ARGS} OUTPUT_VARIABLE out RESULT_VARIABLE status)
+  if(NOT out MATCHES "scans/s +([0-9.]+)")
+    message(FATAL_ERROR "${${build}}: no scans/s in its report (exit ${status})\n${out}")
+  endif()
+  set(${build}_RATE ${CMAKE_MATCH_1})
+  if(build STREQUAL "NEW" AND NOT status EQUAL 0)
+    message(FATAL_ERROR "${NEW} missed cards\n${out}")
+  endif()
+endforeach()
+
+# The bench prints scans/s with two decimals; compare in hundredths.
+string(REPLACE "." "" new_centi ${NEW_RATE})
+string(REPLACE "." "" old_centi ${OLD_RATE})
+math(EXPR needed "${old_centi} * ${MIN_GAIN}")
+message(STATUS "${NEW}: ${NEW_RATE} scans/s, ${OLD}: ${OLD_RATE} scans/s")
+if(new_centi LESS needed)
+  message(FATAL_ERROR "${NEW} is not ${MIN_GAIN}x ${OLD}")
+endif()
@@ -0,0 +1,139 @@
+// CFG between readercfg's side and the firmware's: parseSettings and
+// formatSettings agree with each other, and with what the board on the
+// simulated EEPROM answers to GET, SET and RESET, before and after a
+// power cycle. SettingsClient passes over replies to other commands.
+
+#include <cstring>
+#include <string>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "EEPROM.h"
+#include "check.h"
+#include "firmware_host.h"
+#include "settings.h"
+
+using namespace reader;
+
+namespace {
+
+bool sameSettings(const ReaderSettings &a, const ReaderSettings &b) {
+  return a.gainDb == b.gainDb && a.debounceMs == b.debounceMs && a.baud == b.baud &&
+         a.pollIntervalMs == b.pollIntervalMs && a.binary == b.binary;
+}
+
+ReaderSettings get(test::FirmwareHost &host) {
+  ReaderSettings settings;
+  CHECK(parseSettings(host.command("CFG GET"), &settings));
+  return settings;
+}
+
+void roundTrip() {
+  ReaderSettings settings;
+  settings.gainDb = 48;
+  settings.debounceMs = 65535;
+  settings.baud = 1000000;
+  settings.pollIntervalMs = 16;
+  settings.binary = true;
+  ReaderSettings parsed;
+  CHECK(parseSettings("OK CFG " + formatSettings(settings), &parsed));
+  CHECK(sameSettings(parsed, settings));
+  CHECK(parseSettings("OK CFG " + formatSettings(ReaderSettings()), &parsed));
+  CHECK(sameSettings(parsed, ReaderSettings()));
+
+  // Keys from newer firmware are skipped; a missing or garbled one is not.
+  CHECK(parseSettings("OK CFG GAIN=38 LED=1 DEBOUNCE=10 BAUD=19200 POLL=4 FMT=TXT", &parsed));
+  CHECK(parsed.gainDb == 38 && parsed.debounceMs == 10 && parsed.baud == 19200 && parsed.pollIntervalMs == 4);
+  CHECK(!parseSettings("OK CFG GAIN=38 DEBOUNCE=10 BAUD=19200 POLL=4", &parsed));
+  CHECK(!parseSettings("OK CFG GAIN=38 DEBOUNCE=10 BAUD=19200 POLL=4 FMT=HEX", &parsed));
+  CHECK(!parseSettings("OK CFG GAIN=x DEBOUNCE=10 BAUD=19200 POLL=4 FMT=TXT", &parsed));
+  CHECK(!parseSettings("ERR CFG KEY", &parsed));
+}
+
+// Another client's ERR ahead of the CFG reply, as the board sends them
+// or as readerd forwards them.
+void foreignReply(SettingsClient::Link link, const std::string &foreign, const std::string &reply) {
+  int fds[2];
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  std::string board = foreign + "\n" + reply + "\n";
+  CHECK(write(fds[1], board.data(), board.size()) == static_cast<ssize_t>(board.size()));
+  SettingsClient client(fds[0], link, 200);
+  ReaderSettings settings;
+  CHECK(client.get(&settings));
+  CHECK(settings.gainDb == 38 && settings.baud == 19200);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+}  // namespace
+
+int main() {
+  roundTrip();
+  foreignReply(SettingsClient::Link::kSerialText, "ERR AL VERSION",
+               "OK CFG GAIN=38 DEBOUNCE=10 BAUD=19200 POLL=4 FMT=TXT");
+  foreignReply(SettingsClient::Link::kReaderd, "{\"type\":\"reader\",\"text\":\"ERR AL VERSION\"}",
+               "{\"type\":\"reader\",\"text\":\"OK CFG GAIN=38 DEBOUNCE=10 BAUD=19200 POLL=4 FMT=TXT\"}");
+
+  std::memset(EEPROM.raw(), 0xFF, EEPROM.length());
+  test::FirmwareHost host;
+  CHECK(host.boot());
+  CHECK(host.command("HELLO").compare(0, 8, "OK HELLO") == 0);
+  CHECK(sameSettings(get(host), ReaderSettings()));
+
+  // A session's FMT takes the same rates as CFG SET BAUD.
+  CHECK(host.command("FMT BIN 11520") == "ERR FMT");
+  CHECK(host.command("FMT TXT 9600") == "OK FMT");
+  CHECK(sim::baud() == 9600);
+
+  ReaderSettings want;
+  want.gainDb = 43;
+  want.debounceMs = 1500;
+  want.pollIntervalMs = 8;
+  CHECK(host.command("CFG SET GAIN 43") == "OK CFG SET GAIN 43");
+  CHECK(host.command("CFG SET DEBOUNCE 1500") == "OK CFG SET DEBOUNCE 1500");
+  CHECK(host.command("CFG SET POLL 8") == "OK CFG SET POLL 8");
+  CHECK(sameSettings(get(host), want));
+
+  // Out of range, unknown and malformed: refused, nothing stored.
+  CHECK(host.command("CFG SET GAIN 40") == "ERR CFG RANGE");
+  CHECK(host.command("CFG SET DEBOUNCE 65536") == "ERR CFG RANGE");
+  CHECK(host.command("CFG SET POLL 17") == "ERR CFG RANGE");
+  CHECK(host.command("CFG SET BAUD 12345") == "ERR CFG RANGE");
+  CHECK(host.command("CFG SET FMT HEX") == "ERR CFG RANGE");
+  CHECK(host.command("CFG SET GAIN -1") == "ERR CFG RANGE");
+  CHECK(host.command("CFG SET LED 1") == "ERR CFG KEY");
+  CHECK(host.command("CFG SET GAIN") == "ERR CFG ARGS");
+  CHECK(host.command("CFG FLIP") == "ERR CFG ARGS");
+  CHECK(sameSettings(get(host), want));
+
+  // BAUD and FMT answer on the old link and switch after it.
+  want.baud = 115200;
+  CHECK(host.command("CFG SET BAUD 115200") == "OK CFG SET BAUD 115200");
+  CHECK(sim::baud() == 115200);
+  want.binary = true;
+  CHECK(host.command("CFG SET FMT BIN") == "OK CFG SET FMT BIN");
+  host.setBinary(true);
+  CHECK(sameSettings(get(host), want));
+
+  // A power cycle brings up the stored link, greeting in a TEXT frame.
+  CHECK(host.boot());
+  CHECK(sim::baud() == 115200);
+  CHECK(sameSettings(get(host), want));
+
+  // RESET stores the defaults but keeps this session's link.
+  CHECK(host.command("CFG RESET") == "OK CFG RESET");
+  CHECK(sameSettings(get(host), ReaderSettings()));
+  CHECK(sim::baud() == 115200);
+  CHECK(host.boot());
+  CHECK(sim::baud() == 9600);
+  CHECK(sameSettings(get(host), ReaderSettings()));
+
+  // A stored copy that fails its CRC is not trusted. The flipped bit is
+  // in debounceMs, a value the range checks would let through.
+  CHECK(host.command("CFG SET GAIN 48") == "OK CFG SET GAIN 48");
+  EEPROM.raw()[8] ^= 0x01;
+  CHECK(host.boot());
+  CHECK(sameSettings(get(host), ReaderSettings()));
+  return 0;
+}
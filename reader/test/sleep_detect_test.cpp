@@ -0,0 +1,73 @@
+// Detect latency with the readers asleep. Built with a short
+// SLEEP_AFTER_MS, the board is let fall back to SLEEP before each card,
+// and the card then arrives at a random point of the SLEEP_POLL_MS cycle.
+// From entering the field to the REQA that finds it must stay within the
+// MAX_DETECT_MS the firmware promises, and no poll may be counted late.
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+
+#include "check.h"
+#include "firmware_host.h"
+
+namespace {
+
+struct PollReply {
+  char mode[8] = "";
+  unsigned long wakes = 0;
+  unsigned long latePolls = 0;
+  unsigned long maxGapMs = 0;
+  unsigned long maxDetectMs = 0;
+};
+
+PollReply poll(test::FirmwareHost &host) {
+  PollReply reply;
+  unsigned long active, idle, sleep;
+  CHECK(std::sscanf(host.command("POLL").c_str(), "OK POLL %7s %lu %lu %lu %lu %lu %lu %lu", reply.mode, &active,
+                    &idle, &sleep, &reply.wakes, &reply.latePolls, &reply.maxGapMs, &reply.maxDetectMs) == 8);
+  return reply;
+}
+
+}  // namespace
+
+int main() {
+  const int kCards = 60;
+  test::FirmwareHost host;
+  CHECK(host.boot());
+  CHECK(host.command("HELLO").compare(0, 8, "OK HELLO") == 0);
+
+  std::mt19937 rng(15);
+  uint64_t worstUs = 0;
+  unsigned long maxDetectMs = 0;
+  for (int i = 0; i < kCards; i++) {
+    // Quiet until the board is asleep again, then a little more so the
+    // card lands anywhere in the sleep cycle.
+    do {
+      host.run(250000);
+    } while (std::string(poll(host).mode) != "SLEEP");
+    host.run(rng() % 250000);
+
+    uint8_t uid[4] = {0x5E, 0x00, static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i)};
+    uint64_t now = sim::nowUs();
+    size_t card = sim::addCard(0, uid, sizeof(uid), now, now + 400000);
+    host.run(500000);
+
+    const sim::Card &c = sim::cards()[card];
+    CHECK(c.detectedUs != 0 && c.selectedUs != 0);
+    worstUs = std::max(worstUs, c.detectedUs - c.startUs);
+
+    PollReply reply = poll(host);
+    CHECK(reply.latePolls == 0);
+    maxDetectMs = reply.maxDetectMs;
+  }
+
+  std::printf("sleep_detect_test: %d cards, worst detect %llu us of %lu ms\n", kCards,
+              static_cast<unsigned long long>(worstUs), maxDetectMs);
+  CHECK(worstUs <= maxDetectMs * 1000);
+  // The cards did meet sleeping readers: some waited out most of a cycle.
+  CHECK(worstUs >= 50000);
+  CHECK(poll(host).wakes > 0);
+  return 0;
+}
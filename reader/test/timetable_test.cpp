@@ -0,0 +1,184 @@
+// Timetable::resolve against a linear scan of every window: window edges,
+// overlapping sessions, windows across midnight and the end of the week,
+// then classes set, moved, removed (their slots reused), rosters changed
+// and the whole table cleared at random.
+
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "timetable.h"
+
+using namespace reader;
+
+namespace {
+
+constexpr int kWindow = 30;
+constexpr int kWeek = 7 * 24 * 60;
+
+struct ClassModel {
+  std::vector<Session> sessions;
+  std::set<std::string> students;
+};
+
+using Model = std::map<std::string, ClassModel>;
+
+// Minutes from the tap to the session, taken the short way round the week.
+int offset(const Session &session, int day, int minute) {
+  int diff = ((session.day * 24 * 60 + session.minute) - (day * 24 * 60 + minute) + kWeek) % kWeek;
+  return diff > kWeek / 2 ? diff - kWeek : diff;
+}
+
+// The classes whose nearest session is as near as any and, on a tie, as
+// early; several when classes share a start time.
+std::set<std::string> expected(const Model &model, const std::string &student, int day, int minute) {
+  std::set<std::string> best;
+  int bestDistance = kWindow + 1, bestOffset = 0;
+  for (const auto &entry : model) {
+    if (!entry.second.students.count(student)) continue;
+    for (const Session &session : entry.second.sessions) {
+      int off = offset(session, day, minute);
+      int distance = std::abs(off);
+      if (distance > kWindow) continue;
+      if (distance < bestDistance || (distance == bestDistance && off < bestOffset)) {
+        best.clear();
+        bestDistance = distance;
+        bestOffset = off;
+      }
+      if (distance == bestDistance && off == bestOffset) best.insert(entry.first);
+    }
+  }
+  return best;
+}
+
+void checkQuery(const Timetable &timetable, const Model &model, const std::string &student, int day, int minute) {
+  const std::string *found = timetable.resolve(student, day, minute);
+  std::set<std::string> want = expected(model, student, day, minute);
+  if (want.empty()) {
+    CHECK(found == nullptr);
+  } else {
+    CHECK(found != nullptr && want.count(*found));
+  }
+}
+
+const std::string *resolveAt(const Timetable &timetable, const std::string &student, int day, int hour, int minute) {
+  return timetable.resolve(student, day, hour * 60 + minute);
+}
+
+bool is(const std::string *found, const char *classId) { return found && *found == classId; }
+
+void edges() {
+  Timetable timetable(kWindow);
+  // Monday 09:00 and 09:40 overlap from 09:10 to 09:30.
+  timetable.setClass("math", {{1, 9 * 60}}, {"ana"});
+  timetable.setClass("art", {{1, 9 * 60 + 40}}, {"ana"});
+  CHECK(is(resolveAt(timetable, "ana", 1, 8, 30), "math"));
+  CHECK(resolveAt(timetable, "ana", 1, 8, 29) == nullptr);
+  CHECK(is(resolveAt(timetable, "ana", 1, 9, 19), "math"));
+  CHECK(is(resolveAt(timetable, "ana", 1, 9, 20), "math"));    // equally near: the earlier one
+  CHECK(is(resolveAt(timetable, "ana", 1, 9, 21), "art"));
+  CHECK(is(resolveAt(timetable, "ana", 1, 10, 10), "art"));
+  CHECK(resolveAt(timetable, "ana", 1, 10, 11) == nullptr);
+  CHECK(resolveAt(timetable, "ana", 2, 9, 0) == nullptr);
+  CHECK(resolveAt(timetable, "bob", 1, 9, 0) == nullptr);
+
+  // Tuesday 00:10 opens on Monday at 23:40; Monday 23:55 closes on
+  // Tuesday at 00:25; Sunday 00:05 opens on Saturday at 23:35.
+  timetable.setClass("night", {{2, 10}, {1, 23 * 60 + 55}, {0, 5}}, {"ana"});
+  CHECK(is(resolveAt(timetable, "ana", 1, 23, 40), "night"));
+  CHECK(is(resolveAt(timetable, "ana", 2, 0, 25), "night"));
+  CHECK(resolveAt(timetable, "ana", 2, 0, 41) == nullptr);
+  CHECK(is(resolveAt(timetable, "ana", 6, 23, 35), "night"));
+  CHECK(resolveAt(timetable, "ana", 6, 23, 34) == nullptr);
+
+  // A removed class's slot goes to the next class added; its students
+  // must not inherit the new one.
+  CHECK(timetable.removeClass("math"));
+  CHECK(!timetable.removeClass("math"));
+  timetable.setClass("chem", {{1, 9 * 60}}, {"bob"});
+  CHECK(resolveAt(timetable, "ana", 1, 9, 0) == nullptr);
+  CHECK(is(resolveAt(timetable, "bob", 1, 9, 0), "chem"));
+  CHECK(!timetable.enroll("math", "ana"));
+  CHECK(!timetable.unenroll("chem", "ana"));
+}
+
+std::vector<Session> randomSessions(std::mt19937 &rng) {
+  std::vector<Session> sessions;
+  int count = rng() % 4;
+  for (int i = 0; i < count; i++) {
+    // Half of them within an hour of midnight.
+    int minute = rng() % 2 ? rng() % (24 * 60) : (24 * 60 - 60 + rng() % 120) % (24 * 60);
+    sessions.push_back({static_cast<uint8_t>(rng() % 7), static_cast<uint16_t>(minute)});
+  }
+  return sessions;
+}
+
+void checkAll(const Timetable &timetable, const Model &model, const std::vector<std::string> &students,
+              std::mt19937 &rng) {
+  size_t windows = 0;
+  for (const auto &entry : model) windows += entry.second.sessions.size() * entry.second.students.size();
+  CHECK(timetable.windowCount() == windows);
+  for (const std::string &student : students) {
+    for (int i = 0; i < 40; i++) checkQuery(timetable, model, student, rng() % 7, rng() % (24 * 60));
+    for (int day = 0; day < 7; day++) {
+      for (int minute : {0, 1, 29, 30, 31, 24 * 60 - 31, 24 * 60 - 30, 24 * 60 - 1}) {
+        checkQuery(timetable, model, student, day, minute);
+      }
+    }
+  }
+}
+
+void churn() {
+  std::mt19937 rng(11);
+  std::vector<std::string> classes, students;
+  for (int i = 0; i < 24; i++) classes.push_back("class" + std::to_string(i));
+  for (int i = 0; i < 40; i++) students.push_back("student" + std::to_string(i));
+
+  Timetable timetable(kWindow);
+  Model model;
+  for (int round = 0; round < 60; round++) {
+    for (int op = 0; op < 50; op++) {
+      const std::string &cls = classes[rng() % classes.size()];
+      const std::string &student = students[rng() % students.size()];
+      switch (rng() % 5) {
+        case 0:
+        case 1: {
+          std::vector<Session> sessions = randomSessions(rng);
+          std::vector<std::string> roster;
+          for (int k = rng() % 12; k > 0; k--) roster.push_back(students[rng() % students.size()]);
+          timetable.setClass(cls, sessions, roster);
+          model[cls] = ClassModel{sessions, std::set<std::string>(roster.begin(), roster.end())};
+          break;
+        }
+        case 2:
+          CHECK(timetable.removeClass(cls) == (model.erase(cls) == 1));
+          break;
+        case 3:
+          CHECK(timetable.enroll(cls, student) == (model.count(cls) == 1));
+          if (model.count(cls)) model[cls].students.insert(student);
+          break;
+        default:
+          CHECK(timetable.unenroll(cls, student) == (model.count(cls) && model[cls].students.erase(student) == 1));
+          break;
+      }
+    }
+    checkAll(timetable, model, students, rng);
+    if (round % 20 == 19) {
+      timetable.clear();
+      model.clear();
+      checkAll(timetable, model, students, rng);
+    }
+  }
+}
+
+}  // namespace
+
+int main() {
+  edges();
+  churn();
+  return 0;
+}
@@ -0,0 +1,60 @@
+// UidIndex against a std::map under churn: cards issued, reissued and
+// erased at random over a fixed pool, through several rehashes and with
+// erased entries being reused.
+
+#include <map>
+#include <random>
+#include <string>
+
+#include "check.h"
+#include "uid_index.h"
+
+using namespace reader;
+
+namespace {
+
+Uid uidOf(uint32_t n) {
+  uint8_t bytes[7] = {static_cast<uint8_t>(n >> 24), static_cast<uint8_t>(n >> 16), static_cast<uint8_t>(n >> 8),
+                      static_cast<uint8_t>(n), 0x04, 0x80, 0x01};
+  return uidFromBytes(bytes, n % 2 ? 7 : 4);
+}
+
+void checkSame(const UidIndex &index, const std::map<uint32_t, std::string> &model, uint32_t pool) {
+  CHECK(index.size() == model.size());
+  for (uint32_t n = 0; n < pool; n++) {
+    const StudentRef *found = index.find(uidOf(n));
+    auto it = model.find(n);
+    CHECK((found != nullptr) == (it != model.end()));
+    if (found) CHECK(found->studentId == it->second);
+  }
+}
+
+}  // namespace
+
+int main() {
+  const uint32_t kPool = 3000;
+  std::mt19937 rng(5);
+  UidIndex index(16);
+  std::map<uint32_t, std::string> model;
+
+  for (int round = 0; round < 20; round++) {
+    for (int op = 0; op < 20000; op++) {
+      uint32_t n = rng() % kPool;
+      if (rng() % 3 == 0) {
+        CHECK(index.erase(uidOf(n)) == (model.erase(n) == 1));
+      } else {
+        std::string id = "s" + std::to_string(rng());
+        index.put(uidOf(n), StudentRef{id, "name"});
+        model[n] = id;
+      }
+    }
+    checkSame(index, model, kPool);
+  }
+
+  index.clear();
+  model.clear();
+  checkSame(index, model, kPool);
+  index.put(uidOf(7), StudentRef{"again", ""});
+  CHECK(index.find(uidOf(7)) && index.find(uidOf(7))->studentId == "again");
+  return 0;
+}
@@ -0,0 +1,199 @@
+#include "timetable.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace reader {
+
+namespace {
+
+constexpr int kMinutesPerDay = 24 * 60;
+
+}  // namespace
+
+bool parseSessions(const std::string &text, std::vector<Session> *out) {
+  out->clear();
+  if (text == "-") return true;
+
+  size_t pos = 0;
+  while (pos <= text.size()) {
+    size_t end = text.find(',', pos);
+    if (end == std::string::npos) end = text.size();
+    // <day>@<HH:MM>
+    const char *p = text.c_str() + pos;
+    char *next;
+    long day = std::strtol(p, &next, 10);
+    if (next == p || *next != '@' || day < 0 || day > 6) return false;
+    p = next + 1;
+    long hour = std::strtol(p, &next, 10);
+    if (next == p || *next != ':' || hour < 0 || hour > 23) return false;
+    p = next + 1;
+    long minute = std::strtol(p, &next, 10);
+    if (next == p || minute < 0 || minute > 59 || next != text.c_str() + end) return false;
+
+    out->push_back({static_cast<uint8_t>(day), static_cast<uint16_t>(hour * 60 + minute)});
+    pos = end + 1;
+  }
+  return true;
+}
+
+Timetable::Timetable(int windowMinutes) : window_(windowMinutes) {}
+
+uint32_t Timetable::classIndex(const std::string &classId) {
+  auto it = classIds_.find(classId);
+  if (it != classIds_.end()) return it->second;
+
+  uint32_t cls;
+  if (!freeClasses_.empty()) {
+    cls = freeClasses_.back();
+    freeClasses_.pop_back();
+  } else {
+    cls = static_cast<uint32_t>(classes_.size());
+    classes_.emplace_back();
+  }
+  classes_[cls] = ClassEntry();
+  classes_[cls].id = classId;
+  classes_[cls].live = true;
+  classIds_.emplace(classId, cls);
+  return cls;
+}
+
+uint32_t Timetable::studentIndex(const std::string &studentId) {
+  auto it = studentIds_.find(studentId);
+  if (it != studentIds_.end()) return it->second;
+  uint32_t student = static_cast<uint32_t>(students_.size());
+  students_.emplace_back();
+  studentIds_.emplace(studentId, student);
+  return student;
+}
+
+void Timetable::addSlots(uint32_t student, uint32_t cls) {
+  for (const Session &session : classes_[cls].sessions) {
+    std::vector<Slot> &day = students_[student].days[session.day];
+    Slot slot{session.minute, cls};
+    day.insert(std::upper_bound(day.begin(), day.end(), slot), slot);
+    windows_++;
+  }
+}
+
+void Timetable::removeSlots(uint32_t student, uint32_t cls) {
+  for (const Session &session : classes_[cls].sessions) {
+    std::vector<Slot> &day = students_[student].days[session.day];
+    Slot slot{session.minute, cls};
+    auto it = std::lower_bound(day.begin(), day.end(), slot);
+    if (it != day.end() && it->start == slot.start && it->cls == cls) {
+      day.erase(it);
+      windows_--;
+    }
+  }
+}
+
+void Timetable::setClass(const std::string &classId, const std::vector<Session> &sessions,
+                         const std::vector<std::string> &students) {
+  uint32_t cls = classIndex(classId);
+  ClassEntry &entry = classes_[cls];
+  for (uint32_t student : entry.students) removeSlots(student, cls);
+
+  entry.sessions = sessions;
+  entry.students.clear();
+  for (const std::string &studentId : students) entry.students.push_back(studentIndex(studentId));
+  std::sort(entry.students.begin(), entry.students.end());
+  entry.students.erase(std::unique(entry.students.begin(), entry.students.end()), entry.students.end());
+
+  for (uint32_t student : entry.students) addSlots(student, cls);
+}
+
+bool Timetable::removeClass(const std::string &classId) {
+  auto it = classIds_.find(classId);
+  if (it == classIds_.end()) return false;
+  uint32_t cls = it->second;
+  for (uint32_t student : classes_[cls].students) removeSlots(student, cls);
+  classes_[cls] = ClassEntry();
+  freeClasses_.push_back(cls);
+  classIds_.erase(it);
+  return true;
+}
+
+bool Timetable::enroll(const std::string &classId, const std::string &studentId) {
+  auto it = classIds_.find(classId);
+  if (it == classIds_.end()) return false;
+  uint32_t cls = it->second;
+  uint32_t student = studentIndex(studentId);
+  std::vector<uint32_t> &roster = classes_[cls].students;
+  auto pos = std::lower_bound(roster.begin(), roster.end(), student);
+  if (pos != roster.end() && *pos == student) return true;
+  roster.insert(pos, student);
+  addSlots(student, cls);
+  return true;
+}
+
+bool Timetable::unenroll(const std::string &classId, const std::string &studentId) {
+  auto cit = classIds_.find(classId);
+  auto sit = studentIds_.find(studentId);
+  if (cit == classIds_.end() || sit == studentIds_.end()) return false;
+  uint32_t cls = cit->second;
+  std::vector<uint32_t> &roster = classes_[cls].students;
+  auto pos = std::lower_bound(roster.begin(), roster.end(), sit->second);
+  if (pos == roster.end() || *pos != sit->second) return false;
+  roster.erase(pos);
+  removeSlots(sit->second, cls);
+  return true;
+}
+
+void Timetable::clear() {
+  classIds_.clear();
+  studentIds_.clear();
+  classes_.clear();
+  students_.clear();
+  freeClasses_.clear();
+  windows_ = 0;
+}
+
+// Windows all have the same width, so sorting by start also sorts them by
+// end: the first candidate is the first slot starting at or after
+// minute - window, and the candidates stop at minute + window.
+const Timetable::Slot *Timetable::nearest(const std::vector<Slot> &day, int minute) const {
+  int from = std::max(0, minute - window_);
+  auto it = std::lower_bound(day.begin(), day.end(), Slot{static_cast<uint16_t>(from), 0});
+  const Slot *best = nullptr;
+  int bestDistance = window_ + 1;
+  for (; it != day.end() && it->start <= minute + window_; ++it) {
+    int distance = std::abs(it->start - minute);
+    if (distance < bestDistance) {
+      best = &*it;
+      bestDistance = distance;
+    }
+  }
+  return best;
+}
+
+// The day before, the day itself and the day after, in that order so that
+// a tie still goes to the earlier session; the neighbours only when the
+// window reaches past midnight.
+const std::string *Timetable::resolve(const std::string &studentId, int day, int minute) const {
+  if (day < 0 || day > 6) return nullptr;
+  auto it = studentIds_.find(studentId);
+  if (it == studentIds_.end()) return nullptr;
+  const StudentEntry &student = students_[it->second];
+  const Slot *best = nullptr;
+  int bestDistance = window_ + 1;
+  for (int shift = -1; shift <= 1; shift++) {
+    if ((shift < 0 && minute >= window_) || (shift > 0 && minute + window_ < kMinutesPerDay)) continue;
+    int at = minute - shift * kMinutesPerDay;   // the tap, in minutes after that day's midnight
+    const Slot *slot = nearest(student.days[(day + shift + 7) % 7], at);
+    if (slot && std::abs(slot->start - at) < bestDistance) {
+      best = slot;
+      bestDistance = std::abs(slot->start - at);
+    }
+  }
+  return best ? &classes_[best->cls].id : nullptr;
+}
+
+void Timetable::resolveBatch(const Query *queries, size_t count, const std::string **out) const {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = queries[i].studentId ? resolve(*queries[i].studentId, queries[i].day, queries[i].minute)
+                                  : nullptr;
+  }
+}
+
+}  // namespace reader
@@ -0,0 +1,92 @@
+// Weekly class timetable compiled for "which class is this tap for?".
+//
+// Each class session (weekday + start time) opens a window of +-window
+// minutes around its start. For every student and weekday the windows of
+// the student's classes are kept sorted by start, so resolving a tap is a
+// binary search in that one list: O(log k) in the sessions the student has
+// that day, whatever the size of the center. A window near midnight reaches
+// into the next or previous day (Saturday night into Sunday), so a tap that
+// close to midnight searches that day's list too. Changing a class only
+// touches the lists of its own students.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace reader {
+
+struct Session {
+  uint8_t day;              // 0 = Sunday, as JavaScript's Date.getDay()
+  uint16_t minute;          // start, minutes after midnight
+};
+
+// Parses "<day>@<HH:MM>[,<day>@<HH:MM>...]"; "-" is an empty list.
+bool parseSessions(const std::string &text, std::vector<Session> *out);
+
+class Timetable {
+ public:
+  explicit Timetable(int windowMinutes = 30);
+
+  // Replaces the class's sessions and roster, or adds the class.
+  void setClass(const std::string &classId, const std::vector<Session> &sessions,
+                const std::vector<std::string> &students);
+  bool removeClass(const std::string &classId);
+  bool enroll(const std::string &classId, const std::string &studentId);
+  bool unenroll(const std::string &classId, const std::string &studentId);
+  void clear();
+
+  // The class with a session nearest to (day, minute), if one is within the
+  // window; nullptr otherwise. Ties go to the earlier session.
+  const std::string *resolve(const std::string &studentId, int day, int minute) const;
+
+  struct Query {
+    const std::string *studentId;
+    int day;
+    int minute;
+  };
+  // Resolves a batch of buffered scans; out[i] answers queries[i].
+  void resolveBatch(const Query *queries, size_t count, const std::string **out) const;
+
+  size_t classCount() const { return classIds_.size(); }
+  size_t studentCount() const { return studentIds_.size(); }
+  size_t windowCount() const { return windows_; }
+
+ private:
+  struct Slot {
+    uint16_t start;
+    uint32_t cls;
+    bool operator<(const Slot &other) const {
+      return start != other.start ? start < other.start : cls < other.cls;
+    }
+  };
+
+  struct ClassEntry {
+    std::string id;
+    std::vector<Session> sessions;
+    std::vector<uint32_t> students;   // sorted
+    bool live = false;
+  };
+
+  struct StudentEntry {
+    std::vector<Slot> days[7];
+  };
+
+  uint32_t classIndex(const std::string &classId);
+  uint32_t studentIndex(const std::string &studentId);
+  const Slot *nearest(const std::vector<Slot> &day, int minute) const;
+  void addSlots(uint32_t student, uint32_t cls);
+  void removeSlots(uint32_t student, uint32_t cls);
+
+  int window_;
+  std::unordered_map<std::string, uint32_t> classIds_;
+  std::unordered_map<std::string, uint32_t> studentIds_;
+  std::vector<ClassEntry> classes_;
+  std::vector<StudentEntry> students_;
+  std::vector<uint32_t> freeClasses_;   // slots of removed classes, reused
+  size_t windows_ = 0;
+};
+
+}  // namespace reader
@@ -0,0 +1,54 @@
+#include "uid.h"
+
+namespace reader {
+
+namespace {
+
+int hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+}  // namespace
+
+std::string uidToHex(const Uid &uid) {
+  static const char kHex[] = "0123456789ABCDEF";
+  std::string out(uid.len * 2, '0');
+  for (size_t i = 0; i < uid.len; i++) {
+    out[2 * i] = kHex[uid.bytes[i] >> 4];
+    out[2 * i + 1] = kHex[uid.bytes[i] & 0x0F];
+  }
+  return out;
+}
+
+bool uidFromHex(const char *text, size_t len, Uid *out) {
+  if (len == 0 || len % 2 || len / 2 > sizeof(out->bytes)) return false;
+  Uid uid;
+  uid.len = static_cast<uint8_t>(len / 2);
+  for (size_t i = 0; i < uid.len; i++) {
+    int hi = hexDigit(text[2 * i]);
+    int lo = hexDigit(text[2 * i + 1]);
+    if (hi < 0 || lo < 0) return false;
+    uid.bytes[i] = static_cast<uint8_t>(hi << 4 | lo);
+  }
+  *out = uid;
+  return true;
+}
+
+uint64_t uidHash(const Uid &uid) {
+  // FNV-1a followed by a murmur finalizer so linear probing sees
+  // well-spread low bits even for sequential UIDs.
+  uint64_t h = 14695981039346656037ULL ^ uid.len;
+  for (size_t i = 0; i < uid.len; i++) {
+    h ^= uid.bytes[i];
+    h *= 1099511628211ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+}  // namespace reader
@@ -0,0 +1,40 @@
+// Card UID as reported by the MFRC522: 4, 7 or 10 bytes.
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace reader {
+
+struct Uid {
+  uint8_t len = 0;
+  uint8_t bytes[10] = {};
+
+  bool operator==(const Uid &other) const {
+    return len == other.len && std::memcmp(bytes, other.bytes, len) == 0;
+  }
+  bool operator!=(const Uid &other) const { return !(*this == other); }
+};
+
+// Upper-case hex, the same spelling the firmware and the Card collection use.
+std::string uidToHex(const Uid &uid);
+
+// Accepts upper or lower case, no separators. Returns false on odd length,
+// non-hex characters or more than 10 bytes.
+bool uidFromHex(const char *text, size_t len, Uid *out);
+inline bool uidFromHex(const std::string &text, Uid *out) {
+  return uidFromHex(text.data(), text.size(), out);
+}
+
+inline Uid uidFromBytes(const uint8_t *bytes, size_t len) {
+  Uid uid;
+  uid.len = static_cast<uint8_t>(len > sizeof(uid.bytes) ? sizeof(uid.bytes) : len);
+  std::memcpy(uid.bytes, bytes, uid.len);
+  return uid;
+}
+
+// 64-bit mix of the UID bytes; used by the open-addressing tables.
+uint64_t uidHash(const Uid &uid);
+
+}  // namespace reader
@@ -0,0 +1,151 @@
+#include "uid_index.h"
+
+#include <fstream>
+
+namespace reader {
+
+namespace {
+
+size_t slotsFor(size_t entries) {
+  size_t slots = 16;
+  while (slots * 7 / 10 < entries) slots *= 2;
+  return slots;
+}
+
+}  // namespace
+
+UidIndex::UidIndex(size_t expected) {
+  slots_.assign(slotsFor(expected), kEmpty);
+  entries_.reserve(expected);
+}
+
+size_t UidIndex::probe(const Uid &uid, bool *found) const {
+  size_t mask = slots_.size() - 1;
+  size_t i = uidHash(uid) & mask;
+  size_t firstFree = SIZE_MAX;
+
+  for (;;) {
+    uint32_t slot = slots_[i];
+    if (slot == kEmpty) {
+      *found = false;
+      return firstFree != SIZE_MAX ? firstFree : i;
+    }
+    if (slot == kTombstone) {
+      if (firstFree == SIZE_MAX) firstFree = i;
+    } else if (entries_[slot].uid == uid) {
+      *found = true;
+      return i;
+    }
+    i = (i + 1) & mask;
+  }
+}
+
+void UidIndex::put(const Uid &uid, StudentRef student) {
+  bool found;
+  size_t i = probe(uid, &found);
+  if (found) {
+    entries_[slots_[i]].student = std::move(student);
+    return;
+  }
+
+  if ((used_ + 1) * 10 > slots_.size() * 7) {
+    rehash(slotsFor(2 * (live_ + 1)));
+    i = probe(uid, &found);
+  }
+
+  if (slots_[i] == kEmpty) used_++;
+  if (freeEntries_.empty()) {
+    slots_[i] = static_cast<uint32_t>(entries_.size());
+    entries_.push_back(Entry{uid, std::move(student), true});
+  } else {
+    // Reuse an erased entry, so churn at a steady size (cards reissued,
+    // deactivated, re-enabled) does not grow entries_ between rehashes.
+    slots_[i] = freeEntries_.back();
+    freeEntries_.pop_back();
+    entries_[slots_[i]] = Entry{uid, std::move(student), true};
+  }
+  live_++;
+}
+
+bool UidIndex::erase(const Uid &uid) {
+  bool found;
+  size_t i = probe(uid, &found);
+  if (!found) return false;
+
+  entries_[slots_[i]].live = false;
+  entries_[slots_[i]].student = StudentRef();
+  freeEntries_.push_back(slots_[i]);
+  slots_[i] = kTombstone;
+  live_--;
+  return true;
+}
+
+const StudentRef *UidIndex::find(const Uid &uid) const {
+  bool found;
+  size_t i = probe(uid, &found);
+  return found ? &entries_[slots_[i]].student : nullptr;
+}
+
+void UidIndex::clear() {
+  slots_.assign(slots_.size(), kEmpty);
+  entries_.clear();
+  freeEntries_.clear();
+  live_ = 0;
+  used_ = 0;
+}
+
+// Rebuilds the table without tombstones and compacts the entry vector.
+void UidIndex::rehash(size_t slots) {
+  std::vector<Entry> entries;
+  entries.reserve(live_ + 1);
+  for (Entry &entry : entries_) {
+    if (entry.live) entries.push_back(std::move(entry));
+  }
+
+  entries_ = std::move(entries);
+  freeEntries_.clear();
+  slots_.assign(slots, kEmpty);
+  used_ = live_ = entries_.size();
+
+  size_t mask = slots - 1;
+  for (size_t e = 0; e < entries_.size(); e++) {
+    size_t i = uidHash(entries_[e].uid) & mask;
+    while (slots_[i] != kEmpty) i = (i + 1) & mask;
+    slots_[i] = static_cast<uint32_t>(e);
+  }
+}
+
+bool UidIndex::loadSnapshot(const std::string &path, size_t *skipped) {
+  std::ifstream in(path);
+  if (!in) return false;
+
+  std::vector<std::pair<Uid, StudentRef>> rows;
+  size_t bad = 0;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    size_t tab1 = line.find('\t');
+    size_t tab2 = tab1 == std::string::npos ? tab1 : line.find('\t', tab1 + 1);
+    Uid uid;
+    if (tab1 == std::string::npos || !uidFromHex(line.data(), tab1, &uid)) {
+      bad++;
+      continue;
+    }
+    StudentRef student;
+    student.studentId = line.substr(tab1 + 1, tab2 == std::string::npos ? std::string::npos : tab2 - tab1 - 1);
+    if (tab2 != std::string::npos) student.name = line.substr(tab2 + 1);
+    rows.emplace_back(uid, std::move(student));
+  }
+
+  entries_.clear();
+  freeEntries_.clear();
+  entries_.reserve(rows.size());
+  slots_.assign(slotsFor(rows.size()), kEmpty);
+  live_ = used_ = 0;
+  for (auto &row : rows) put(row.first, std::move(row.second));
+
+  if (skipped) *skipped = bad;
+  return true;
+}
+
+}  // namespace reader
@@ -0,0 +1,56 @@
+// UID -> student lookup kept by readerd. Open addressing with linear
+// probing over a power-of-two table; entries live in a dense vector so a
+// full snapshot reload is one allocation.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "uid.h"
+
+namespace reader {
+
+struct StudentRef {
+  std::string studentId;    // Mongo ObjectId as hex
+  std::string name;
+};
+
+class UidIndex {
+ public:
+  explicit UidIndex(size_t expected = 1024);
+
+  // Inserts or replaces.
+  void put(const Uid &uid, StudentRef student);
+  bool erase(const Uid &uid);
+  const StudentRef *find(const Uid &uid) const;
+  void clear();
+
+  size_t size() const { return live_; }
+
+  // Loads "uid<TAB>studentId<TAB>name" lines, replacing the current
+  // contents. Malformed lines are skipped and counted in *skipped.
+  bool loadSnapshot(const std::string &path, size_t *skipped = nullptr);
+
+ private:
+  static constexpr uint32_t kEmpty = 0xFFFFFFFF;
+  static constexpr uint32_t kTombstone = 0xFFFFFFFE;
+
+  struct Entry {
+    Uid uid;
+    StudentRef student;
+    bool live;
+  };
+
+  size_t probe(const Uid &uid, bool *found) const;
+  void rehash(size_t slots);
+
+  std::vector<uint32_t> slots_;   // index into entries_, or kEmpty/kTombstone
+  std::vector<Entry> entries_;
+  std::vector<uint32_t> freeEntries_;   // erased entries, reused by put
+  size_t live_ = 0;
+  size_t used_ = 0;               // live + tombstones
+};
+
+}  // namespace reader
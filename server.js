@@ -5,6 +5,7 @@ const { SerialPort } = require('serialport');
 const { ReadlineParser } = require('@serialport/parser-readline');
 const socketio = require('socket.io');
 const path = require('path');
+const net = require('net');
 const cors = require('cors');
 const moment = require('moment');
 const jwt = require('jsonwebtoken');
@@ -450,6 +451,7 @@ app.post('/api/authorized-cards', async (req, res) => {
     });
 
     await authorizedCard.save();
+    syncRfidAllowlist();
     
     // Populate createdBy field for response
     await authorizedCard.populate('createdBy', 'username fullName');
@@ -480,6 +482,7 @@ app.put('/api/authorized-cards/:id',  async (req, res) => {
       return res.status(404).json({ error: 'البطاقة غير موجودة' });
     }
 
+    syncRfidAllowlist();
     res.json(authorizedCard);
   } catch (err) {
     res.status(400).json({ error: err.message });
@@ -494,6 +497,8 @@ app.delete('/api/authorized-cards/:id', async (req, res) => {
       return res.status(404).json({ error: 'البطاقة غير موجودة' });
     }
 
+    syncRfidAllowlist();
+
     res.json({ message: 'تم حذف البطاقة بنجاح' });
   } catch (err) {
     res.status(500).json({ error: err.message });
@@ -547,10 +552,713 @@ app.get('/api/authorized-cards/check/:uid', async (req, res) => {
 
 
 let serialPort = null;
+let rfidDaemon = null;
+
+// Sends one command line to the reader through whichever transport is up.
+function writeRfidLine(line) {
+  if (rfidDaemon && !rfidDaemon.destroyed) {
+    rfidDaemon.write(`SEND ${line}\n`);
+    return true;
+  }
+  if (serialPort && serialPort.isOpen) {
+    serialPort.write(line + '\n');
+    return true;
+  }
+  return false;
+}
+
+// Binary frames sent by the reader after "FMT BIN" (layout in reader/frame.h):
+// SYNC LEN TYPE READER SEQ_LO SEQ_HI PAYLOAD... CRC_LO CRC_HI
+const RFID_FRAME_SYNC = 0xA5;
+const RFID_FRAME_HEADER = 4;
+const RFID_FRAME_SCAN = 0x01;
+const RFID_FRAME_BATCH = 0x02;
+const RFID_FRAME_TEXT = 0x7F;
+
+function rfidCrc16(buf, start, end) {
+  let crc = 0xFFFF;
+  for (let i = start; i < end; i++) {
+    crc ^= buf[i] << 8;
+    for (let bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) & 0xFFFF : (crc << 1) & 0xFFFF;
+    }
+  }
+  return crc;
+}
+
+// Returns a function that takes raw serial chunks and calls onFrame for
+// every frame whose CRC checks out. Noise and corrupted frames are skipped.
+function createRfidFrameDecoder(onFrame) {
+  let pending = Buffer.alloc(0);
+
+  return (chunk) => {
+    pending = pending.length ? Buffer.concat([pending, chunk]) : chunk;
+    let pos = 0;
+
+    while (pos < pending.length) {
+      if (pending[pos] !== RFID_FRAME_SYNC) { pos++; continue; }
+      if (pending.length - pos < 2) break;
+
+      const len = pending[pos + 1];
+      if (len < RFID_FRAME_HEADER) { pos++; continue; }
+      if (pending.length - pos < len + 4) break;
+
+      const end = pos + 2 + len;
+      const crc = pending[end] | (pending[end + 1] << 8);
+      if (rfidCrc16(pending, pos + 1, end) !== crc) { pos++; continue; }
+
+      onFrame({
+        type: pending[pos + 2],
+        reader: pending[pos + 3],
+        seq: pending.readUInt16LE(pos + 4),
+        payload: pending.subarray(pos + 2 + RFID_FRAME_HEADER, end)
+      });
+      pos = end + 2;
+    }
+
+    pending = pending.subarray(pos);
+  };
+}
+
+// Class schedule days, indexed like Date.getDay().
+const SCHEDULE_DAYS = ['الأحد', 'الإثنين', 'الثلاثاء', 'الأربعاء', 'الخميس', 'الجمعة', 'السبت'];
+
+// classId is the class readerd resolved from its timetable (null: none in
+// session); undefined means resolve it here from the student's classes.
+// `logged` is set for taps readerd has written to its scan log with a
+// resolved class; their attendance arrives through the export below.
+// `record` is the student record read from the card itself, if any; it
+// names the student, so the Card lookup is skipped.
+async function handleCardScan(uid, scannedAt = new Date(), classId = undefined, logged = false, record = null) {
+  console.log('Card detected:', uid);
+
+  try {
+    const card = record ? null : await Card.findOne({ uid }).populate('student');
+    const studentId = record ? record.student : card && card.student._id;
+    if (studentId) {
+      const student = await Student.findById(studentId)
+        .populate({
+          path: 'classes',
+          populate: [
+            { path: 'teacher', model: 'Teacher' },
+            { path: 'students', model: 'Student' }
+          ]
+        });
+
+      if (!student) {
+        io.emit('unknown-card', { uid });
+        return;
+      }
+
+      const payments = await Payment.find({ student: student._id, status: { $in: ['pending', 'late'] } })
+        .populate('class');
+
+      // Check if any class is scheduled at the time of the tap
+      const now = scannedAt;
+      const day = SCHEDULE_DAYS[now.getDay()];
+      const currentHour = now.getHours();
+      const currentMinute = now.getMinutes();
+
+      let currentClass = null;
+
+      if (classId !== undefined) {
+        currentClass = (student.classes || []).find(cls => String(cls._id) === classId) || null;
+      } else {
+        for (const cls of student.classes || []) {
+          for (const schedule of cls.schedule || []) {
+            if (schedule.day === day) {
+              const [hour, minute] = schedule.time.split(':').map(Number);
+              if (Math.abs((hour - currentHour) * 60 + (minute - currentMinute)) <= 30) {
+                currentClass = cls;
+                break;
+              }
+            }
+          }
+          if (currentClass) break;
+        }
+      }
+
+      if (currentClass) {
+        // Record attendance
+        if (!logged) {
+          const attendance = new Attendance({
+            student: student._id,
+            class: currentClass._id,
+            date: now,
+            status: 'present'
+          });
+          await attendance.save();
+        }
+
+        // Send SMS to parent
+        // const smsContent = `تم تسجيل حضور الطالب ${student.name} في حصة ${currentClass.name} في ${now.toLocaleString()}`;
+
+        try {
+          await smsGateway.send(student.parentPhone, smsContent);
+          await Message.create({
+            sender: null,
+            recipients: [{ student: student._id, parentPhone: student.parentPhone }],
+            class: currentClass._id,
+            content: smsContent,
+            messageType: 'individual'
+          });
+        } catch (smsErr) {
+          console.error('Failed to send SMS:', smsErr);
+        }
+      }
+
+      io.emit('student-detected', {
+        student,
+        card: card || { uid, student: student._id, groups: record.groups },
+        classes: student.classes || [],
+        payments: payments || [],
+        currentClass
+      });
+    } else {
+      io.emit('unknown-card', { uid });
+    }
+  } catch (err) {
+    console.error('Error processing card:', err);
+    io.emit('card-error', { error: 'Error processing card' });
+  }
+}
+
+// Commands that expect an "OK ..." / "ERR ..." reply from the reader,
+// oldest first. Each reply goes to the oldest command it answers: a bloom
+// "AL BEGIN" answers late, and on a shared link other clients' replies
+// (readercfg's "OK CFG ...") come through too. Commands with a multi-line
+// answer (STATS) pass `lines` to collect the "STAT ..." lines that precede
+// the final OK.
+let rfidPendingReplies = [];
+
+// Whether reply text can answer command line. Replies name their command
+// ("OK AL END", "ERR CARD AUTH"), except PING's "OK PONG", the bare "OK"
+// of "AL +" / "AL -", and "ERR UNKNOWN" from firmware without the command.
+function rfidReplyAnswers(line, text) {
+  if (text === 'ERR UNKNOWN') return true;
+  const verb = line.split(' ')[0];
+  if (verb === 'PING') return text === 'OK PONG';
+  if (text === 'OK') return line.startsWith('AL +') || line.startsWith('AL -');
+  const rest = text.startsWith('OK ') ? text.slice(3) : text.startsWith('ERR ') ? text.slice(4) : null;
+  return rest !== null && (rest === verb || rest.startsWith(verb + ' '));
+}
+
+function rfidCommand(line, timeoutMs = 5000, lines = null) {
+  return new Promise((resolve, reject) => {
+    const entry = { line, resolve, reject, lines };
+    rfidPendingReplies.push(entry);
+    if (!writeRfidLine(line)) {
+      rfidPendingReplies.pop();
+      reject(new Error('RFID reader not connected'));
+      return;
+    }
+    entry.timer = setTimeout(() => {
+      rfidPendingReplies = rfidPendingReplies.filter(e => e !== entry);
+      reject(new Error(`RFID command timed out: ${line}`));
+    }, timeoutMs);
+  });
+}
+
+// Returns true if text was a command reply.
+function handleRfidReply(text) {
+  if (text.startsWith('CARD ')) return handleRfidCardWrite(text);
+  if (text.startsWith('STAT ')) {
+    const entry = rfidPendingReplies.find(e => e.lines);
+    if (entry) entry.lines.push(text);
+    return true;
+  }
+  if (!text.startsWith('OK') && !text.startsWith('ERR')) return false;
+  // Not ours if no pending command matches.
+  const index = rfidPendingReplies.findIndex(e => rfidReplyAnswers(e.line, text));
+  if (index >= 0) {
+    const [entry] = rfidPendingReplies.splice(index, 1);
+    clearTimeout(entry.timer);
+    if (text.startsWith('OK')) entry.resolve(text);
+    else entry.reject(new Error(text));
+  }
+  return true;
+}
+
+// Reader-side timing from "STATS": per stage count and min/mean/max in
+// microseconds plus a histogram (<64us, <256us, <1ms, <4ms, <16ms, more),
+// and failure counters, so a slow reader can be told from a slow server.
+const RFID_STAT_BUCKETS = ['64us', '256us', '1ms', '4ms', '16ms', 'more'];
+
+async function readRfidStats() {
+  const lines = [];
+  const reply = await rfidCommand('STATS', 5000, lines);
+  const stats = { sinceResetMs: Number(reply.split(' ')[2]), stages: {}, errors: {} };
+  for (const line of lines) {
+    const [, name, ...values] = line.split(' ');
+    const numbers = values.map(Number);
+    if (name === 'ERR') {
+      const [selectFailed, batchResends, hostTimeouts, dropped, commandOverflows, noCardRecord = 0] = numbers;
+      stats.errors = { selectFailed, batchResends, hostTimeouts, dropped, commandOverflows, noCardRecord };
+    } else {
+      const [count, minUs, meanUs, maxUs, ...buckets] = numbers;
+      stats.stages[name.toLowerCase()] = {
+        count, minUs, meanUs, maxUs,
+        histogram: Object.fromEntries(RFID_STAT_BUCKETS.map((bound, i) => [bound, buckets[i] || 0]))
+      };
+    }
+  }
+  // Polling mode and time per mode ("POLL"); absent on older firmware.
+  try {
+    const [, , mode, activeMs, idleMs, sleepMs, wakes, latePolls, maxGapMs, maxDetectMs] =
+      (await rfidCommand('POLL')).split(' ');
+    stats.polling = {
+      mode: mode.toLowerCase(),
+      msInMode: { active: Number(activeMs), idle: Number(idleMs), sleep: Number(sleepMs) },
+      wakes: Number(wakes),
+      latePolls: Number(latePolls),
+      maxPollGapMs: Number(maxGapMs),
+      maxDetectMs: Number(maxDetectMs)
+    };
+  } catch (err) {
+    stats.polling = null;
+  }
+  return stats;
+}
+
+// Student record cached in a MIFARE data block of the card (firmware
+// CARD_RECORD_BLOCK): the student's ObjectId and a 16-bit bitmap with bit
+// rfidClassGroup(id) set for each class the student had when the card was
+// issued. It follows the UID in scan events; the reader checks its CRC.
+const RFID_CARD_RECORD_LEN = 14;
+const RFID_CARD_WRITE_TIMEOUT_MS = 10000;     // the reader's CARD_WRITE_TIMEOUT_MS
+
+function rfidClassGroup(classId) {
+  return parseInt(String(classId).slice(-1), 16);
+}
+
+function rfidCardRecord(bytes) {
+  if (!bytes || bytes.length !== RFID_CARD_RECORD_LEN) return null;
+  return { student: bytes.subarray(0, 12).toString('hex'), groups: bytes.readUInt16LE(12) };
+}
+
+// Cards armed with "CARD WRITE", by UID. The reader reports the outcome
+// later as "CARD <uid> OK|ERR|TIMEOUT", once the card has been tapped.
+const rfidCardWrites = new Map();
+
+function handleRfidCardWrite(text) {
+  const [, uid, result] = text.split(' ');
+  const entry = rfidCardWrites.get(uid);
+  if (entry) {
+    clearTimeout(entry.timer);
+    rfidCardWrites.delete(uid);
+    if (result === 'OK') entry.resolve();
+    else entry.reject(new Error(`RFID card write: ${result}`));
+  }
+  return true;
+}
+
+// Resolves once the card has been tapped on the reader and its record
+// written and read back.
+async function encodeRfidCard(uid, student) {
+  const groups = (student.classes || []).reduce((bits, cls) => bits | (1 << rfidClassGroup(cls._id || cls)), 0);
+  await rfidCommand(`CARD WRITE ${uid} ${student._id} ${groups.toString(16).padStart(4, '0')}`);
+  return new Promise((resolve, reject) => {
+    const timer = setTimeout(() => {
+      rfidCardWrites.delete(uid);
+      reject(new Error('RFID card write timed out'));
+    }, RFID_CARD_WRITE_TIMEOUT_MS + 5000);
+    rfidCardWrites.set(uid, { resolve, reject, timer });
+  });
+}
+
+function resetRfidReplies() {
+  for (const entry of [...rfidPendingReplies, ...rfidCardWrites.values()]) {
+    clearTimeout(entry.timer);
+    entry.reject(new Error('RFID reader restarted'));
+  }
+  rfidPendingReplies = [];
+  rfidCardWrites.clear();
+}
+
+// Allowlist last pushed to the reader's EEPROM. The reader gives instant
+// accept/deny feedback from it; when the versions match only the
+// difference is sent, otherwise the list is rewritten. Lists larger than
+// the reader's capacity go out as a Bloom filter (adds only).
+const RFID_BLOOM_HASHES = 4;
+let rfidAllowlist = { version: 0, bloom: false, uids: new Set() };
+let rfidAllowlistSync = Promise.resolve();
+
+// The sorted list is kept in the order of the reader's uidKey (FNV-1a over
+// the UID bytes). Each add or remove in a delta shifts the entries after
+// it in EEPROM, so only small deltas are sent; a rewrite goes out in key
+// order and every add is an append.
+const RFID_ALLOWLIST_MAX_DELTA = 8;
+// A BLOOM rewrite answers AL BEGIN only once the reader has zeroed its
+// bitmap, a couple of bytes per loop() pass: about 5 s after a full list.
+const RFID_ALLOWLIST_CLEAR_TIMEOUT_MS = 15000;
+
+function rfidUidKey(uid) {
+  let h = 0x811C9DC5;
+  for (let i = 0; i < uid.length; i += 2) {
+    h ^= parseInt(uid.substring(i, i + 2), 16);
+    h = Math.imul(h, 0x01000193);
+  }
+  return h >>> 0;
+}
+
+async function pushRfidAllowlist() {
+  const [, , version, , mode, capacity] = (await rfidCommand('AL VER')).split(' ');
+  const cards = await AuthorizedCard.find({ active: true, expirationDate: { $gte: new Date() } }, 'uid');
+  const uids = new Set(cards
+    .map(card => card.uid.toUpperCase())
+    .filter(uid => /^([0-9A-F]{2}){1,10}$/.test(uid)));
+  const bloom = uids.size > Number(capacity);
+
+  const removed = [...rfidAllowlist.uids].filter(uid => !uids.has(uid));
+  const fresh = [...uids].filter(uid => !rfidAllowlist.uids.has(uid));
+  const delta = Number(version) !== 0 &&
+    Number(version) === rfidAllowlist.version &&
+    bloom === rfidAllowlist.bloom &&
+    (Number(mode) === 1) === bloom &&
+    (bloom ? !removed.length : fresh.length + removed.length <= RFID_ALLOWLIST_MAX_DELTA);
+
+  const nextVersion = Math.max(Math.floor(Date.now() / 1000), rfidAllowlist.version + 1);
+  const base = delta ? rfidAllowlist.version : 0;
+  await rfidCommand(`AL BEGIN ${base} ${nextVersion}${bloom ? ` BLOOM ${RFID_BLOOM_HASHES}` : ''}`,
+    bloom && !delta ? RFID_ALLOWLIST_CLEAR_TIMEOUT_MS : undefined);
+
+  const added = (delta ? fresh : [...uids]).sort((a, b) => rfidUidKey(a) - rfidUidKey(b));
+  if (delta) {
+    for (const uid of removed) await rfidCommand(`AL - ${uid}`);
+  }
+  for (const uid of added) await rfidCommand(`AL + ${uid}`);
+  await rfidCommand('AL END');
+
+  rfidAllowlist = { version: nextVersion, bloom, uids };
+  console.log(`RFID allowlist v${nextVersion}: ${delta ? `+${added.length} -${removed.length}` : `${uids.size} cards`}`);
+}
+
+function syncRfidAllowlist() {
+  rfidAllowlistSync = rfidAllowlistSync
+    .then(pushRfidAllowlist)
+    .catch(err => console.error('RFID allowlist sync failed:', err.message));
+  return rfidAllowlistSync;
+}
+
+function greetRfidReader() {
+  rfidCommand('HELLO')
+    .then(syncRfidAllowlist)
+    .catch(err => console.error('RFID reader handshake failed:', err.message));
+}
+
+// Sequence number of the last buffered scan handed to handleCardScan, so a
+// batch re-sent after a lost ACK is not recorded twice. Reset when the
+// reader reboots and starts counting from 1 again.
+let lastRfidEventSeq = 0;
+
+// readerNow and at are reader millis(); the difference dates a scan that
+// sat in the reader's buffer while the server was away.
+function handleRfidEvent(seq, at, readerNow, uid, record = null) {
+  if (seq <= lastRfidEventSeq) return;
+  lastRfidEventSeq = seq;
+  handleCardScan(uid, new Date(Date.now() - Math.max(0, readerNow - at)), undefined, false, record);
+}
+
+// Text protocol. Buffered scans arrive as
+//   BATCH:<count>:<now>, EVT:<seq>:<at>:<reader>:<uid>[:<record>]..., END:<lastSeq>
+// and are acknowledged with "ACK <lastSeq>". Readers built with
+// REQUIRE_ACK 0 send one "UID:<hex>[:<record>]" line per card instead.
+const RFID_BATCH_LINE = /^BATCH:(\d+):(\d+)$/;
+const RFID_EVT_LINE = /^EVT:(\d+):(\d+):(\d+):((?:[0-9A-F]{2}){1,10})(?::([0-9A-F]{28}))?$/;
+const RFID_END_LINE = /^END:(\d+)$/;
+
+// Lines carry no checksum, so a batch is only taken whole: every EVT line
+// parsed and as many as BATCH announced. Its events are handled, and
+// acknowledged, up to the last one whose seq follows on from
+// lastSeq - count + 1. Anything else is left for the reader to resend
+// after its ACK timeout, so a line damaged on the wire is neither lost
+// nor recorded under a wrong seq.
+function finishTextRfidBatch(port, batch, end) {
+  const match = RFID_END_LINE.exec(end);
+  if (!batch || batch.damaged || !match || batch.events.length !== batch.count || batch.count === 0) {
+    console.warn('RFID batch incomplete, waiting for the reader to resend it');
+    return;
+  }
+
+  const first = Number(match[1]) - batch.count + 1;
+  let acked = null;
+  for (const [i, event] of batch.events.entries()) {
+    if (event.seq !== first + i) break;
+    handleRfidEvent(event.seq, event.at, batch.now, event.uid, event.record);
+    acked = event.seq;
+  }
+  if (acked !== null) port.write(`ACK ${acked}\n`);
+}
+
+function attachTextRfidProtocol(port) {
+  const parser = port.pipe(new ReadlineParser({ delimiter: '\r\n' }));
+  let batch = null;   // between BATCH: and END:
+
+  port.on('open', greetRfidReader);
+
+  parser.on('data', (data) => {
+    console.log('Raw RFID data:', data); // Debug output
+
+    if (data.length > 0) {
+      const uid = data.trim();
+      console.log('Potential UID:', uid);
+      io.emit('raw-data', { data, uid }); // Send to frontend for debugging
+    }
+
+    if (handleRfidReply(data.trim())) {
+      return;
+    } else if (data.startsWith('UID:')) {
+      const [, uid, record] = data.trim().split(':');
+      handleCardScan(uid, new Date(), undefined, false, rfidCardRecord(record && Buffer.from(record, 'hex')));
+    } else if (data.startsWith('BATCH:')) {
+      const match = RFID_BATCH_LINE.exec(data);
+      batch = match && { count: Number(match[1]), now: Number(match[2]), events: [], damaged: false };
+    } else if (data.startsWith('EVT:')) {
+      const match = RFID_EVT_LINE.exec(data);
+      if (!batch) return;
+      if (!match) {
+        batch.damaged = true;
+        return;
+      }
+      const [, seq, at, , uid, record] = match;
+      batch.events.push({ seq: Number(seq), at: Number(at), uid,
+        record: rfidCardRecord(record && Buffer.from(record, 'hex')) });
+    } else if (data.startsWith('END:')) {
+      finishTextRfidBatch(port, batch, data);
+      batch = null;
+    } else if (data.startsWith('RFID Reader Ready')) {
+      lastRfidEventSeq = 0;
+      batch = null;
+      resetRfidReplies();
+      greetRfidReader();
+    }
+  });
+}
+
+// Payload of a RFID_FRAME_BATCH: <now u32><count u8> then per event
+// <seq u32><at u32><reader u8><size u8><uid...>[<record>], the 0x80 bit
+// of size flagging a card record after the UID.
+function handleRfidBatchFrame(port, payload) {
+  if (payload.length < 5) return;
+  const readerNow = payload.readUInt32LE(0);
+  const count = payload[4];
+  let pos = 5;
+  let lastSeq = null;
+
+  for (let i = 0; i < count && pos + 10 <= payload.length; i++) {
+    const seq = payload.readUInt32LE(pos);
+    const at = payload.readUInt32LE(pos + 4);
+    const size = payload[pos + 9] & 0x7F;
+    const recordLen = payload[pos + 9] & 0x80 ? RFID_CARD_RECORD_LEN : 0;
+    const uid = payload.subarray(pos + 10, pos + 10 + size).toString('hex').toUpperCase();
+    const record = rfidCardRecord(recordLen ? payload.subarray(pos + 10 + size, pos + 10 + size + recordLen) : null);
+    pos += 10 + size + recordLen;
+    handleRfidEvent(seq, at, readerNow, uid, record);
+    lastSeq = seq;
+  }
+
+  if (lastSeq !== null) port.write(`ACK ${lastSeq}\n`);
+}
+
+// Binary protocol: ask the reader to switch with "FMT BIN <baud>", follow it
+// to the new baud rate once it answers, then decode frames. If the reader is
+// already in binary mode (host restarted without resetting the board) the
+// first request goes unanswered, so retry once at the binary baud rate.
+// A reboot starts this over from the boot baud.
+function attachBinaryRfidProtocol(port) {
+  const bootBaud = port.baudRate;
+  const binaryBaud = parseInt(process.env.RFID_BINARY_BAUD_RATE) || 115200;
+  const command = `FMT BIN ${binaryBaud}\n`;
+  let negotiated = false;
+  let handshake = '';
+
+  const negotiate = () => {
+    negotiated = false;
+    handshake = '';
+    port.write(command);
+    setTimeout(() => {
+      if (negotiated || !port.isOpen) return;
+      port.update({ baudRate: binaryBaud }, () => port.write(command));
+    }, 1000);
+  };
+
+  const decode = createRfidFrameDecoder((frame) => {
+    if (frame.type === RFID_FRAME_SCAN) {
+      // A UID is at most 10 bytes; a longer payload ends with a card record.
+      const size = frame.payload.length > 10 ? frame.payload.length - RFID_CARD_RECORD_LEN : frame.payload.length;
+      handleCardScan(frame.payload.subarray(0, size).toString('hex').toUpperCase(), new Date(), undefined, false,
+        rfidCardRecord(frame.payload.subarray(size)));
+    } else if (frame.type === RFID_FRAME_BATCH) {
+      handleRfidBatchFrame(port, frame.payload);
+    } else if (frame.type === RFID_FRAME_TEXT) {
+      const text = frame.payload.toString('latin1');
+      if (text.startsWith('RFID Reader Ready')) {
+        // Rebooted on a stored binary link: seqs count from 1 again and
+        // the session (FMT, HELLO) is gone.
+        lastRfidEventSeq = 0;
+        resetRfidReplies();
+        port.update({ baudRate: bootBaud }, negotiate);
+      } else if (!handleRfidReply(text)) {
+        console.log('RFID reader:', text);
+      }
+    }
+  });
+
+  port.on('data', (chunk) => {
+    if (negotiated) {
+      decode(chunk);
+      return;
+    }
+
+    handshake = (handshake + chunk.toString('latin1')).slice(-64);
+    if (handshake.includes('OK FMT')) {
+      negotiated = true;
+      port.update({ baudRate: binaryBaud }, (err) => {
+        if (err) {
+          console.error('Failed to switch RFID baud rate:', err.message);
+          return;
+        }
+        greetRfidReader();
+      });
+      console.log(`RFID reader switched to binary frames at ${binaryBaud} baud`);
+    }
+  });
+
+  port.on('open', negotiate);
+}
+
+// Keeps readerd's UID index in step with the Card collection.
+function sendRfidDaemon(line) {
+  if (rfidDaemon && !rfidDaemon.destroyed) rfidDaemon.write(line + '\n');
+}
+
+// "CLASS <id> <day>@<HH:MM>,... <studentId>..." for readerd's timetable.
+function rfidDaemonClassLine(cls) {
+  const sessions = (cls.schedule || [])
+    .filter(session => SCHEDULE_DAYS.includes(session.day) && /^\d{1,2}:\d{2}$/.test(session.time || ''))
+    .map(session => `${SCHEDULE_DAYS.indexOf(session.day)}@${session.time}`);
+  const students = (cls.students || []).map(student => String(student._id || student));
+  return `CLASS ${cls._id} ${sessions.join(',') || '-'} ${students.join(' ')}`.trim();
+}
+
+async function pushRfidDaemonSnapshot() {
+  const cards = await Card.find({ active: { $ne: false } }).populate('student', 'name');
+  const classes = await Class.find({}, 'schedule students');
+  const lines = ['CLEAR'];
+  for (const card of cards) {
+    if (card.student) lines.push(`PUT ${card.uid} ${card.student._id} ${card.student.name}`);
+  }
+  for (const cls of classes) lines.push(rfidDaemonClassLine(cls));
+  rfidDaemon.write(lines.join('\n') + '\n');
+  console.log(`RFID daemon snapshot: ${cards.length} cards, ${classes.length} classes`);
+}
+
+// readerd started with --log keeps every tap in its scan log. Attendance is
+// pulled from it in batches and written with one bulkWrite; the ids come
+// from the log, so a batch written twice (crash before COMMIT) lands once.
+const RFID_EXPORT_INTERVAL_MS = 5000;
+const RFID_EXPORT_BATCH = 1000;
+let rfidExportPending = false;
+let rfidExportTimer = null;
+
+function requestRfidExport() {
+  if (rfidExportPending || !rfidDaemon || rfidDaemon.destroyed) return;
+  rfidExportPending = true;
+  rfidDaemon.write(`EXPORT ${RFID_EXPORT_BATCH}\n`);
+}
+
+async function handleRfidExport(batch) {
+  let committed = false;
+  try {
+    if (batch.records.length) {
+      await Attendance.bulkWrite(batch.records.map(record => ({
+        updateOne: {
+          filter: { _id: record.id },
+          update: {
+            $setOnInsert: {
+              student: record.student,
+              class: record.class,
+              date: new Date(record.date),
+              status: 'present'
+            }
+          },
+          upsert: true
+        }
+      })), { ordered: false });
+    }
+    sendRfidDaemon(`COMMIT ${batch.next}`);
+    committed = true;
+  } catch (err) {
+    console.error('RFID attendance export failed:', err.message);
+  } finally {
+    rfidExportPending = false;
+  }
+  if (committed && batch.more) requestRfidExport();
+}
+
+// readerd (reader/readerd.cpp) owns the serial port and publishes one JSON
+// line per scan, so taps are parsed and resolved outside this event loop.
+function initializeRFIDDaemon(socketPath) {
+  rfidDaemon = net.createConnection(socketPath);
+  const parser = rfidDaemon.pipe(new ReadlineParser({ delimiter: '\n' }));
+
+  rfidDaemon.on('connect', () => {
+    console.log(`RFID daemon connected on ${socketPath}`);
+    rfidExportTimer = setInterval(requestRfidExport, RFID_EXPORT_INTERVAL_MS);
+    pushRfidDaemonSnapshot()
+      .then(syncRfidAllowlist)
+      .catch(err => console.error('RFID daemon snapshot failed:', err.message));
+  });
+
+  parser.on('data', (line) => {
+    let event;
+    try {
+      event = JSON.parse(line);
+    } catch (err) {
+      return;
+    }
+
+    if (event.type === 'scan' || event.type === 'unknown-card') {
+      const logged = event.record !== undefined && event.class !== undefined;
+      // readerd prefers its index over the card's record for the student.
+      const record = event.card ? { ...event.card, student: event.student } : null;
+      handleCardScan(event.uid, new Date(event.scannedAt), event.class, logged, record);
+    } else if (event.type === 'export') {
+      handleRfidExport(event);
+    } else if (event.type === 'reply' && event.text.startsWith('EXPORT')) {
+      // readerd runs without --log: nothing to export.
+      clearInterval(rfidExportTimer);
+      rfidExportPending = false;
+    } else if (event.type === 'reader') {
+      if (event.text.startsWith('RFID Reader Ready')) {
+        resetRfidReplies();
+        syncRfidAllowlist();
+      } else if (!/^OK (HELLO|FMT)/.test(event.text)) {
+        // HELLO and FMT are readerd's own handshake, not our commands.
+        handleRfidReply(event.text);
+      }
+    }
+  });
+
+  rfidDaemon.on('error', err => console.error('RFID daemon error:', err.message));
+  rfidDaemon.on('close', () => {
+    console.log('RFID daemon connection closed, retrying in 5 seconds...');
+    resetRfidReplies();
+    clearInterval(rfidExportTimer);
+    rfidExportPending = false;
+    setTimeout(() => initializeRFIDDaemon(socketPath), 5000);
+  });
+}
 
 function initializeRFIDReader() {
+  if (process.env.RFID_DAEMON_SOCKET) {
+    initializeRFIDDaemon(process.env.RFID_DAEMON_SOCKET);
+    return;
+  }
+
   const portName = process.env.RFID_PORT;
   const baudRate = parseInt(process.env.RFID_BAUD_RATE) || 9600;
+  const protocol = process.env.RFID_PROTOCOL || 'text';
 
   if (!portName) {
     console.error('RFID_PORT not configured in .env file');
@@ -580,100 +1288,11 @@ function initializeRFIDReader() {
       console.log(`RFID reader connected successfully on ${portName}`);
     });
 
-    const parser = serialPort.pipe(new ReadlineParser({ delimiter: '\r\n' }));
-
-    parser.on('data', async (data) => {
-      console.log('Raw RFID data:', data); // Debug output
-      
-      if (data.length > 0) {
-        const uid = data.trim();
-        console.log('Potential UID:', uid);
-        io.emit('raw-data', { data, uid }); // Send to frontend for debugging
-      }
-
-      if (data.startsWith('UID:')) {
-        const uid = data.trim().substring(4).trim();
-        console.log('Card detected:', uid);
-
-        try {
-          const card = await Card.findOne({ uid }).populate('student');
-          if (card) {
-            const student = await Student.findById(card.student._id)
-              .populate({
-                path: 'classes',
-                populate: [
-                  { path: 'teacher', model: 'Teacher' },
-                  { path: 'students', model: 'Student' }
-                ]
-              });
-
-            const payments = await Payment.find({ student: card.student._id, status: { $in: ['pending', 'late'] } })
-              .populate('class');
-
-            // Check if any class is scheduled now
-            const now = new Date();
-            const day = ['الأحد', 'الإثنين', 'الثلاثاء', 'الأربعاء', 'الخميس', 'الجمعة', 'السبت'][now.getDay()];
-            const currentHour = now.getHours();
-            const currentMinute = now.getMinutes();
-
-            let currentClass = null;
-
-            for (const cls of student.classes || []) {
-              for (const schedule of cls.schedule || []) {
-                if (schedule.day === day) {
-                  const [hour, minute] = schedule.time.split(':').map(Number);
-                  if (Math.abs((hour - currentHour) * 60 + (minute - currentMinute)) <= 30) {
-                    currentClass = cls;
-                    break;
-                  }
-                }
-              }
-              if (currentClass) break;
-            }
-
-            if (currentClass) {
-              // Record attendance
-              const attendance = new Attendance({
-                student: student._id,
-                class: currentClass._id,
-                date: now,
-                status: 'present'
-              });
-              await attendance.save();
-
-              // Send SMS to parent
-              // const smsContent = `تم تسجيل حضور الطالب ${student.name} في حصة ${currentClass.name} في ${now.toLocaleString()}`;
-
-              try {
-                await smsGateway.send(student.parentPhone, smsContent);
-                await Message.create({
-                  sender: null,
-                  recipients: [{ student: student._id, parentPhone: student.parentPhone }],
-                  class: currentClass._id,
-                  content: smsContent,
-                  messageType: 'individual'
-                });
-              } catch (smsErr) {
-                console.error('Failed to send SMS:', smsErr);
-              }
-            }
-
-            io.emit('student-detected', {
-              student,
-              card,
-              classes: student.classes || [],
-              payments: payments || [],
-              currentClass
-            });
-          } else {
-            io.emit('unknown-card', { uid });
-          }
-        } catch (err) {
-          console.error('Error processing card:', err);
-          io.emit('card-error', { error: 'Error processing card' });
-        }
-      }
-    });
+    if (protocol === 'binary') {
+      attachBinaryRfidProtocol(serialPort);
+    } else {
+      attachTextRfidProtocol(serialPort);
+    }
 
     serialPort.on('error', err => {
       console.error('RFID reader error:', err.message);
@@ -1028,6 +1647,7 @@ app.post('/api/classes', authenticate(['admin', 'secretary']), async (req, res)
   try {
     const classObj = new Class(req.body);
     await classObj.save();
+    sendRfidDaemon(rfidDaemonClassLine(classObj));
     res.status(201).json(classObj);
   } catch (err) {
     res.status(400).json({ error: err.message });
@@ -1058,6 +1678,7 @@ app.put('/api/classes/:id', authenticate(['admin', 'secretary']), async (req, re
       .populate('students')
       .populate('schedule.classroom');
 
+    if (classObj) sendRfidDaemon(rfidDaemonClassLine(classObj));
     res.json(classObj);
   } catch (err) {
     res.status(400).json({ error: err.message });
@@ -1078,6 +1699,7 @@ app.delete('/api/classes/:id', authenticate(['admin']), async (req, res) => {
 
     // Delete the class
     await Class.findByIdAndDelete(req.params.id);
+    sendRfidDaemon(`UNCLASS ${req.params.id}`);
 
     res.json({ message: 'تم حذف الحصة بنجاح' });
   } catch (err) {
@@ -1128,6 +1750,7 @@ app.post('/api/classes/:classId/enroll/:studentId', authenticate(['admin', 'secr
       student.classes.push(req.params.classId);
       await student.save();
     }
+    sendRfidDaemon(`ENROLL ${req.params.classId} ${req.params.studentId}`);
 
     // 4. Create monthly payments for student starting from enrollment date (now)
     const enrollmentDate = new Date(); // Use current date as enrollment date
@@ -1203,6 +1826,7 @@ app.delete('/api/classes/:classId/unenroll/:studentId', authenticate(['admin', '
       req.params.studentId,
       { $pull: { classes: req.params.classId } }
     );
+    sendRfidDaemon(`UNENROLL ${req.params.classId} ${req.params.studentId}`);
 
     // Delete associated payments
     await Payment.deleteMany({
@@ -1267,9 +1891,12 @@ app.get('/api/cards', authenticate(['admin', 'secretary']), async (req, res) =>
   }
 });
 
+// With `encode`, the card is also written with the student's record the
+// next time it is tapped on the reader, so its scans need no lookup; the
+// reply then waits for that tap and reports it in `encoded`.
 app.post('/api/cards', authenticate(['admin', 'secretary']), async (req, res) => {
   try {
-    const { uid, student } = req.body;
+    const { uid, student, encode } = req.body;
 
     // First check if card is authorized
     const authorizedCard = await AuthorizedCard.findOne({ 
@@ -1303,6 +1930,7 @@ app.post('/api/cards', authenticate(['admin', 'secretary']), async (req, res) =>
     });
 
     await card.save();
+    sendRfidDaemon(`PUT ${uid} ${student} ${studentExists.name}`);
     
     // Update authorized card with student assignment info
     await AuthorizedCard.findByIdAndUpdate(authorizedCard._id, {
@@ -1312,7 +1940,13 @@ app.post('/api/cards', authenticate(['admin', 'secretary']), async (req, res) =>
       }
     });
 
-    res.status(201).json(card);
+    if (!encode) return res.status(201).json(card);
+    try {
+      await encodeRfidCard(String(uid).toUpperCase(), studentExists);
+      res.status(201).json({ ...card.toObject(), encoded: true });
+    } catch (encodeErr) {
+      res.status(201).json({ ...card.toObject(), encoded: false, encodeError: encodeErr.message });
+    }
   } catch (err) {
     console.error('Error creating card:', err);
     res.status(400).json({ error: err.message });
@@ -1321,7 +1955,8 @@ app.post('/api/cards', authenticate(['admin', 'secretary']), async (req, res) =>
 
 app.delete('/api/cards/:id', authenticate(['admin']), async (req, res) => {
   try {
-    await Card.findByIdAndDelete(req.params.id);
+    const card = await Card.findByIdAndDelete(req.params.id);
+    if (card) sendRfidDaemon(`DEL ${card.uid}`);
     res.json({ message: 'تم حذف البطاقة بنجاح' });
   } catch (err) {
     res.status(500).json({ error: err.message });
@@ -1354,6 +1989,73 @@ app.get('/api/cards/uid/:cardId',  async (req, res) => {
   }
 });
 
+// RFID reader diagnostics
+app.get('/api/rfid/stats', authenticate(['admin']), async (req, res) => {
+  try {
+    res.json(await readRfidStats());
+  } catch (error) {
+    res.status(503).json({ error: error.message });
+  }
+});
+
+app.post('/api/rfid/stats/reset', authenticate(['admin']), async (req, res) => {
+  try {
+    await rfidCommand('STATS RESET');
+    res.json({ message: 'RFID reader statistics reset' });
+  } catch (error) {
+    res.status(503).json({ error: error.message });
+  }
+});
+
+// Runtime reader settings ("CFG"), kept in the board's EEPROM. The link
+// keys go last: the reader switches right after answering them.
+const RFID_CONFIG_KEYS = {
+  gainDb: 'GAIN',
+  debounceMs: 'DEBOUNCE',
+  pollIntervalMs: 'POLL',
+  baud: 'BAUD',
+  format: 'FMT'
+};
+
+async function readRfidConfig() {
+  const fields = Object.fromEntries((await rfidCommand('CFG GET')).split(' ').slice(2).map(f => f.split('=')));
+  return {
+    gainDb: Number(fields.GAIN),
+    debounceMs: Number(fields.DEBOUNCE),
+    pollIntervalMs: Number(fields.POLL),
+    baud: Number(fields.BAUD),
+    format: fields.FMT === 'BIN' ? 'binary' : 'text'
+  };
+}
+
+app.get('/api/rfid/config', authenticate(['admin']), async (req, res) => {
+  try {
+    res.json(await readRfidConfig());
+  } catch (error) {
+    res.status(503).json({ error: error.message });
+  }
+});
+
+app.put('/api/rfid/config', authenticate(['admin']), async (req, res) => {
+  const changes = Object.keys(RFID_CONFIG_KEYS).filter(key => req.body[key] !== undefined);
+  // readerd follows a baud or format change; our own serial port does not.
+  if ((changes.includes('baud') || changes.includes('format')) && !rfidDaemon) {
+    return res.status(400).json({ error: 'baud and format can only be changed through readerd' });
+  }
+  if (changes.includes('format') && !['text', 'binary'].includes(req.body.format)) {
+    return res.status(400).json({ error: 'format must be text or binary' });
+  }
+  try {
+    for (const key of changes) {
+      const value = key === 'format' ? (req.body.format === 'binary' ? 'BIN' : 'TXT') : parseInt(req.body[key], 10);
+      await rfidCommand(`CFG SET ${RFID_CONFIG_KEYS[key]} ${value}`);
+    }
+    res.json(await readRfidConfig());
+  } catch (error) {
+    res.status(error.message.startsWith('ERR CFG') ? 400 : 503).json({ error: error.message });
+  }
+});
+
 
 
 // Payments